@@ -0,0 +1,15 @@
+int printf(const char *, ...);
+int x = 5;
+int arr[4] = {1,2,3,4};
+static int *p = &x;
+int *q = &arr[2];
+static const int *cq = &arr[1];
+const char *s = "hello";
+char buf[] = "abc";
+const int ci = 0;
+const int carr[3] = {7, 8, 9};
+struct S { int a; int *p; char c; } st = { 3, &x, 'z' };
+int main(void) {
+    printf("%d %d %d %s %s %d %d %d %d %c\n", *p, *q, *cq, s, buf, ci, carr[2], st.a, *st.p, st.c);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Region of memory where objects are allocated by bumping a pointer, and all
+ * released together. Grows in chunks, which are kept for reuse by other arenas
+ * when released.
+ */
+struct arena;
+
+/* Create new empty arena.
+ */
+struct arena *arena_init(void);
+
+/* Allocate zero initialized memory, suitably aligned for any object.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/* Grow object allocated in arena from old to size bytes, preserving contents
+ * and zero initializing the remainder. Extends in place if ptr is the last
+ * object allocated, otherwise the object is copied. Old memory is not reused
+ * until the arena is freed.
+ */
+void *arena_realloc(struct arena *arena, void *ptr, size_t old, size_t size);
+
+/* Release all memory allocated in arena, and the arena itself.
+ */
+void arena_free(struct arena *arena);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef HASH_H
 #define HASH_H
 
+#include <stddef.h>
+
 /* Compute hash of string.
  */
 unsigned long djb2_hash(const char *str);
@@ -9,4 +11,38 @@ unsigned long djb2_hash(const char *str);
  */
 unsigned long djb2_hash_p(const char *str, const char *endptr);
 
+/* Compute hash of string of length n, reading a word of eight characters at a
+ * time.
+ */
+unsigned long word_hash(const char *str, size_t n);
+
+/* Hash table from strings to values, using open addressing with linear
+ * probing. Keys are copied and owned by the table. A zero initialized table is
+ * empty and ready for use.
+ */
+struct hash_table {
+    struct hash_entry {
+        char *key;
+        void *value;
+    } *entry;
+    size_t count;
+    size_t capacity;
+};
+
+/* Find entry with key, or NULL if not present.
+ */
+struct hash_entry *hash_table_lookup(
+    const struct hash_table *table,
+    const char *key);
+
+/* Find entry with key, adding it with NULL value if not present. Entries move
+ * when the table grows, so the pointer is only valid until the next insert.
+ */
+struct hash_entry *hash_table_insert(struct hash_table *table, const char *key);
+
+/* Free all memory held by table, calling free_value on each value unless it
+ * is NULL.
+ */
+void hash_table_free(struct hash_table *table, void (*free_value)(void *));
+
 #endif
@@ -1,6 +1,7 @@
 #ifndef IR_H
 #define IR_H
 
+#include "arena.h"
 #include "symbol.h"
 
 #include <stddef.h>
@@ -11,6 +12,13 @@
 #define NOPERANDS(t) ((t) > IR_CAST ? 2 : (t) > IR_PARAM)
 #define IS_COMPARISON(t) ((t) == IR_OP_EQ || (t) == IR_OP_GE || (t) == IR_OP_GT)
 
+/* Iterate over all successors of a block, covering both jump targets and jump
+ * table entries. Successors can be NULL, and the same block can occur more
+ * than once.
+ */
+#define N_SUCCESSORS(b) (2 + (b)->n_table)
+#define SUCCESSOR(b, i) (*((i) < 2 ? &(b)->jump[i] : &(b)->table[(i) - 2]))
+
 /* Three address code operation types.
  */
 enum optype {
@@ -45,7 +53,11 @@ enum optype {
 
     /* Call a = va_arg(b, T), with type T taken from a. Intercepted as call to
      * __builtin_va_arg in parser. */
-    IR_VA_ARG
+    IR_VA_ARG,
+
+    /* Set all bytes of a to zero, where a can be of any object type. Used to
+     * clear aggregates in initializers without one assignment per member. */
+    IR_ZERO
 };
 
 /* A reference to some storage location or direct value, used in intermediate
@@ -86,7 +98,8 @@ struct block {
     /* Unique jump target address, symbol of type SYM_LABEL. */
     const struct symbol *label;
 
-    /* Realloc-able list of 3-address code operations. */
+    /* List of 3-address code operations, allocated in the arena of the
+     * definition owning the block. */
     struct op {
         enum optype type;
         struct var a;
@@ -94,8 +107,9 @@ struct block {
         struct var c;
     } *code;
 
-    /* Number of ir operations. */
+    /* Number of ir operations, and number allocated for. */
     int n;
+    int capacity;
 
     /* Toggle last statement was return, meaning expr is valid. There are cases
      * where we reach end of control in a non-void function, but not wanting to
@@ -114,6 +128,17 @@ struct block {
      * - (x, y)      : False and true branch targets, respectively. */
     struct block *jump[2];
 
+    /* Indirect branch through a table of targets, indexed by integer expr.
+     * Control is transferred to table[expr] if expr is in range [0, n_table),
+     * and to jump[0] otherwise. Only used with jump[1] being NULL. */
+    struct block **table;
+    int n_table;
+
+    /* Set by parser on blocks where the value of a logical expression is
+     * joined. Holds the branches deciding the value, which are redirected
+     * straight to the targets if the result is only used as a condition. */
+    struct logical_exits *exits;
+
     /* Used to mark nodes as visited during graph traversal. */
     enum color {
         WHITE,
@@ -159,6 +184,13 @@ struct definition {
      * as a series of assignment IR operations. */
     struct block *body;
 
+    /* Constant initializers of static and extern definitions are written to
+     * an image of the object while parsing, leaving only assignments of
+     * addresses in body. Image is NULL if all bytes are zero, otherwise at
+     * least the size of symbol. */
+    char *data;
+    size_t data_capacity;
+
     /* Store all symbols associated with a function definition. Need non-const
      * references, as backend will use this to assign stack offset of existing
      * symbols. */
@@ -169,6 +201,10 @@ struct definition {
     /* Store all associated nodes in a list to be able to free everything at
      * the end. */
     struct block_list nodes;
+
+    /* Memory for blocks, operations, jump tables and lists of symbols and
+     * nodes, released all at once when the definition is freed. */
+    struct arena *arena;
 };
 
 /* Parse input for the next function or object definition. Symbol is NULL on
@@ -0,0 +1,32 @@
+#ifndef STRTAB_H
+#define STRTAB_H
+
+#include <stddef.h>
+
+/* Register a string and store it internally, allocating a new copy if needed.
+ * Manages memory ownership for all string constants used at runtime. Equal
+ * strings are always registered at the same address.
+ */
+const char *str_register(const char *s);
+const char *str_register_n(const char *s, size_t n);
+
+/* Register string and return its index, which is never zero. Equal strings
+ * have the same index.
+ */
+unsigned str_index(const char *s, size_t n);
+
+/* Look up registered string by index.
+ */
+const char *str_at(unsigned index);
+
+/* Length of string returned from str_register, without scanning for the null
+ * terminator. Not valid for any other string.
+ */
+size_t str_len(const char *s);
+
+/* Hash value of string returned from str_register, computed once when the
+ * string was first registered. Not valid for any other string.
+ */
+unsigned str_hash(const char *s);
+
+#endif
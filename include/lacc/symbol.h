@@ -51,6 +51,10 @@ struct symbol {
      * during parsing, but assigned when passed to back-end. */
     int stack_offset;
 
+    /* Register holding parameter or local variable for the duration of the
+     * function, or 0 if kept in memory. Assigned by back-end. */
+    int regno;
+
     /* Scope depth. */
     int depth;
 };
@@ -69,7 +73,8 @@ extern const struct symbol *decl_memcpy;
  */
 const char *sym_name(const struct symbol *sym);
 
-/* Create a jump label symbol, of type void.
+/* Create a jump label symbol, of type void. Labels are local to the function
+ * they are created for, and released after it is compiled.
  */
 struct symbol *sym_create_label(void);
 
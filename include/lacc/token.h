@@ -99,15 +99,25 @@ enum token_type {
     STRING
 };
 
-/* Every token has a reference to its textual value. The integer value is
- * kept for numeric constants.
+/* Tokens are small handles, copied by value. Identifiers, numbers, strings
+ * and whitespace refer to their textual value by index in the table of
+ * registered strings. Keywords and operators have index zero, with text given
+ * by their type. The value of integer constants is kept separately, looked up
+ * by the same index.
  */
 struct token {
     enum token_type token;
-    const char *strval;
-    long intval;
+    unsigned str;
 };
 
+/* Textual value of token.
+ */
+const char *tokstr(struct token t);
+
+/* Numeric value of integer constant.
+ */
+long tokval(struct token t);
+
 /* Peek lookahead of 1.
  */
 struct token peek(void);
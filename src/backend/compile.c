@@ -3,7 +3,10 @@
 #include "x86_64/assemble.h"
 #include "x86_64/elf.h"
 #include "x86_64/instructions.h"
+#include "x86_64/peephole.h"
+#include "x86_64/registers.h"
 #include "compile.h"
+#include "ssa.h"
 #include <lacc/cli.h>
 
 #include <assert.h>
@@ -12,9 +15,15 @@
 static enum compile_target compile_target;
 static FILE *output_stream;
 
-static int (*enter_context)(const struct symbol *);
+static int (*emit_symbol)(const struct symbol *);
 static int (*emit_instruction)(struct instruction);
 static int (*emit_data)(struct immediate);
+static int (*emit_bytes)(const char *, size_t);
+static int (*emit_bss)(const struct symbol *);
+static int (*emit_rodata)(const struct symbol *);
+static int (*emit_jump_table)(
+    const struct symbol *, const struct symbol **, int);
+static int (*flush_function)(void);
 static int (*flush_backend)(void);
 
 /* Values from va_list initialization.
@@ -24,8 +33,47 @@ static int fp_offset;
 static int overflow_arg_area_offset;
 static int reg_save_area_offset;
 
+/* Callee saved registers used by register allocation, and the stack offset
+ * where they are saved on entering a function.
+ */
+static enum reg saved_regs[MAX_CALLEE_SAVED];
+static int n_saved_regs;
+static int saved_regs_offset;
+
+/* Maximum number of quadwords to clear with individual stores, before using
+ * rep stosq instead.
+ */
+#define ZERO_STORE_LIMIT 8
+
+/* Maximum number of bytes to copy with individual moves, before using rep
+ * movsq instead. Copies larger than COPY_CALL_LIMIT call memcpy.
+ */
+#define COPY_MOVE_LIMIT 64
+
 static void compile_block(struct block *block, const enum param_class *res);
 
+/* Last instruction emitted. Repeating a move between registers has no effect,
+ * as the value is already in place. Labels can be reached from elsewhere, and
+ * start over with no instruction seen.
+ */
+static struct instruction last_instr;
+
+static int enter_context(const struct symbol *sym)
+{
+    last_instr.optype = OPT_NONE;
+    return emit_symbol(sym);
+}
+
+static int is_repeated_move(struct instruction instr)
+{
+    return instr.opcode == INSTR_MOV && instr.optype == OPT_REG_REG
+        && last_instr.opcode == INSTR_MOV && last_instr.optype == OPT_REG_REG
+        && instr.source.reg.r == last_instr.source.reg.r
+        && instr.source.reg.w == last_instr.source.reg.w
+        && instr.dest.reg.r == last_instr.dest.reg.r
+        && instr.dest.reg.w == last_instr.dest.reg.w;
+}
+
 static void emit(enum opcode opcode, enum instr_optype optype, ...)
 {
     va_list args;
@@ -69,7 +117,10 @@ static void emit(enum opcode opcode, enum instr_optype optype, ...)
     }
 
     va_end(args);
-    emit_instruction(instr);
+    if (!is_repeated_move(instr)) {
+        last_instr = instr;
+        emit_instruction(instr);
+    }
 }
 
 static struct registr reg(enum reg r, int w)
@@ -121,6 +172,7 @@ static struct address address_of(struct var var)
 {
     struct address addr = {0};
     assert(var.kind == DIRECT);
+    assert(!var.symbol->regno);
 
     if (var.symbol->linkage != LINK_NONE) {
         addr.base = IP;
@@ -161,8 +213,11 @@ static struct immediate constant(int n, int w)
     return value_of(var_int(n), w);
 }
 
+static enum reg load_base(const struct symbol *sym);
+
 /* Load variable v to register r, sign extended to fit register size. Width must
- * be either 4 (as in %eax) or 8 (as in %rax).
+ * be either 4 (as in %eax) or 8 (as in %rax). Nothing is emitted if the value
+ * is already kept in r.
  */
 static enum reg load_value(struct var v, enum reg r, int w)
 {
@@ -189,13 +244,15 @@ static enum reg load_value(struct var v, enum reg r, int w)
 
     switch (v.kind) {
     case DIRECT:
-        emit(opcode, OPT_MEM_REG, location_of(v, s), reg(r, w));
+        if (!v.symbol->regno)
+            emit(opcode, OPT_MEM_REG, location_of(v, s), reg(r, w));
+        else if (opcode != INSTR_MOV || v.symbol->regno != r)
+            emit(opcode, OPT_REG_REG, reg(v.symbol->regno, s), reg(r, w));
         break;
     case DEREF:
-        assert(is_pointer(&v.symbol->type));
-        load_value(var_direct(v.symbol), R11, size_of(&v.symbol->type));
         emit(opcode, OPT_MEM_REG,
-            location(address(v.offset, R11, 0, 0), s), reg(r, w));
+            location(address(v.offset, load_base(v.symbol), 0, 0), s),
+            reg(r, w));
         break;
     case IMMEDIATE:
         emit(INSTR_MOV, OPT_IMM_REG, value_of(v, w), reg(r, w));
@@ -218,13 +275,36 @@ static enum reg load(struct var v, enum reg r)
     return load_value(v, r, w);
 }
 
+/* Get register containing value of v, extended to 32 or 64 bit like load. A
+ * variable kept in register with this width is used directly, and must not be
+ * modified by the caller. Other values are loaded to r.
+ */
+static enum reg load_operand(struct var v, enum reg r)
+{
+    int w = size_of(v.type);
+
+    if (v.kind == DIRECT && v.symbol->regno && (w == 4 || w == 8))
+        return v.symbol->regno;
+
+    return load(v, r);
+}
+
+/* Get register holding value of pointer, to be used as base address. Pointers
+ * that are not kept in register are loaded to %r11.
+ */
+static enum reg load_base(const struct symbol *sym)
+{
+    assert(is_pointer(&sym->type));
+    return load_operand(var_direct(sym), R11);
+}
+
 static void load_address(struct var v, enum reg r)
 {
     if (v.kind == DIRECT) {
         emit(INSTR_LEA, OPT_MEM_REG, location_of(v, 8), reg(r, 8));
     } else {
         assert(v.kind == DEREF);
-        assert(v.symbol->stack_offset);
+        assert(v.symbol->stack_offset || v.symbol->regno);
         assert(is_pointer(&v.symbol->type));
 
         load(var_direct(v.symbol), r);
@@ -233,6 +313,73 @@ static void load_address(struct var v, enum reg r)
     }
 }
 
+/* Address of object referenced by v, which can be a string literal. Pointers
+ * not kept in register are loaded to r.
+ */
+static struct address object_address(struct var v, enum reg r)
+{
+    struct address addr = {0};
+
+    switch (v.kind) {
+    case DIRECT:
+        addr = address_of(v);
+        break;
+    case DEREF:
+        assert(is_pointer(&v.symbol->type));
+        addr.disp = v.offset;
+        addr.base = load_operand(var_direct(v.symbol), r);
+        break;
+    case IMMEDIATE:
+        assert(is_string(v));
+        addr.disp = v.offset;
+        addr.base = IP;
+        addr.sym = v.symbol;
+        break;
+    }
+
+    return addr;
+}
+
+/* Copy size bytes between memory locations through %rax, using the widest
+ * moves possible.
+ */
+static void copy_moves(struct address dst, struct address src, int size)
+{
+    int w;
+
+    for (w = 8; size; w /= 2) {
+        while (size >= w) {
+            emit(INSTR_MOV, OPT_MEM_REG, location(src, w), reg(AX, w));
+            emit(INSTR_MOV, OPT_REG_MEM, reg(AX, w), location(dst, w));
+            src.disp += w;
+            dst.disp += w;
+            size -= w;
+        }
+    }
+}
+
+/* Copy object between memory locations. Addresses must not depend on %rdi or
+ * %rsi, except for dst and src themselves, respectively.
+ */
+static void copy(struct address dst, struct address src, int size)
+{
+    if (size <= COPY_MOVE_LIMIT) {
+        copy_moves(dst, src, size);
+        return;
+    }
+
+    emit(INSTR_LEA, OPT_MEM_REG, location(dst, 8), reg(DI, 8));
+    emit(INSTR_LEA, OPT_MEM_REG, location(src, 8), reg(SI, 8));
+    if (size <= COPY_CALL_LIMIT) {
+        emit(INSTR_MOV, OPT_IMM_REG, constant(size / 8, 4), reg(CX, 4));
+        emit(INSTR_REP_MOVSQ, OPT_NONE);
+        copy_moves(address(0, DI, 0, 0), address(0, SI, 0, 0), size % 8);
+    } else {
+        emit(INSTR_MOV, OPT_IMM_REG, constant(size, 8), reg(DX, 4));
+        emit(INSTR_CALL, OPT_IMM, addr(decl_memcpy));
+    }
+}
+
 static void store(enum reg r, struct var v)
 {
     const int w = size_of(v.type);
@@ -241,15 +388,30 @@ static void store(enum reg r, struct var v)
     if (v.kind == DIRECT) {
         assert(!is_array(v.type));
 
-        emit(INSTR_MOV, OPT_REG_MEM, reg(r, w), location_of(v, w));
+        if (!v.symbol->regno)
+            emit(INSTR_MOV, OPT_REG_MEM, reg(r, w), location_of(v, w));
+        else if (v.symbol->regno != r)
+            emit(INSTR_MOV, OPT_REG_REG, reg(r, w), reg(v.symbol->regno, w));
     } else {
         assert(v.kind == DEREF);
-        assert(is_pointer(&v.symbol->type));
+        emit(INSTR_MOV, OPT_REG_MEM, reg(r, w),
+            location(address(v.offset, load_base(v.symbol), 0, 0), w));
+    }
+}
 
-        load_value(var_direct(v.symbol), R11, size_of(&v.symbol->type));
-        emit(INSTR_MOV, OPT_REG_MEM,
-            reg(r, w), location(address(v.offset, R11, 0, 0), w));
+/* Register to compute the result of an operation in, avoiding a move if target
+ * is kept in register. Operand c must not be overwritten before it is read.
+ */
+static enum reg result_reg(const struct op *op)
+{
+    if (op->a.kind == DIRECT && op->a.symbol->regno
+        && (NOPERANDS(op->type) < 2 || op->c.kind == IMMEDIATE
+            || op->c.symbol != op->a.symbol))
+    {
+        return op->a.symbol->regno;
     }
+
+    return AX;
 }
 
 /* Push value to stack, rounded up to always be 8 byte aligned.
@@ -408,7 +570,7 @@ static void call(int n, const struct var *args, struct var res, struct var func)
     free(res_pc);
 }
 
-/* Assign storage to local variables.
+/* Assign storage to local variables that are not kept in register.
  */
 static int assign_locals_storage(struct symbol_list locals, int offset)
 {
@@ -418,7 +580,7 @@ static int assign_locals_storage(struct symbol_list locals, int offset)
         struct symbol *sym = locals.symbol[i];
         assert(!sym->stack_offset);
 
-        if (sym->linkage == LINK_NONE) {
+        if (sym->linkage == LINK_NONE && !sym->regno) {
             offset -= size_of(&sym->type);
             sym->stack_offset = offset;
         }
@@ -479,17 +641,24 @@ static enum param_class *enter(
         if (*params_pc[i] == PC_MEMORY) {
             sym->stack_offset = mem_offset;
             mem_offset += N_EIGHTBYTES(&sym->type) * 8;
-        } else {
+        } else if (!sym->regno) {
             stack_offset -= N_EIGHTBYTES(&sym->type) * 8;
             sym->stack_offset = stack_offset;
         }
     }
 
-    /* Assign storage to locals. */
+    /* Assign storage to locals, and reserve space for saving callee saved
+     * registers used by register allocation. */
     stack_offset = assign_locals_storage(locals, stack_offset);
+    stack_offset -= n_saved_regs * 8;
+    saved_regs_offset = stack_offset;
     if (stack_offset < 0)
         emit(INSTR_SUB, OPT_IMM_REG, constant(-stack_offset, 8), reg(SP, 8));
 
+    for (i = 0; i < n_saved_regs; ++i)
+        emit(INSTR_MOV, OPT_REG_MEM, reg(saved_regs[i], 8),
+            location(address(saved_regs_offset + i * 8, BP, 0, 0), 8));
+
     /* Store return address to well known stack offset. */
     if (*ret_pc == PC_MEMORY)
         emit(INSTR_MOV, OPT_REG_MEM,
@@ -522,7 +691,8 @@ static enum param_class *enter(
         }
     }
 
-    /* Move arguments from register to stack. */
+    /* Move arguments from register to stack, or to the register allocated.
+     * Parameters passed on stack are loaded if kept in register. */
     for (i = 0; i < params.length; ++i) {
         enum param_class *eightbyte = params_pc[i];
 
@@ -543,6 +713,13 @@ static enum param_class *enter(
                 size -= width;
             }
             assert(!size);
+        } else if (params.symbol[i]->regno) {
+            const struct symbol *sym = params.symbol[i];
+            int w = size_of(&sym->type);
+
+            emit(INSTR_MOV, OPT_MEM_REG,
+                location(address(sym->stack_offset, BP, 0, 0), w),
+                reg(sym->regno, w));
         }
     }
 
@@ -600,10 +777,9 @@ static void ret(struct var val, const enum param_class *pc)
         /* Load return address from magic stack offset and copy result. */
         emit(INSTR_MOV, OPT_MEM_REG,
             location(address(-8, BP, 0, 0), 8), reg(DI, 8));
-        load_address(val, SI);
-        emit(INSTR_MOV, OPT_IMM_REG,
-            constant(size_of(val.type), 8), reg(DX, 4));
-        emit(INSTR_CALL, OPT_IMM, addr(decl_memcpy));
+        copy(address(0, DI, 0, 0),
+            object_address(val, SI),
+            size_of(val.type));
 
         /* The ABI specifies that the address should be in %rax on return. */
         emit(INSTR_MOV, OPT_MEM_REG,
@@ -748,11 +924,9 @@ static void compile__builtin_va_arg(struct var res, struct var args)
         assert(res.kind == DIRECT);
         emit(INSTR_MOV, OPT_MEM_REG,
             location(address(0, SI, 0, 0), w), reg(AX, w));
-        emit(INSTR_MOV, OPT_REG_MEM, reg(AX, w), location_of(res, w));
+        store(AX, res);
     } else {
-        load_address(res, DI);
-        emit(INSTR_MOV, OPT_IMM_REG, constant(w, 8), reg(DX, 8));
-        emit(INSTR_CALL, OPT_IMM, addr(decl_memcpy));
+        copy(object_address(res, DI), address(0, SI, 0, 0), w);
     }
 
     /* Move overflow_arg_area pointer to position of next memory argument, 
@@ -765,42 +939,93 @@ static void compile__builtin_va_arg(struct var res, struct var args)
         enter_context(done);
 }
 
+/* Clear memory of target object. Small objects are written with a sequence of
+ * stores, larger ones with rep stosq followed by stores of the remainder.
+ */
+static void compile_zero(struct var target)
+{
+    int w, size = size_of(target.type);
+
+    emit(INSTR_XOR, OPT_REG_REG, reg(AX, 4), reg(AX, 4));
+    if (size > 8 * ZERO_STORE_LIMIT) {
+        load_address(target, DI);
+        emit(INSTR_MOV, OPT_IMM_REG, constant(size / 8, 4), reg(CX, 4));
+        emit(INSTR_REP_STOSQ, OPT_NONE);
+        target.offset += size - size % 8;
+        size = size % 8;
+    }
+
+    for (w = 8; size; w /= 2) {
+        while (size >= w) {
+            emit(INSTR_MOV, OPT_REG_MEM, reg(AX, w), location_of(target, w));
+            target.offset += w;
+            size -= w;
+        }
+    }
+}
+
+/* Compile operation a = b <op> c, computing the result directly in register
+ * allocated to a if possible.
+ */
+static void compile_binary(enum opcode opcode, const struct op *op)
+{
+    const int w = size_of(op->a.type);
+    enum reg t, r;
+
+    t = result_reg(op);
+    load(op->b, t);
+    r = load_operand(op->c, CX);
+    emit(opcode, OPT_REG_REG, reg(r, w), reg(t, w));
+    store(t, op->a);
+}
+
+/* Compile shift operation, where the shift amount must be in %cl.
+ */
+static void compile_shift(enum opcode opcode, const struct op *op)
+{
+    enum reg t = result_reg(op);
+
+    /* Shift instruction encoding is either by immediate, or implicit %cl
+     * register. Encode as if something other than %cl could be chosen.
+     * Behavior is undefined if shift is greater than integer width, so don't
+     * care about overflow or sign. */
+    load(op->b, t);
+    load(op->c, CX);
+    emit(opcode, OPT_REG_REG, reg(CX, 1), reg(t, size_of(op->a.type)));
+    store(t, op->a);
+}
+
 static void compile_op(const struct op *op)
 {
     static int n_args, w;
     static struct var *args;
+    enum reg t, r;
 
     switch (op->type) {
     case IR_ASSIGN:
         /* Handle special case of char [] = string literal. This will only occur
          * as part of initializer, at block scope. External definitions are
          * handled before this. At no other point should array types be seen in
-         * assembly backend. We handle these assignments with memcpy, other
-         * compilers load the string into register as ascii numbers. */
+         * assembly backend. We copy the string from its static location,
+         * other compilers load the string into register as ascii numbers. */
         if (is_array(op->a.type) || is_array(op->b.type)) {
-            int size = size_of(op->a.type);
-
             assert(op->a.kind == DIRECT);
             assert(is_string(op->b));
             assert(type_equal(op->a.type, op->b.type));
 
-            load_address(op->a, DI);
-            emit(INSTR_MOV, OPT_IMM_REG, addr(op->b.symbol), reg(SI, 8));
-            emit(INSTR_MOV, OPT_IMM_REG, constant(size, 8), reg(DX, 8));
-            emit(INSTR_CALL, OPT_IMM, addr(decl_memcpy));
+            copy(object_address(op->a, DI),
+                object_address(op->b, SI),
+                size_of(op->a.type));
             break;
         }
-        /* Struct or union assignment, values that cannot be loaded into a
-         * single register. */
-        else if (size_of(op->a.type) > 8) {
-            int size = size_of(op->a.type);
+        /* Struct or union assignment, copied in memory also when the size
+         * fits in a single register. */
+        else if (is_struct_or_union(op->a.type)) {
             assert(size_of(op->a.type) == size_of(op->b.type));
 
-            load_address(op->a, DI);
-            load_address(op->b, SI);
-
-            emit(INSTR_MOV, OPT_IMM_REG, constant(size, 8), reg(DX, 8));
-            emit(INSTR_CALL, OPT_IMM, addr(decl_memcpy));
+            copy(object_address(op->a, DI),
+                object_address(op->b, SI),
+                size_of(op->a.type));
             break;
         }
         /* Fallthrough, assignment has implicit cast for convenience and to make
@@ -810,15 +1035,22 @@ static void compile_op(const struct op *op)
             size_of(op->a.type) : size_of(op->b.type);
         w = (w < 4) ? 4 : w;
         assert(w == 4 || w == 8);
-        load_value(op->b, AX, w);
-        store(AX, op->a);
+
+        /* Load directly to register allocated to target, unless the value
+         * needs to be truncated to 32 bit. */
+        t = result_reg(op);
+        if (size_of(op->a.type) == 4 && w == 8)
+            t = AX;
+        load_value(op->b, t, w);
+        store(t, op->a);
         break;
     case IR_DEREF:
-        load(op->b, CX);
+        r = load_operand(op->b, CX);
+        t = result_reg(op);
         emit(INSTR_MOV, OPT_MEM_REG,
-            location(address(0, CX, 0, 0), size_of(op->a.type)),
-            reg(AX, size_of(op->a.type)));
-        store(AX, op->a);
+            location(address(0, r, 0, 0), size_of(op->a.type)),
+            reg(t, size_of(op->a.type)));
+        store(t, op->a);
         break;
     case IR_PARAM:
         args = realloc(args, ++n_args * sizeof(*args));
@@ -833,35 +1065,29 @@ static void compile_op(const struct op *op)
         }
         break;
     case IR_ADDR:
-        load_address(op->b, AX);
-        store(AX, op->a);
+        t = result_reg(op);
+        load_address(op->b, t);
+        store(t, op->a);
         break;
     case IR_NOT:
-        load(op->b, AX);
-        emit(INSTR_NOT, OPT_REG, reg(AX, size_of(op->a.type)));
-        store(AX, op->a);
+        t = result_reg(op);
+        load(op->b, t);
+        emit(INSTR_NOT, OPT_REG, reg(t, size_of(op->a.type)));
+        store(t, op->a);
         break;
     case IR_OP_ADD:
-        load(op->b, AX);
-        load(op->c, CX);
-        emit(INSTR_ADD, OPT_REG_REG,
-            reg(CX, size_of(op->a.type)), reg(AX, size_of(op->a.type)));
-        store(AX, op->a);
+        compile_binary(INSTR_ADD, op);
         break;
     case IR_OP_SUB:
-        load(op->b, AX);
-        load(op->c, CX);
-        emit(INSTR_SUB, OPT_REG_REG,
-            reg(CX, size_of(op->a.type)), reg(AX, size_of(op->a.type)));
-        store(AX, op->a);
+        compile_binary(INSTR_SUB, op);
         break;
     case IR_OP_MUL:
         load(op->c, AX);
-        if (op->b.kind == DIRECT) {
+        if (op->b.kind == DIRECT && !op->b.symbol->regno) {
             emit(INSTR_MUL, OPT_MEM, location_of(op->b, size_of(op->b.type)));
         } else {
-            load(op->b, CX);
-            emit(INSTR_MUL, OPT_REG, reg(CX, size_of(op->b.type)));
+            r = load_operand(op->b, CX);
+            emit(INSTR_MUL, OPT_REG, reg(r, size_of(op->b.type)));
         }
         store(AX, op->a);
         break;
@@ -870,65 +1096,45 @@ static void compile_op(const struct op *op)
         /* %rdx must be zero to avoid SIGFPE. */
         emit(INSTR_XOR, OPT_REG_REG, reg(DX, 8), reg(DX, 8));
         load(op->b, AX);
-        if (op->c.kind == DIRECT) {
+        if (op->c.kind == DIRECT && !op->c.symbol->regno) {
             emit(INSTR_DIV, OPT_MEM, location_of(op->c, size_of(op->c.type)));
         } else {
-            load(op->c, CX);
-            emit(INSTR_DIV, OPT_REG, reg(CX, size_of(op->c.type)));
+            r = load_operand(op->c, CX);
+            emit(INSTR_DIV, OPT_REG, reg(r, size_of(op->c.type)));
         }
         store((op->type == IR_OP_DIV) ? AX : DX, op->a);
         break;
     case IR_OP_AND:
-        load(op->b, AX);
-        load(op->c, CX);
-        emit(INSTR_AND, OPT_REG_REG, reg(CX, 8), reg(AX, 8));
-        store(AX, op->a);
+        compile_binary(INSTR_AND, op);
         break;
     case IR_OP_OR:
-        load(op->b, AX);
-        load(op->c, CX);
-        emit(INSTR_OR, OPT_REG_REG, reg(CX, 8), reg(AX, 8));
-        store(AX, op->a);
+        compile_binary(INSTR_OR, op);
         break;
     case IR_OP_XOR:
-        load(op->b, AX);
-        load(op->c, CX);
-        emit(INSTR_XOR, OPT_REG_REG, reg(CX, 8), reg(AX, 8));
-        store(AX, op->a);
+        compile_binary(INSTR_XOR, op);
         break;
     case IR_OP_SHL:
-        /* Shift instruction encoding is either by immediate, or implicit %cl
-         * register. Encode as if something other than %cl could be chosen.
-         * Behavior is undefined if shift is greater than integer width, so
-         * don't care about overflow or sign. */
-        load(op->b, AX);
-        load(op->c, CX);
-        emit(INSTR_SHL, OPT_REG_REG, reg(CX, 1), reg(AX, size_of(op->a.type)));
-        store(AX, op->a);
+        compile_shift(INSTR_SHL, op);
         break;
     case IR_OP_SHR:
-        load(op->b, AX);
-        load(op->c, CX);
-        emit((is_unsigned(op->a.type)) ? INSTR_SHR : INSTR_SAR, OPT_REG_REG,
-            reg(CX, 1), reg(AX, size_of(op->a.type)));
-        store(AX, op->a);
+        compile_shift(is_unsigned(op->a.type) ? INSTR_SHR : INSTR_SAR, op);
         break;
     case IR_OP_EQ:
         assert(size_of(op->a.type) == 4);
-        load(op->b, AX);
-        load(op->c, CX);
+        t = load_operand(op->b, AX);
+        r = load_operand(op->c, CX);
         emit(INSTR_CMP, OPT_REG_REG,
-            reg(CX, size_of(op->a.type)), reg(AX, size_of(op->a.type)));
+            reg(r, size_of(op->b.type)), reg(t, size_of(op->b.type)));
         emit(INSTR_SETZ, OPT_REG, reg(AX, 1));
         emit(INSTR_MOVZX, OPT_REG_REG, reg(AX, 1), reg(AX, 4));
         store(AX, op->a);
         break;
     case IR_OP_GE:
         assert(size_of(op->a.type) == 4);
-        load(op->b, AX);
-        load(op->c, CX);
+        t = load_operand(op->b, AX);
+        r = load_operand(op->c, CX);
         emit(INSTR_CMP, OPT_REG_REG,
-            reg(CX, size_of(op->a.type)), reg(AX, size_of(op->a.type)));
+            reg(r, size_of(op->b.type)), reg(t, size_of(op->b.type)));
         if (is_unsigned(op->b.type)) {
             assert(is_unsigned(op->c.type));
             emit(INSTR_SETAE, OPT_REG, reg(AX, 1));
@@ -940,10 +1146,10 @@ static void compile_op(const struct op *op)
         break;
     case IR_OP_GT:
         assert(size_of(op->a.type) == 4);
-        load(op->b, AX);
-        load(op->c, CX);
+        t = load_operand(op->b, AX);
+        r = load_operand(op->c, CX);
         emit(INSTR_CMP, OPT_REG_REG,
-            reg(CX, size_of(op->a.type)), reg(AX, size_of(op->a.type)));
+            reg(r, size_of(op->b.type)), reg(t, size_of(op->b.type)));
         if (is_unsigned(op->b.type)) {
             assert(is_unsigned(op->c.type));
             /* When comparison is unsigned, set flag without considering
@@ -961,100 +1167,255 @@ static void compile_op(const struct op *op)
     case IR_VA_ARG:
         compile__builtin_va_arg(op->a, op->b);
         break;
+    case IR_ZERO:
+        compile_zero(op->a);
+        break;
     default:
         assert(0);
         break;
     }
 }
 
-static void tail_cmp_jump(struct block *block, const enum param_class *res)
+static int is_zero(struct var v)
 {
-    struct instruction instr = {0};
-    struct op *cmp = block->code + block->n - 1;
+    return v.kind == IMMEDIATE && !is_string(v) && !v.imm.i;
+}
+
+/* Determine if immediate can be encoded as operand to cmp, which is sign
+ * extended from 32 bit when comparing 64 bit registers.
+ */
+static int is_imm32(struct var v, int w)
+{
+    return v.kind == IMMEDIATE && !is_string(v)
+        && (w == 4 || (v.imm.i >= -2147483647 - 1 && v.imm.i <= 2147483647));
+}
 
-    /* Target of assignment should be temporary, thus we do not lose any side
-     * effects from not storing the value to stack. */
-    assert(!cmp->a.lvalue);
+static enum opcode invert(enum opcode jcc)
+{
+    switch (jcc) {
+    case INSTR_JZ:  return INSTR_JNZ;
+    case INSTR_JNZ: return INSTR_JZ;
+    case INSTR_JA:  return INSTR_JBE;
+    case INSTR_JBE: return INSTR_JA;
+    case INSTR_JAE: return INSTR_JB;
+    case INSTR_JB:  return INSTR_JAE;
+    case INSTR_JG:  return INSTR_JLE;
+    case INSTR_JLE: return INSTR_JG;
+    case INSTR_JGE: return INSTR_JL;
+    default:
+        assert(jcc == INSTR_JL);
+        return INSTR_JGE;
+    }
+}
+
+/* Set flags from comparison, returning conditional jump taken if the result
+ * is true. Immediate operands are encoded directly, swapping operands if the
+ * immediate is on the left side, and comparison with zero becomes test.
+ */
+static enum opcode compare(const struct op *cmp)
+{
+    int w, swap, uns;
+    enum reg b, c;
+    struct var l = cmp->b, r = cmp->c;
+
+    swap = l.kind == IMMEDIATE && r.kind != IMMEDIATE;
+    if (swap) {
+        l = cmp->c;
+        r = cmp->b;
+    }
 
-    load(cmp->c, CX);
-    load(cmp->b, AX);
-    emit(INSTR_CMP, OPT_REG_REG,
-        reg(CX, size_of(cmp->a.type)), reg(AX, size_of(cmp->a.type)));
+    w = size_of(cmp->b.type) == 8 ? 8 : 4;
+    b = load_operand(l, AX);
+    if (is_zero(r)) {
+        emit(INSTR_TEST, OPT_REG_REG, reg(b, w), reg(b, w));
+    } else if (is_imm32(r, w)) {
+        emit(INSTR_CMP, OPT_IMM_REG, value_of(r, w), reg(b, w));
+    } else {
+        c = load_operand(r, CX);
+        emit(INSTR_CMP, OPT_REG_REG, reg(c, w), reg(b, w));
+    }
 
+    uns = is_unsigned(cmp->b.type);
     switch (cmp->type) {
     case IR_OP_EQ:
-        instr.opcode = INSTR_JZ;
-        break;
+        return INSTR_JZ;
     case IR_OP_GE:
-        instr.opcode = (is_unsigned(cmp->b.type)) ? INSTR_JAE : INSTR_JGE;
-        break;
+        if (uns)
+            return swap ? INSTR_JBE : INSTR_JAE;
+        return swap ? INSTR_JLE : INSTR_JGE;
     default:
         assert(cmp->type == IR_OP_GT);
-        instr.opcode = (is_unsigned(cmp->b.type)) ? INSTR_JA : INSTR_JG;
-        break;
+        if (uns)
+            return swap ? INSTR_JB : INSTR_JA;
+        return swap ? INSTR_JL : INSTR_JG;
     }
+}
 
-    instr.optype = OPT_IMM;
-    instr.source.imm = addr(block->jump[1]->label);
-    emit_instruction(instr);
+static int is_comparison_of(const struct op *op, struct var v)
+{
+    return IS_COMPARISON(op->type) && !op->a.lvalue && op->a.kind == DIRECT
+        && v.kind == DIRECT && op->a.symbol == v.symbol;
+}
 
-    if (block->jump[0]->color == BLACK)
-        emit(INSTR_JMP, OPT_IMM, addr(block->jump[0]->label));
-    else
+/* Find comparison computing the branch condition of block, which can set
+ * flags for the conditional jump without storing its result (always a
+ * temporary). Comparing such a result equal to zero, as generated for ! and
+ * !=, is folded by negating the condition. Return index of the comparison, or
+ * -1 if the condition must be tested as a value.
+ */
+static int branch_comparison(const struct block *block, int *negate)
+{
+    int i = block->n - 1;
+    const struct op *op;
+    struct var v;
+
+    *negate = 0;
+    if (i < 0 || !is_comparison_of(block->code + i, block->expr))
+        return -1;
+
+    for (; i > 0; --i) {
+        op = block->code + i;
+        if (op->type != IR_OP_EQ)
+            break;
+        else if (is_zero(op->b))
+            v = op->c;
+        else if (is_zero(op->c))
+            v = op->b;
+        else
+            break;
+
+        if (!is_comparison_of(op - 1, v))
+            break;
+
+        *negate = !*negate;
+    }
+
+    return i;
+}
+
+/* Conditional jump to jump[1] if condition holds, otherwise to jump[0]. The
+ * condition is inverted to fall through to jump[1] whenever it is not yet
+ * emitted, otherwise we fall through to jump[0].
+ */
+static void tail_branch(
+    struct block *block,
+    const struct op *cmp,
+    int negate,
+    const enum param_class *res)
+{
+    int w;
+    enum reg r;
+    enum opcode jcc;
+
+    if (cmp) {
+        jcc = compare(cmp);
+    } else {
+        w = size_of(block->expr.type) == 8 ? 8 : 4;
+        r = load_operand(block->expr, AX);
+        emit(INSTR_TEST, OPT_REG_REG, reg(r, w), reg(r, w));
+        jcc = INSTR_JNZ;
+    }
+
+    if (negate)
+        jcc = invert(jcc);
+
+    if (block->jump[1]->color != BLACK) {
+        emit(invert(jcc), OPT_IMM, addr(block->jump[0]->label));
+        compile_block(block->jump[1], res);
         compile_block(block->jump[0], res);
+    } else {
+        emit(jcc, OPT_IMM, addr(block->jump[1]->label));
+        if (block->jump[0]->color == BLACK)
+            emit(INSTR_JMP, OPT_IMM, addr(block->jump[0]->label));
+        else
+            compile_block(block->jump[0], res);
+    }
+}
 
-    compile_block(block->jump[1], res);
+/* Indirect jump through table of block addresses placed in read-only data,
+ * after checking that the index is within bounds. The index is extended to 64
+ * bit, so that negative values also compare above the size of the table.
+ */
+static void tail_table_jump(struct block *block, const enum param_class *res)
+{
+    int i;
+    enum reg r;
+    struct address loc = {0};
+    const struct symbol *table, **labels;
+
+    assert(block->jump[0] && !block->jump[1]);
+    labels = calloc(block->n_table, sizeof(*labels));
+    for (i = 0; i < block->n_table; ++i)
+        labels[i] = block->table[i]->label;
+
+    table = sym_create_label();
+    emit_jump_table(table, labels, block->n_table);
+    free(labels);
+
+    r = load_value(block->expr, AX, 8);
+    emit(INSTR_CMP, OPT_IMM_REG, constant(block->n_table, 4), reg(r, 8));
+    emit(INSTR_JAE, OPT_IMM, addr(block->jump[0]->label));
+
+    loc.sym = table;
+    loc.offset = r;
+    loc.mult = 8;
+    emit(INSTR_JMP, OPT_MEM, location(loc, 8));
+
+    compile_block(block->jump[0], res);
+    for (i = 0; i < block->n_table; ++i)
+        compile_block(block->table[i], res);
 }
 
 static void tail_generic(struct block *block, const enum param_class *res)
 {
+    int i;
+
     if (!block->jump[0] && !block->jump[1]) {
         if (*res != PC_NO_CLASS && block->has_return_value) {
             assert(block->expr.type && !is_void(block->expr.type));
             ret(block->expr, res);
         }
 
+        for (i = 0; i < n_saved_regs; ++i)
+            emit(INSTR_MOV, OPT_MEM_REG,
+                location(address(saved_regs_offset + i * 8, BP, 0, 0), 8),
+                reg(saved_regs[i], 8));
+
         emit(INSTR_LEAVE, OPT_NONE);
         emit(INSTR_RET, OPT_NONE);
-    } else if (!block->jump[1]) {
+    } else if (block->n_table) {
+        tail_table_jump(block, res);
+    } else {
+        assert(!block->jump[1]);
         if (block->jump[0]->color == BLACK)
             emit(INSTR_JMP, OPT_IMM, addr(block->jump[0]->label));
         else
             compile_block(block->jump[0], res);
-    } else {
-        load(block->expr, AX);
-        emit(INSTR_CMP, OPT_IMM_REG, constant(0, 4), reg(AX, 4));
-        emit(INSTR_JZ, OPT_IMM, addr(block->jump[0]->label));
-        if (block->jump[1]->color == BLACK)
-            emit(INSTR_JMP, OPT_IMM, addr(block->jump[1]->label));
-        else
-            compile_block(block->jump[1], res);
-        compile_block(block->jump[0], res);
     }
 }
 
 static void compile_block(struct block *block, const enum param_class *res)
 {
-    int i;
+    int i, n, cmp = -1, negate = 0;
 
     if (block->color == BLACK)
         return;
 
     block->color = BLACK;
     enter_context(block->label);
-    for (i = 0; i < block->n - 1; ++i)
+    if (block->jump[1]) {
+        assert(block->jump[0]);
+        cmp = branch_comparison(block, &negate);
+    }
+
+    n = (cmp < 0) ? block->n : cmp;
+    for (i = 0; i < n; ++i)
         compile_op(block->code + i);
 
-    /* Special case on comparison + jump, saving some space by not writing
-     * the result of comparison (always a temporary). */
-    if (block->n && IS_COMPARISON(block->code[i].type) && block->jump[1]) {
-        assert(block->jump[0]);
-        tail_cmp_jump(block, res);
-    } else {
-        if (block->n)
-            compile_op(block->code + i);
+    if (block->jump[1])
+        tail_branch(block, cmp < 0 ? NULL : block->code + cmp, negate, res);
+    else
         tail_generic(block, res);
-    }
 }
 
 static void compile_data_assign(struct var target, struct var val)
@@ -1093,21 +1454,52 @@ static void compile_data_assign(struct var target, struct var val)
     emit_data(imm);
 }
 
-static void zero_fill_data(size_t bytes)
+/* Determine if definition has no initializer, or is initialized with only
+ * zero values, so that it can be placed in .bss.
+ */
+static int is_zero_data(struct definition def)
 {
-    struct immediate
-        zero_byte = {IMM_INT, 1},
-        zero_quad = {IMM_INT, 8};
+    int i;
+    const struct op *op;
+
+    for (i = 0; i < def.body->n; ++i) {
+        op = def.body->code + i;
+        if (is_string(op->b) || op->b.imm.i)
+            return 0;
+    }
 
-    while (bytes > size_of(&basic_type__long)) {
-        emit_data(zero_quad);
-        bytes -= size_of(&basic_type__long);
+    if (def.data) {
+        for (i = 0; i < size_of(&def.symbol->type); ++i)
+            if (def.data[i])
+                return 0;
     }
 
-    while (bytes--)
-        emit_data(zero_byte);
+    return 1;
+}
+
+/* Determine if object is const qualified, or an array of const elements, so
+ * that it can be placed in read-only memory.
+ */
+static int is_readonly(const struct typetree *type)
+{
+    while (is_array(type))
+        type = type->next;
+
+    return is_const(type);
 }
 
+/* Write bytes of initialized object, from offset and up to end, taken from
+ * image of the definition.
+ */
+static void compile_data_image(struct definition def, int offset, int end)
+{
+    if (end > offset)
+        emit_bytes(def.data ? def.data + offset : NULL, end - offset);
+}
+
+/* Write image of static object, with assignments remaining in the definition
+ * for values that need relocation.
+ */
 static void compile_data(struct definition def)
 {
     struct op *op;
@@ -1115,7 +1507,15 @@ static void compile_data(struct definition def)
         total_size = size_of(&def.symbol->type),
         initialized = 0;
 
-    enter_context(def.symbol);
+    if (is_readonly(&def.symbol->type)) {
+        emit_rodata(def.symbol);
+    } else if (is_zero_data(def)) {
+        emit_bss(def.symbol);
+        return;
+    } else {
+        enter_context(def.symbol);
+    }
+
     for (i = 0; i < def.body->n; ++i) {
         op = def.body->code + i;
 
@@ -1124,24 +1524,38 @@ static void compile_data(struct definition def)
         assert(op->a.symbol == def.symbol);
         assert(op->a.offset >= initialized);
 
-        zero_fill_data(op->a.offset - initialized);
+        compile_data_image(def, initialized, op->a.offset);
         compile_data_assign(op->a, op->b);
         initialized = op->a.offset + size_of(op->a.type);
     }
 
     assert(total_size >= initialized);
-    zero_fill_data(total_size - initialized);
+    compile_data_image(def, initialized, total_size);
 }
 
 static void compile_function(struct definition def)
 {
+    struct ssa *ssa;
     enum param_class *result_class;
 
     assert(is_function(&def.symbol->type));
+
+    /* Go through SSA form, splitting variables that are assigned more than
+     * once into separate live ranges. */
+    ssa = ssa_construct(&def);
+    if (ssa) {
+        ssa_destruct(ssa);
+        def.locals = ssa->locals;
+    }
+
     enter_context(def.symbol);
     emit(INSTR_PUSH, OPT_REG, reg(BP, 8));
     emit(INSTR_MOV, OPT_REG_REG, reg(SP, 8), reg(BP, 8));
 
+    /* Keep parameters and local variables in register where possible, which
+     * must be decided before assigning stack storage. */
+    n_saved_regs = allocate_registers(def, saved_regs);
+
     /* Make sure parameters and local variables are placed on stack. Keep
      * parameter class of return value for later assembling return. */
     result_class = enter(&def.symbol->type, def.params, def.locals);
@@ -1149,7 +1563,15 @@ static void compile_function(struct definition def)
     /* Recursively assemble body. */
     compile_block(def.body, result_class);
 
+    /* Write all buffered output, resolving references to labels. Labels are
+     * released after the function is compiled. */
+    peephole_flush();
+    if (flush_function)
+        flush_function();
+
     free(result_class);
+    if (ssa)
+        ssa_free(ssa);
 }
 
 void set_compile_target(FILE *stream, enum compile_target target)
@@ -1162,16 +1584,27 @@ void set_compile_target(FILE *stream, enum compile_target target)
         break;
     case TARGET_x86_64_ASM:
         asm_output = stream;
-        enter_context = asm_symbol;
-        emit_instruction = asm_text;
+        peephole_init(asm_symbol, asm_text);
+        emit_symbol = peephole_symbol;
+        emit_instruction = peephole_text;
         emit_data = asm_data;
+        emit_bytes = asm_bytes;
+        emit_bss = asm_bss;
+        emit_rodata = asm_rodata;
+        emit_jump_table = asm_jump_table;
         flush_backend = asm_flush;
         break;
     case TARGET_x86_64_ELF:
         object_file_output = stream;
-        enter_context = elf_symbol;
-        emit_instruction = elf_text;
+        peephole_init(elf_symbol, elf_text);
+        emit_symbol = peephole_symbol;
+        emit_instruction = peephole_text;
         emit_data = elf_data;
+        emit_bytes = elf_bytes;
+        emit_bss = elf_bss;
+        emit_rodata = elf_rodata;
+        emit_jump_table = elf_jump_table;
+        flush_function = elf_flush_function;
         flush_backend = elf_flush;
         break;
     }
@@ -1214,8 +1647,16 @@ int compile_symbols(struct symbol_list list)
     return 0;
 }
 
+int set_optimization(const char *name, int enable)
+{
+    return peephole_enable(name, enable);
+}
+
 void flush(void)
 {
-    if (flush_backend)
+    if (flush_backend) {
+        peephole_flush();
+        peephole_report();
         flush_backend();
+    }
 }
@@ -26,6 +26,11 @@ int compile(struct definition def);
  */
 int compile_symbols(struct symbol_list list);
 
+/* Enable or disable peephole optimization rule by name. Return non-zero if
+ * there is no such rule.
+ */
+int set_optimization(const char *name, int enable);
+
 /* Flush any buffered output, no more input will follow.
  */
 void flush(void);
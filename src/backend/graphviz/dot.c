@@ -84,7 +84,7 @@ static char *vartostr(const struct var var)
 
 static void foutputnode(FILE *stream, struct block *node)
 {
-    int i;
+    int i, j;
 
     if (node->color == BLACK)
         return;
@@ -188,6 +188,9 @@ static void foutputnode(FILE *stream, struct block *node)
             fprintf(stream, " | %s = va_arg(%s, %s)",
                 vartostr(op.a), vartostr(op.b), typetostr(op.a.type));
             break;
+        case IR_ZERO:
+            fprintf(stream, " | zero %s", vartostr(op.a));
+            break;
         }
     }
 
@@ -197,6 +200,22 @@ static void foutputnode(FILE *stream, struct block *node)
             fprintf(stream, " %s", vartostr(node->expr));
         }
         fprintf(stream, " }\"];\n");
+    } else if (node->n_table) {
+        fprintf(stream, " | goto table[%s], default %s",
+            vartostr(node->expr), escape(node->jump[0]->label));
+        fprintf(stream, " }\"];\n");
+        foutputnode(stream, node->jump[0]);
+        fprintf(stream, "\t%s:s -> %s:n;\n",
+            sanitize(node->label), sanitize(node->jump[0]->label));
+        for (i = 0; i < node->n_table; ++i) {
+            for (j = 0; j < i && node->table[j] != node->table[i]; ++j)
+                ;
+            if (j < i || node->table[i] == node->jump[0])
+                continue;
+            foutputnode(stream, node->table[i]);
+            fprintf(stream, "\t%s:s -> %s:n;\n",
+                sanitize(node->label), sanitize(node->table[i]->label));
+        }
     } else if (node->jump[1] != NULL) {
         fprintf(stream, " | if %s goto %s",
             vartostr(node->expr), escape(node->jump[1]->label));
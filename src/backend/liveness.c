@@ -0,0 +1,72 @@
+#include "liveness.h"
+
+int compare_block(const void *a, const void *b)
+{
+    const struct block_index
+        *l = (const struct block_index *) a,
+        *r = (const struct block_index *) b;
+
+    return (l->block > r->block) - (l->block < r->block);
+}
+
+int is_candidate(const struct symbol *sym)
+{
+    return sym->linkage == LINK_NONE
+        && (is_integer(&sym->type) || is_pointer(&sym->type))
+        && !is_volatile(&sym->type);
+}
+
+int is_escaping(struct var var, int is_addr)
+{
+    return var.kind == DIRECT
+        && (is_addr || var.offset || !is_scalar(var.type)
+            || size_of(var.type) != size_of(&var.symbol->type));
+}
+
+int n_operands(const struct op *op)
+{
+    switch (op->type) {
+    case IR_VA_START:
+    case IR_ZERO:
+        return 0;
+    case IR_VA_ARG:
+        return 1;
+    default:
+        return NOPERANDS(op->type);
+    }
+}
+
+int op_uses(struct op *op, struct var **list)
+{
+    int n = 0;
+
+    if (op->type == IR_PARAM || op->type == IR_VA_START
+        || op->a.kind == DEREF)
+    {
+        list[n++] = &op->a;
+    }
+
+    if (n_operands(op) > 0)
+        list[n++] = &op->b;
+    if (n_operands(op) > 1)
+        list[n++] = &op->c;
+
+    return n;
+}
+
+struct var *op_def(struct op *op)
+{
+    if (op->type == IR_PARAM || op->type == IR_VA_START
+        || op->a.kind != DIRECT)
+    {
+        return NULL;
+    }
+
+    return &op->a;
+}
+
+int has_tail_use(const struct block *block)
+{
+    return block->jump[1] || block->n_table
+        || (!block->jump[0] && block->has_return_value);
+}
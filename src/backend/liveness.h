@@ -0,0 +1,53 @@
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <lacc/ir.h>
+
+#include <limits.h>
+
+/* Bit vector operations, used to represent liveness sets over variables.
+ */
+#define BITS (sizeof(unsigned long) * CHAR_BIT)
+#define bit_test(set, i) ((set)[(i) / BITS] & (1ul << ((i) % BITS)))
+#define bit_set(set, i) ((set)[(i) / BITS] |= (1ul << ((i) % BITS)))
+
+/* Index of block in some ordering of the control flow graph. Lists sorted with
+ * compare_block can be searched with bsearch to find the index of a block.
+ */
+struct block_index {
+    const struct block *block;
+    int i;
+};
+
+int compare_block(const void *a, const void *b);
+
+/* Only integer and pointer values are considered for renaming to SSA form
+ * and for being kept in general purpose registers.
+ */
+int is_candidate(const struct symbol *sym);
+
+/* Determine if reference to variable requires it to be kept in memory, which
+ * is when the address is taken, or only part of the variable is accessed.
+ */
+int is_escaping(struct var var, int is_addr);
+
+/* Number of operands read by operation, not counting a. Operands not in use
+ * are not necessarily initialized.
+ */
+int n_operands(const struct op *op);
+
+/* Write operands read by operation to output list, returning the number of
+ * elements written. Dereferencing a pointer is a use of the pointer, and the
+ * list must have room for three elements.
+ */
+int op_uses(struct op *op, struct var **list);
+
+/* Operand written by operation, or NULL.
+ */
+struct var *op_def(struct op *op);
+
+/* Branch condition, table index or return value is read at the end of block.
+ */
+int has_tail_use(const struct block *block);
+
+#endif
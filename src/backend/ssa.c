@@ -0,0 +1,1159 @@
+#include "liveness.h"
+#include "ssa.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Variable considered for renaming, with stack of versions reaching the node
+ * currently visited in dominator tree.
+ */
+struct variable {
+    struct symbol *sym;
+    int excluded;
+
+    /* Original symbol is not live at entry, and can be reused as the first
+     * version assigned. */
+    int reuse;
+
+    struct symbol **stack;
+    int n_stack, cap_stack;
+};
+
+/* Additional node information only needed during construction.
+ */
+struct info {
+    /* Dominance frontier. */
+    int *df;
+    int n_df, cap_df;
+
+    /* Dominator tree, as first child and next sibling. */
+    int child;
+    int sibling;
+
+    /* Marker to avoid duplicate phi functions and worklist entries. */
+    int has_phi;
+    int on_work;
+
+    unsigned long *use, *def, *in;
+};
+
+struct symbol_index {
+    const struct symbol *sym;
+    int i;
+};
+
+/* Function currently being processed. */
+static struct ssa *cur;
+static struct info *info;
+static int cap_nodes;
+
+static struct variable *vars;
+static int n_vars, cap_vars;
+
+static struct symbol_index *sym_map;
+static struct block_index *block_map;
+
+/* Versions connected through phi functions, called webs, are candidates for
+ * being merged back to a single symbol when translating out of SSA. Members
+ * are indexed through symbol map, with parent pointers forming disjoint sets.
+ */
+static int *parent;
+static int n_members;
+
+/* Log of variables pushed to version stacks, to be popped when leaving a
+ * subtree of the dominator tree.
+ */
+static int *pushed;
+static int n_pushed, cap_pushed;
+
+static int compare_symbol(const void *a, const void *b)
+{
+    const struct symbol_index
+        *l = (const struct symbol_index *) a,
+        *r = (const struct symbol_index *) b;
+
+    return (l->sym > r->sym) - (l->sym < r->sym);
+}
+
+/* Index of variable considered for renaming, or -1. Dereferencing a pointer
+ * is considered a use of the pointer variable.
+ */
+static int var_index(struct var var)
+{
+    struct symbol_index key, *found;
+
+    if (var.kind == IMMEDIATE || !var.symbol || !n_vars)
+        return -1;
+
+    key.sym = var.symbol;
+    found = bsearch(&key, sym_map, n_vars, sizeof(*sym_map), compare_symbol);
+    return (found) ? found->i : -1;
+}
+
+static int node_index(const struct block *block)
+{
+    struct block_index key, *found;
+
+    key.block = block;
+    found = bsearch(&key, block_map, cur->n, sizeof(*block_map),
+        compare_block);
+    assert(found);
+    return found->i;
+}
+
+static void add_local(struct symbol *sym)
+{
+    struct symbol_list *list = &cur->locals;
+
+    if (list->length == list->capacity) {
+        list->capacity = (list->capacity) ? list->capacity * 2 : 64;
+        list->symbol = realloc(list->symbol,
+            list->capacity * sizeof(*list->symbol));
+    }
+
+    list->symbol[list->length++] = sym;
+}
+
+static void add_variables(struct symbol_list list)
+{
+    int i;
+
+    for (i = 0; i < list.length; ++i) {
+        if (!is_candidate(list.symbol[i]))
+            continue;
+
+        if (n_vars == cap_vars) {
+            cap_vars = (cap_vars) ? cap_vars * 2 : 64;
+            vars = realloc(vars, cap_vars * sizeof(*vars));
+        }
+
+        memset(vars + n_vars, 0, sizeof(*vars));
+        vars[n_vars++].sym = list.symbol[i];
+    }
+}
+
+/* Variables must be referenced as a whole, and not have their address taken,
+ * to be renamed.
+ */
+static void exclude_escaping(struct var var, int is_addr)
+{
+    int i = var_index(var);
+
+    if (i >= 0 && is_escaping(var, is_addr))
+        vars[i].excluded = 1;
+}
+
+/* Add nodes reachable from block in postorder.
+ */
+static void number_nodes(struct block *block)
+{
+    int i;
+
+    if (block->color == BLACK)
+        return;
+
+    block->color = BLACK;
+    for (i = 0; i < N_SUCCESSORS(block); ++i)
+        if (SUCCESSOR(block, i))
+            number_nodes(SUCCESSOR(block, i));
+
+    if (cur->n == cap_nodes) {
+        cap_nodes = (cap_nodes) ? cap_nodes * 2 : 64;
+        cur->node = realloc(cur->node, cap_nodes * sizeof(*cur->node));
+    }
+
+    memset(cur->node + cur->n, 0, sizeof(*cur->node));
+    cur->node[cur->n++].block = block;
+}
+
+/* Create lookup table from block to node index.
+ */
+static void map_blocks(void)
+{
+    int i;
+
+    block_map = calloc(cur->n, sizeof(*block_map));
+    for (i = 0; i < cur->n; ++i) {
+        block_map[i].block = cur->node[i].block;
+        block_map[i].i = i;
+    }
+
+    qsort(block_map, cur->n, sizeof(*block_map), compare_block);
+}
+
+/* Index of edge from node i through successor j in list of predecessors,
+ * which is also the index of corresponding phi arguments.
+ */
+static int pred_index(const struct ssa_node *node, int i, int j)
+{
+    int k;
+
+    for (k = 0; k < node->n_pred; ++k)
+        if (node->pred[k].node == i && node->pred[k].jump == j)
+            return k;
+
+    assert(0);
+    return -1;
+}
+
+/* Number nodes in reverse postorder, and resolve predecessor edges.
+ */
+static void link_nodes(struct block *entry)
+{
+    int i, j, k;
+    struct ssa_node tmp, *node;
+
+    number_nodes(entry);
+    for (i = 0, j = cur->n - 1; i < j; ++i, --j) {
+        tmp = cur->node[i];
+        cur->node[i] = cur->node[j];
+        cur->node[j] = tmp;
+    }
+
+    for (i = 0; i < cur->n; ++i)
+        cur->node[i].block->color = WHITE;
+
+    map_blocks();
+    for (i = 0; i < cur->n; ++i) {
+        for (j = 0; j < N_SUCCESSORS(cur->node[i].block); ++j) {
+            if (!SUCCESSOR(cur->node[i].block, j))
+                continue;
+
+            k = node_index(SUCCESSOR(cur->node[i].block, j));
+            node = &cur->node[k];
+            node->pred = realloc(node->pred,
+                (node->n_pred + 1) * sizeof(*node->pred));
+            node->pred[node->n_pred].node = i;
+            node->pred[node->n_pred].jump = j;
+            node->n_pred++;
+        }
+    }
+}
+
+static int intersect(int a, int b)
+{
+    while (a != b) {
+        while (a > b)
+            a = cur->node[a].idom;
+        while (b > a)
+            b = cur->node[b].idom;
+    }
+
+    return a;
+}
+
+/* Compute immediate dominators by iterating to a fixed point in reverse
+ * postorder, as described by Cooper, Harvey and Kennedy in 'A Simple, Fast
+ * Dominance Algorithm'.
+ */
+static void compute_dominators(void)
+{
+    int i, j, p, idom, changed;
+    struct ssa_node *node;
+
+    cur->node[0].idom = 0;
+    for (i = 1; i < cur->n; ++i)
+        cur->node[i].idom = -1;
+
+    do {
+        changed = 0;
+        for (i = 1; i < cur->n; ++i) {
+            node = &cur->node[i];
+            idom = -1;
+            for (j = 0; j < node->n_pred; ++j) {
+                p = node->pred[j].node;
+                if (cur->node[p].idom == -1)
+                    continue;
+                idom = (idom == -1) ? p : intersect(p, idom);
+            }
+
+            if (node->idom != idom) {
+                node->idom = idom;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    cur->node[0].idom = -1;
+    for (i = cur->n - 1; i > 0; --i) {
+        idom = cur->node[i].idom;
+        info[i].sibling = info[idom].child;
+        info[idom].child = i;
+    }
+}
+
+static void add_frontier(int i, int y)
+{
+    struct info *in = &info[i];
+
+    if (in->n_df && in->df[in->n_df - 1] == y)
+        return;
+
+    if (in->n_df == in->cap_df) {
+        in->cap_df = (in->cap_df) ? in->cap_df * 2 : 4;
+        in->df = realloc(in->df, in->cap_df * sizeof(*in->df));
+    }
+
+    in->df[in->n_df++] = y;
+}
+
+/* Compute dominance frontiers, walking up the dominator tree from each
+ * predecessor of join nodes.
+ */
+static void compute_frontiers(void)
+{
+    int i, j, runner;
+    struct ssa_node *node;
+
+    for (i = 0; i < cur->n; ++i) {
+        node = &cur->node[i];
+        if (node->n_pred < 2)
+            continue;
+
+        for (j = 0; j < node->n_pred; ++j) {
+            runner = node->pred[j].node;
+            while (runner != node->idom) {
+                add_frontier(runner, i);
+                runner = cur->node[runner].idom;
+            }
+        }
+    }
+}
+
+/* Exclude variables that cannot be renamed, and compute use and def sets of
+ * each node.
+ */
+static void scan_nodes(int words)
+{
+    int i, j, k, n, v;
+    struct block *block;
+    struct var *list[3], *def;
+
+    for (i = 0; i < cur->n; ++i) {
+        block = cur->node[i].block;
+        for (j = 0; j < block->n; ++j) {
+            n = op_uses(block->code + j, list);
+            for (k = 0; k < n; ++k)
+                exclude_escaping(*list[k], 0);
+            if (block->code[j].type == IR_ADDR)
+                exclude_escaping(block->code[j].b, 1);
+            if ((def = op_def(block->code + j)) != NULL)
+                exclude_escaping(*def, 0);
+        }
+
+        if (has_tail_use(block))
+            exclude_escaping(block->expr, 0);
+    }
+
+    for (i = 0; i < cur->n; ++i) {
+        block = cur->node[i].block;
+        info[i].use = calloc(3 * words, sizeof(*info[i].use));
+        info[i].def = info[i].use + words;
+        info[i].in = info[i].use + 2 * words;
+        for (j = 0; j <= block->n; ++j) {
+            if (j < block->n) {
+                n = op_uses(block->code + j, list);
+                def = op_def(block->code + j);
+            } else {
+                n = 0;
+                if (has_tail_use(block))
+                    list[n++] = &block->expr;
+                def = NULL;
+            }
+
+            for (k = 0; k < n; ++k) {
+                v = var_index(*list[k]);
+                if (v >= 0 && !bit_test(info[i].def, v))
+                    bit_set(info[i].use, v);
+            }
+
+            if (def && (v = var_index(*def)) >= 0)
+                bit_set(info[i].def, v);
+        }
+    }
+}
+
+/* Compute live in sets by iterating to a fixed point, visiting nodes in
+ * postorder.
+ */
+static void compute_liveness(int words)
+{
+    int i, j, k, changed;
+    unsigned long u, *out, *succ;
+    struct block *block;
+
+    out = calloc(words, sizeof(*out));
+    do {
+        changed = 0;
+        for (i = cur->n - 1; i >= 0; --i) {
+            block = cur->node[i].block;
+            memset(out, 0, words * sizeof(*out));
+            for (j = 0; j < N_SUCCESSORS(block); ++j) {
+                if (SUCCESSOR(block, j)) {
+                    succ = info[node_index(SUCCESSOR(block, j))].in;
+                    for (k = 0; k < words; ++k)
+                        out[k] |= succ[k];
+                }
+            }
+
+            for (k = 0; k < words; ++k) {
+                u = info[i].use[k] | (out[k] & ~info[i].def[k]);
+                if (u != info[i].in[k]) {
+                    info[i].in[k] = u;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    free(out);
+}
+
+static void add_phi(int i, int v)
+{
+    int j;
+    struct phi *phi;
+    struct ssa_node *node = &cur->node[i];
+
+    node->phi = realloc(node->phi, (node->n_phi + 1) * sizeof(*node->phi));
+    phi = &node->phi[node->n_phi++];
+    phi->a = var_direct(vars[v].sym);
+    phi->args = calloc(node->n_pred, sizeof(*phi->args));
+    for (j = 0; j < node->n_pred; ++j)
+        phi->args[j] = phi->a;
+}
+
+/* Place phi functions in the iterated dominance frontier of nodes assigning
+ * each variable, but only where the variable is live.
+ */
+static void insert_phis(void)
+{
+    int i, j, v, x, y, n, *work;
+
+    work = calloc(cur->n, sizeof(*work));
+    for (v = 0; v < n_vars; ++v) {
+        if (vars[v].excluded)
+            continue;
+
+        for (i = 0, n = 0; i < cur->n; ++i) {
+            if (bit_test(info[i].def, v)) {
+                work[n++] = i;
+                info[i].on_work = v + 1;
+            }
+        }
+
+        while (n) {
+            x = work[--n];
+            for (j = 0; j < info[x].n_df; ++j) {
+                y = info[x].df[j];
+                if (info[y].has_phi == v + 1 || !bit_test(info[y].in, v))
+                    continue;
+
+                add_phi(y, v);
+                info[y].has_phi = v + 1;
+                if (info[y].on_work != v + 1) {
+                    info[y].on_work = v + 1;
+                    work[n++] = y;
+                }
+            }
+        }
+    }
+
+    free(work);
+}
+
+/* Create new symbol for a version of variable, added to list of locals.
+ */
+static struct symbol *create_version(const struct symbol *orig)
+{
+    static int n;
+    struct symbol *sym;
+
+    sym = calloc(1, sizeof(*sym));
+    *sym = *orig;
+    sym->n = ++n;
+    sym->stack_offset = 0;
+    sym->regno = 0;
+    add_local(sym);
+    return sym;
+}
+
+static struct symbol *top_version(int v)
+{
+    struct variable *var = &vars[v];
+    return (var->n_stack) ? var->stack[var->n_stack - 1] : var->sym;
+}
+
+static struct symbol *push_version(int v)
+{
+    struct symbol *sym;
+    struct variable *var = &vars[v];
+
+    if (var->reuse) {
+        var->reuse = 0;
+        sym = var->sym;
+    } else {
+        sym = create_version(var->sym);
+    }
+
+    if (var->n_stack == var->cap_stack) {
+        var->cap_stack = (var->cap_stack) ? var->cap_stack * 2 : 8;
+        var->stack = realloc(var->stack, var->cap_stack * sizeof(*sym));
+    }
+
+    if (n_pushed == cap_pushed) {
+        cap_pushed = (cap_pushed) ? cap_pushed * 2 : 64;
+        pushed = realloc(pushed, cap_pushed * sizeof(*pushed));
+    }
+
+    var->stack[var->n_stack++] = sym;
+    pushed[n_pushed++] = v;
+    return sym;
+}
+
+static void rename_use(struct var *var)
+{
+    int v = var_index(*var);
+
+    if (v >= 0 && !vars[v].excluded)
+        var->symbol = top_version(v);
+}
+
+static void rename_def(struct var *var)
+{
+    int v = var_index(*var);
+
+    if (v >= 0 && !vars[v].excluded)
+        var->symbol = push_version(v);
+}
+
+/* Rename variables in preorder walk of dominator tree, where the current
+ * version of each variable is the top of its stack.
+ */
+static void rename_node(int i)
+{
+    int j, k, n, s, mark;
+    struct var *list[3], *def;
+    struct ssa_node *succ, *node = &cur->node[i];
+    struct block *block = node->block;
+
+    mark = n_pushed;
+    for (j = 0; j < node->n_phi; ++j)
+        rename_def(&node->phi[j].a);
+
+    for (j = 0; j < block->n; ++j) {
+        n = op_uses(block->code + j, list);
+        for (k = 0; k < n; ++k)
+            rename_use(list[k]);
+        if ((def = op_def(block->code + j)) != NULL)
+            rename_def(def);
+    }
+
+    if (has_tail_use(block))
+        rename_use(&block->expr);
+
+    for (j = 0; j < N_SUCCESSORS(block); ++j) {
+        if (!SUCCESSOR(block, j))
+            continue;
+
+        s = node_index(SUCCESSOR(block, j));
+        succ = &cur->node[s];
+        k = pred_index(succ, i, j);
+        for (n = 0; n < succ->n_phi; ++n)
+            rename_use(&succ->phi[n].args[k]);
+    }
+
+    for (j = info[i].child; j; j = info[j].sibling)
+        rename_node(j);
+
+    while (n_pushed > mark)
+        vars[pushed[--n_pushed]].n_stack--;
+}
+
+/* Free node list of function, including phi functions not yet translated.
+ */
+static void free_nodes(struct ssa *ssa)
+{
+    int i, j;
+    struct ssa_node *node;
+
+    for (i = 0; i < ssa->n; ++i) {
+        node = &ssa->node[i];
+        for (j = 0; j < node->n_phi; ++j)
+            free(node->phi[j].args);
+        free(node->phi);
+        free(node->pred);
+    }
+
+    free(ssa->node);
+    ssa->node = NULL;
+    ssa->n = 0;
+}
+
+/* Release memory only needed during construction.
+ */
+static void cleanup(void)
+{
+    int i;
+
+    for (i = 0; i < cur->n; ++i) {
+        free(info[i].df);
+        free(info[i].use);
+    }
+
+    for (i = 0; i < n_vars; ++i)
+        free(vars[i].stack);
+
+    free(info);
+    free(sym_map);
+    free(block_map);
+    free(pushed);
+    free(parent);
+    info = NULL;
+    parent = NULL;
+    n_members = 0;
+    sym_map = NULL;
+    block_map = NULL;
+    pushed = NULL;
+    n_pushed = cap_pushed = 0;
+    n_vars = 0;
+    cap_nodes = 0;
+    cur = NULL;
+}
+
+struct ssa *ssa_construct(const struct definition *def)
+{
+    int i, words;
+    struct ssa *ssa;
+
+    add_variables(def->params);
+    add_variables(def->locals);
+    if (!n_vars)
+        return NULL;
+
+    ssa = cur = calloc(1, sizeof(*ssa));
+    ssa->arena = def->arena;
+    link_nodes(def->body);
+    info = calloc(ssa->n, sizeof(*info));
+
+    /* Entry block must have no predecessors, leaving no place to copy the
+     * initial value of variables. */
+    if (ssa->node[0].n_pred) {
+        cleanup();
+        free_nodes(ssa);
+        free(ssa);
+        return NULL;
+    }
+
+    sym_map = calloc(n_vars, sizeof(*sym_map));
+    for (i = 0; i < n_vars; ++i) {
+        sym_map[i].sym = vars[i].sym;
+        sym_map[i].i = i;
+    }
+
+    qsort(sym_map, n_vars, sizeof(*sym_map), compare_symbol);
+    words = (n_vars + BITS - 1) / BITS;
+    scan_nodes(words);
+    compute_liveness(words);
+    compute_dominators();
+    compute_frontiers();
+    insert_phis();
+
+    /* Copy list of locals, which is still owned by the parser. */
+    ssa->n_locals = def->locals.length;
+    for (i = 0; i < def->locals.length; ++i)
+        add_local(def->locals.symbol[i]);
+
+    /* Original symbol is reused as first version of variables that are not
+     * read before being assigned, avoiding unused stack slots. */
+    for (i = 0; i < n_vars; ++i)
+        vars[i].reuse = !bit_test(info[0].in, i);
+
+    rename_node(0);
+    cleanup();
+    return ssa;
+}
+
+static struct block *split_edge(struct block *block, int j)
+{
+    struct block *split;
+    struct block_list *list = &cur->blocks;
+
+    split = arena_alloc(cur->arena, sizeof(*split));
+    split->label = sym_create_label();
+    split->jump[0] = SUCCESSOR(block, j);
+    SUCCESSOR(block, j) = split;
+
+    if (list->length == list->capacity) {
+        list->capacity = (list->capacity) ? list->capacity * 2 : 16;
+        list->block = realloc(list->block,
+            list->capacity * sizeof(*list->block));
+    }
+
+    list->block[list->length++] = split;
+    return split;
+}
+
+static void append_copy(struct block *block, struct var a, struct var b)
+{
+    int cap;
+    struct op op = {IR_ASSIGN};
+
+    op.a = a;
+    op.b = b;
+    if (block->n == block->capacity) {
+        cap = (block->capacity) ? block->capacity * 2 : 8;
+        block->code = arena_realloc(cur->arena, block->code,
+            block->capacity * sizeof(*block->code),
+            cap * sizeof(*block->code));
+        block->capacity = cap;
+    }
+
+    block->code[block->n++] = op;
+}
+
+/* Determine if variable is read by any of the copies except one.
+ */
+static int is_read(struct var var, const struct var *src, int n, int skip)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+        if (i != skip && src[i].kind == DIRECT && src[i].symbol == var.symbol)
+            return 1;
+
+    return 0;
+}
+
+/* Append parallel copies a[i] = b[i] as a sequence of assignments, ordered
+ * such that no variable is overwritten before being read. Cycles are broken
+ * by saving one of the values to a temporary.
+ */
+static void append_parallel_copy(
+    struct block *block,
+    struct var *a,
+    struct var *b,
+    int n)
+{
+    int i, progress;
+    struct var tmp;
+
+    while (n) {
+        progress = 0;
+        for (i = 0; i < n; ++i) {
+            if (!is_read(a[i], b, n, i)) {
+                append_copy(block, a[i], b[i]);
+                n--;
+                a[i] = a[n];
+                b[i] = b[n];
+                i--;
+                progress = 1;
+            }
+        }
+
+        if (!progress) {
+            tmp = var_direct(create_version(a[0].symbol));
+            append_copy(block, tmp, a[0]);
+            for (i = 0; i < n; ++i)
+                if (b[i].kind == DIRECT && b[i].symbol == a[0].symbol)
+                    b[i] = tmp;
+        }
+    }
+}
+
+static int member_index(struct var var)
+{
+    struct symbol_index key, *found;
+
+    if (var.kind == IMMEDIATE || !var.symbol || !n_members)
+        return -1;
+
+    key.sym = var.symbol;
+    found = bsearch(&key, sym_map, n_members, sizeof(*sym_map),
+        compare_symbol);
+    return (found) ? found->i : -1;
+}
+
+static int find(int i)
+{
+    while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+
+    return i;
+}
+
+/* Collect symbols used in phi functions, and union each phi target with its
+ * arguments.
+ */
+static void find_webs(void)
+{
+    int i, j, k, l, a, b;
+    struct phi *phi;
+
+    for (i = 0, l = 0; i < cur->n; ++i)
+        l += cur->node[i].n_phi * (cur->node[i].n_pred + 1);
+
+    sym_map = calloc(l, sizeof(*sym_map));
+    for (i = 0; i < cur->n; ++i) {
+        for (j = 0; j < cur->node[i].n_phi; ++j) {
+            phi = &cur->node[i].phi[j];
+            sym_map[n_members++].sym = phi->a.symbol;
+            for (k = 0; k < cur->node[i].n_pred; ++k)
+                if (phi->args[k].kind == DIRECT)
+                    sym_map[n_members++].sym = phi->args[k].symbol;
+        }
+    }
+
+    qsort(sym_map, n_members, sizeof(*sym_map), compare_symbol);
+    for (i = 0, l = 0; i < n_members; ++i) {
+        if (!l || sym_map[l - 1].sym != sym_map[i].sym) {
+            sym_map[l].sym = sym_map[i].sym;
+            sym_map[l].i = l;
+            l++;
+        }
+    }
+
+    n_members = l;
+    parent = calloc(n_members, sizeof(*parent));
+    for (i = 0; i < n_members; ++i)
+        parent[i] = i;
+
+    for (i = 0; i < cur->n; ++i) {
+        for (j = 0; j < cur->node[i].n_phi; ++j) {
+            phi = &cur->node[i].phi[j];
+            a = find(member_index(phi->a));
+            for (k = 0; k < cur->node[i].n_pred; ++k) {
+                b = member_index(phi->args[k]);
+                if (b >= 0 && (b = find(b)) != a)
+                    parent[b] = a;
+            }
+        }
+    }
+}
+
+/* Compute set of web members live at the end of node i, including arguments
+ * to phi functions in successors.
+ */
+static void live_out(int i, unsigned long *out, int words)
+{
+    int j, k, n, s, v;
+    struct ssa_node *succ;
+    struct block *block = cur->node[i].block;
+
+    memset(out, 0, words * sizeof(*out));
+    for (j = 0; j < N_SUCCESSORS(block); ++j) {
+        if (!SUCCESSOR(block, j))
+            continue;
+
+        s = node_index(SUCCESSOR(block, j));
+        succ = &cur->node[s];
+        for (k = 0; k < words; ++k)
+            out[k] |= info[s].in[k];
+
+        k = pred_index(succ, i, j);
+        for (n = 0; n < succ->n_phi; ++n)
+            if ((v = member_index(succ->phi[n].args[k])) >= 0)
+                bit_set(out, v);
+    }
+}
+
+/* Compute liveness of web members, where phi targets are assigned at the
+ * start of the block, and phi arguments read at the end of the corresponding
+ * predecessor.
+ */
+static void compute_member_liveness(int words)
+{
+    int i, j, k, n, v, changed;
+    unsigned long u, *out;
+    struct var *list[3], *def;
+    struct block *block;
+    struct ssa_node *node;
+
+    for (i = 0; i < cur->n; ++i) {
+        node = &cur->node[i];
+        block = node->block;
+        info[i].use = calloc(3 * words, sizeof(*info[i].use));
+        info[i].def = info[i].use + words;
+        info[i].in = info[i].use + 2 * words;
+        for (j = 0; j < node->n_phi; ++j)
+            bit_set(info[i].def, member_index(node->phi[j].a));
+
+        for (j = 0; j <= block->n; ++j) {
+            if (j < block->n) {
+                n = op_uses(block->code + j, list);
+                def = op_def(block->code + j);
+            } else {
+                n = 0;
+                if (has_tail_use(block))
+                    list[n++] = &block->expr;
+                def = NULL;
+            }
+
+            for (k = 0; k < n; ++k) {
+                v = member_index(*list[k]);
+                if (v >= 0 && !bit_test(info[i].def, v))
+                    bit_set(info[i].use, v);
+            }
+
+            if (def && (v = member_index(*def)) >= 0)
+                bit_set(info[i].def, v);
+        }
+    }
+
+    out = calloc(words, sizeof(*out));
+    do {
+        changed = 0;
+        for (i = cur->n - 1; i >= 0; --i) {
+            live_out(i, out, words);
+            for (k = 0; k < words; ++k) {
+                u = info[i].use[k] | (out[k] & ~info[i].def[k]);
+                if (u != info[i].in[k]) {
+                    info[i].in[k] = u;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    free(out);
+}
+/* Mark web as conflicting if any other member is live where v is assigned.
+ */
+static void interfere(
+    int v,
+    const unsigned long *live,
+    const int *next,
+    int *conflict)
+{
+    int w, root = find(v);
+
+    for (w = root; w >= 0 && !conflict[root]; w = next[w])
+        if (w != v && bit_test(live, w))
+            conflict[root] = 1;
+}
+
+/* Find webs where two members are live at the same time, which cannot be
+ * merged to a single symbol. Return list of flags indexed by web root.
+ */
+static int *find_conflicts(int words)
+{
+    int i, j, k, n, v, *next, *conflict;
+    unsigned long *live;
+    struct var *list[3], *def;
+    struct block *block;
+    struct ssa_node *node;
+
+    /* Link members of each web in a list starting at the root. */
+    next = calloc(n_members, sizeof(*next));
+    conflict = calloc(n_members, sizeof(*conflict));
+    for (i = 0; i < n_members; ++i)
+        next[i] = -1;
+
+    for (i = 0; i < n_members; ++i) {
+        v = find(i);
+        if (v != i) {
+            next[i] = next[v];
+            next[v] = i;
+        }
+    }
+
+    live = calloc(words, sizeof(*live));
+    for (i = 0; i < cur->n; ++i) {
+        node = &cur->node[i];
+        block = node->block;
+        live_out(i, live, words);
+        if (has_tail_use(block) && (v = member_index(block->expr)) >= 0)
+            bit_set(live, v);
+
+        for (j = block->n - 1; j >= 0; --j) {
+            def = op_def(block->code + j);
+            if (def && (v = member_index(*def)) >= 0) {
+                interfere(v, live, next, conflict);
+                live[v / BITS] &= ~(1ul << (v % BITS));
+            }
+
+            n = op_uses(block->code + j, list);
+            for (k = 0; k < n; ++k)
+                if ((v = member_index(*list[k])) >= 0)
+                    bit_set(live, v);
+        }
+
+        /* Phi functions are evaluated in parallel, and cannot assign to
+         * the same symbol. */
+        for (j = 0; j < node->n_phi; ++j) {
+            v = member_index(node->phi[j].a);
+            interfere(v, live, next, conflict);
+            for (k = 0; k < j; ++k)
+                if (find(member_index(node->phi[k].a)) == find(v))
+                    conflict[find(v)] = 1;
+        }
+    }
+
+    free(live);
+    free(next);
+    return conflict;
+}
+
+static void merge_var(struct var *var, struct symbol *const *target)
+{
+    int v = member_index(*var);
+
+    if (v >= 0 && target[v])
+        var->symbol = target[v];
+}
+
+/* Replace all members of webs without conflicts by a single symbol, removing
+ * the other versions from list of locals. Original symbols are preferred as
+ * representative of each web.
+ */
+static void merge_webs(const int *conflict)
+{
+    int i, j, k, n, v, *root, *created;
+    struct var *list[3], *def;
+    struct symbol **target, *sym;
+    struct ssa_node *node;
+    struct block *block;
+
+    root = calloc(2 * n_members, sizeof(*root));
+    created = root + n_members;
+    target = calloc(n_members, sizeof(*target));
+    for (i = cur->n_locals; i < cur->locals.length; ++i) {
+        v = member_index(var_direct(cur->locals.symbol[i]));
+        if (v >= 0)
+            created[v] = 1;
+    }
+
+    for (i = 0; i < n_members; ++i)
+        root[i] = -1;
+
+    for (i = 0; i < n_members; ++i) {
+        v = find(i);
+        if (root[v] < 0 || (created[root[v]] && !created[i]))
+            root[v] = i;
+    }
+
+    for (i = 0; i < n_members; ++i) {
+        v = find(i);
+        if (!conflict[v])
+            target[i] = (struct symbol *) sym_map[root[v]].sym;
+    }
+
+    for (i = 0; i < cur->n; ++i) {
+        node = &cur->node[i];
+        block = node->block;
+        for (j = 0; j < node->n_phi; ++j) {
+            merge_var(&node->phi[j].a, target);
+            for (k = 0; k < node->n_pred; ++k)
+                merge_var(&node->phi[j].args[k], target);
+        }
+
+        for (j = 0; j < block->n; ++j) {
+            n = op_uses(block->code + j, list);
+            for (k = 0; k < n; ++k)
+                merge_var(list[k], target);
+            if ((def = op_def(block->code + j)) != NULL)
+                merge_var(def, target);
+        }
+
+        if (has_tail_use(block))
+            merge_var(&block->expr, target);
+    }
+
+    for (i = cur->n_locals, j = i; i < cur->locals.length; ++i) {
+        sym = cur->locals.symbol[i];
+        v = member_index(var_direct(sym));
+        if (v >= 0 && target[v] && target[v] != sym)
+            free(sym);
+        else
+            cur->locals.symbol[j++] = sym;
+    }
+
+    cur->locals.length = j;
+    free(target);
+    free(root);
+}
+
+/* Replace phi functions by copies in predecessors, splitting critical edges
+ * where needed.
+ */
+static void insert_copies(void)
+{
+    int i, j, k, n;
+    struct var *a, *b, arg;
+    struct block *block;
+    struct ssa_node *node;
+    struct ssa_edge edge;
+
+    for (i = 0; i < cur->n; ++i) {
+        node = &cur->node[i];
+        if (!node->n_phi)
+            continue;
+
+        a = calloc(2 * node->n_phi, sizeof(*a));
+        b = a + node->n_phi;
+        for (j = 0; j < node->n_pred; ++j) {
+            for (k = 0, n = 0; k < node->n_phi; ++k) {
+                arg = node->phi[k].args[j];
+                if (arg.kind != DIRECT || arg.symbol != node->phi[k].a.symbol) {
+                    a[n] = node->phi[k].a;
+                    b[n] = arg;
+                    n++;
+                }
+            }
+
+            if (!n)
+                continue;
+
+            /* Copies cannot be placed before a branch, as the variable
+             * assigned can be live on the other path. */
+            edge = node->pred[j];
+            block = cur->node[edge.node].block;
+            if (block->jump[1] || block->n_table)
+                block = split_edge(block, edge.jump);
+
+            append_parallel_copy(block, a, b, n);
+        }
+
+        free(a);
+        for (k = 0; k < node->n_phi; ++k)
+            free(node->phi[k].args);
+
+        free(node->phi);
+        node->phi = NULL;
+        node->n_phi = 0;
+    }
+}
+
+void ssa_destruct(struct ssa *ssa)
+{
+    int words, *conflict;
+
+    cur = ssa;
+    info = calloc(ssa->n, sizeof(*info));
+    map_blocks();
+    find_webs();
+    if (n_members) {
+        words = (n_members + BITS - 1) / BITS;
+        compute_member_liveness(words);
+        conflict = find_conflicts(words);
+        merge_webs(conflict);
+        free(conflict);
+    }
+
+    insert_copies();
+    cleanup();
+}
+
+void ssa_free(struct ssa *ssa)
+{
+    int i;
+
+    for (i = ssa->n_locals; i < ssa->locals.length; ++i)
+        free(ssa->locals.symbol[i]);
+
+    free_nodes(ssa);
+    free(ssa->locals.symbol);
+    free(ssa->blocks.block);
+    free(ssa);
+}
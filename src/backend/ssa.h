@@ -0,0 +1,75 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include <lacc/ir.h>
+
+/* Phi function at the start of a basic block, assigning to a the argument
+ * corresponding to the predecessor edge control came from.
+ */
+struct phi {
+    struct var a;
+    struct var *args;
+};
+
+/* Edge in control flow graph, from node through one of its successors.
+ */
+struct ssa_edge {
+    int node;
+    int jump;
+};
+
+/* Basic block reachable from function entry, with dominator and phi functions.
+ */
+struct ssa_node {
+    struct block *block;
+
+    /* Index of immediate dominator, or -1 for entry node. */
+    int idom;
+
+    /* Incoming edges, in the same order as arguments to phi functions. */
+    struct ssa_edge *pred;
+    int n_pred;
+
+    struct phi *phi;
+    int n_phi;
+};
+
+/* Function in SSA form. Nodes are numbered in reverse postorder, with entry
+ * node first.
+ */
+struct ssa {
+    struct ssa_node *node;
+    int n;
+
+    /* Local variables of the function, followed by versions created when
+     * renaming starting at index n_locals. */
+    struct symbol_list locals;
+    int n_locals;
+
+    /* Blocks created when splitting critical edges, allocated in the arena
+     * of the definition together with copies appended to existing blocks. */
+    struct block_list blocks;
+    struct arena *arena;
+};
+
+/* Convert function to SSA form. Scalar parameters and local variables that
+ * never have their address taken are renamed to a separate symbol for each
+ * assignment, with phi functions inserted at join points where more than one
+ * version is live. Operations are modified in place, while new symbols are
+ * only added to the list of locals owned by the result.
+ *
+ * Return NULL if the function has no variables to rename.
+ */
+struct ssa *ssa_construct(const struct definition *def);
+
+/* Translate out of SSA form by replacing phi functions with copies at the end
+ * of predecessor blocks. Critical edges are split to make room for the copies.
+ */
+void ssa_destruct(struct ssa *ssa);
+
+/* Free memory, including symbols created. Must not be called until the
+ * function is completely compiled.
+ */
+void ssa_free(struct ssa *ssa);
+
+#endif
@@ -100,8 +100,11 @@ static const char *address(struct address addr)
         w += snprintf(buf + w, s - w, "%d", addr.disp);
     }
 
-    reg.r = addr.base;
-    w += snprintf(buf + w, s - w, "(%s", mnemonic(reg));
+    w += snprintf(buf + w, s - w, "(");
+    if (addr.base) {
+        reg.r = addr.base;
+        w += snprintf(buf + w, s - w, "%s", mnemonic(reg));
+    }
     if (addr.offset) {
         reg.r = addr.offset;
         w += snprintf(buf + w, s - w, ",%s,%d", mnemonic(reg), addr.mult);
@@ -202,8 +205,7 @@ int asm_symbol(const struct symbol *sym)
         I2(".type", sym->name, "@function");
         out("%s:\n", sym->name);
     } else if (sym->symtype == SYM_STRING_VALUE) {
-        I0(".data");
-        out("\t.align\t%d\n", sym_alignment(sym));
+        I0(".section .rodata.str1.1,\"aMS\",@progbits,1");
         out("\t.type\t%s, @object\n", sym_name(sym));
         out("\t.size\t%s, %d\n", sym_name(sym), size_of(&sym->type));
         out("%s:\n", sym_name(sym));
@@ -306,12 +308,22 @@ int asm_text(struct instruction instr)
     case INSTR_CMP:      S2("cmp", wd, source, destin); break;
     case INSTR_LEA:      S2("lea", wd, source, destin); break;
     case INSTR_PUSH:     S1("push", ws, source); break;
-    case INSTR_JMP:      I1("jmp", source); break;
+    case INSTR_JMP:
+        if (instr.optype == OPT_IMM)
+            I1("jmp", source);
+        else
+            out("\tjmp\t*%s\n", source);
+        break;
     case INSTR_JZ:       I1("jz", source); break;
     case INSTR_JA:       I1("ja", source); break;
     case INSTR_JG:       I1("jg", source); break;
     case INSTR_JAE:      I1("jae", source); break;
     case INSTR_JGE:      I1("jge", source); break;
+    case INSTR_JNZ:      I1("jnz", source); break;
+    case INSTR_JB:       I1("jb", source); break;
+    case INSTR_JL:       I1("jl", source); break;
+    case INSTR_JBE:      I1("jbe", source); break;
+    case INSTR_JLE:      I1("jle", source); break;
     case INSTR_CALL:
         if (instr.optype == OPT_REG)
             out("\tcall\t*%s\n", source);
@@ -321,6 +333,66 @@ int asm_text(struct instruction instr)
     case INSTR_LEAVE:    I0("leave"); break;
     case INSTR_RET:      I0("ret"); break;
     case INSTR_REP_MOVSQ:I0("rep movsq"); break;
+    case INSTR_REP_STOSQ:I0("rep stosq"); break;
+    }
+
+    return 0;
+}
+
+int asm_bss(const struct symbol *sym)
+{
+    assert(sym->symtype == SYM_DEFINITION);
+    asm_flush();
+    current_symbol = sym;
+
+    I0(".bss");
+    if (sym->linkage == LINK_EXTERN)
+        I1(".globl", sym->name);
+    out("\t.align\t%d\n", sym_alignment(sym));
+    out("\t.type\t%s, @object\n", sym_name(sym));
+    out("\t.size\t%s, %d\n", sym_name(sym), size_of(&sym->type));
+    out("%s:\n", sym_name(sym));
+    out("\t.zero\t%d\n", size_of(&sym->type));
+    return 0;
+}
+
+int asm_rodata(const struct symbol *sym)
+{
+    assert(sym->symtype == SYM_DEFINITION);
+    asm_flush();
+    current_symbol = sym;
+
+    I0(".section .rodata");
+    if (sym->linkage == LINK_EXTERN)
+        I1(".globl", sym->name);
+    out("\t.align\t%d\n", sym_alignment(sym));
+    out("\t.type\t%s, @object\n", sym_name(sym));
+    out("\t.size\t%s, %d\n", sym_name(sym), size_of(&sym->type));
+    out("%s:\n", sym_name(sym));
+    return 0;
+}
+
+/* Write bytes in lines of .byte directives, with runs of zero written as
+ * a single .zero directive.
+ */
+int asm_bytes(const char *ptr, size_t n)
+{
+    size_t i, j;
+
+    for (i = 0; i < n; i = j) {
+        for (j = i; j < n && (!ptr || !ptr[j]); ++j)
+            continue;
+
+        if (j - i >= 8 || j == n) {
+            if (j > i)
+                out("\t.zero\t%lu\n", (unsigned long) (j - i));
+            continue;
+        }
+
+        out("\t.byte\t%d", (unsigned char) ptr[i]);
+        for (j = i + 1; j < n && j - i < 16; ++j)
+            out(",%d", (unsigned char) ptr[j]);
+        out("\n");
     }
 
     return 0;
@@ -357,6 +429,23 @@ int asm_data(struct immediate data)
     return 0;
 }
 
+int asm_jump_table(
+    const struct symbol *table,
+    const struct symbol **labels,
+    int n)
+{
+    int i;
+
+    out("\t.section .rodata\n");
+    out("\t.align\t8\n");
+    out("%s:\n", sym_name(table));
+    for (i = 0; i < n; ++i)
+        out("\t.quad\t%s\n", sym_name(labels[i]));
+
+    I0(".text");
+    return 0;
+}
+
 int asm_flush(void)
 {
     if (current_symbol) {
@@ -21,6 +21,27 @@ int asm_text(struct instruction instr);
  */
 int asm_data(struct immediate data);
 
+/* Add n bytes to internal symbol context, or zeros if ptr is NULL.
+ */
+int asm_bytes(const char *ptr, size_t n);
+
+/* Define symbol in .bss, with all bytes zero. This starts a new context like
+ * asm_symbol, with no data following.
+ */
+int asm_bss(const struct symbol *sym);
+
+/* Define symbol in .rodata, with data following like for asm_symbol.
+ */
+int asm_rodata(const struct symbol *sym);
+
+/* Add table of label addresses to read-only data, defined by symbol table.
+ * Can be called in the middle of a function, which continues after the table.
+ */
+int asm_jump_table(
+    const struct symbol *table,
+    const struct symbol **labels,
+    int n);
+
 /* Write any buffered data to output.
  */
 int asm_flush(void);
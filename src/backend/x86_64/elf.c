@@ -1,9 +1,20 @@
+#if _XOPEN_SOURCE < 500
+#  undef _XOPEN_SOURCE
+#  define _XOPEN_SOURCE 500 /* writev */
+#endif
 #include "abi.h"
 #include "elf.h"
+#include <lacc/cli.h>
+#include <lacc/hash.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
-#define SHNUM 9     /* Number of section headers */
+#define SHNUM 12    /* Number of section headers */
 
 #define SHID_ZERO 0
 #define SHID_SHSTRTAB 1
@@ -11,9 +22,16 @@
 #define SHID_SYMTAB 3
 #define SHID_RELA_TEXT 4
 #define SHID_RELA_DATA 5
-#define SHID_DATA 6
-#define SHID_RODATA 7
-#define SHID_TEXT 8
+#define SHID_RELA_RODATA 6
+#define SHID_DATA 7
+#define SHID_RODATA 8
+#define SHID_TEXT 9
+#define SHID_RODATA_STR 10
+#define SHID_BSS 11
+
+/* Index of section symbol for .text, used for relocations to labels.
+ */
+#define SYMTAB_TEXT 2
 
 #define SHDR_CHAIN_OFFSET(a, b) \
     shdr[b].sh_offset = shdr[a].sh_offset + shdr[a].sh_size
@@ -48,7 +66,8 @@ static Elf64_Ehdr header = {
 
 static char shstrtab[] =
     "\0.data\0.text\0.shstrtab\0.symtab\0.strtab\0.rodata"
-    "\0.rela.text\0.rela.data\0\0\0\0\0\0\0\0\0\0\0"; /* Make size % 16 = 0 */
+    "\0.rela.text\0.rela.data\0.rela.rodata\0.bss\0.rodata.str1.1"
+    "\0\0\0\0\0\0\0\0\0\0"; /* Make size % 16 = 0 */
 
 static Elf64_Shdr shdr[] = {
     {0},                /* First section header must contain all-zeroes */
@@ -112,6 +131,18 @@ static Elf64_Shdr shdr[] = {
         8,              /* sh_addralign */
         sizeof(Elf64_Rela)
     },
+    { /* .rela.rodata */
+        69,             /* sh_name, index into shstrtab */
+        SHT_RELA,       /* sh_type */
+        0x0,
+        0x0,            /* Virtual address */
+        0x0,            /* Offset in file (TODO!) */
+        0,              /* Size of section (TODO!) */
+        SHID_SYMTAB,    /* sh_link, symbol table referenced by relocations */
+        SHID_RODATA,    /* sh_info, section which relocations apply */
+        8,              /* sh_addralign */
+        sizeof(Elf64_Rela)
+    },
     { /* .data */
         1,              /* sh_name, index into shstrtab */
         SHT_PROGBITS,   /* Section type */
@@ -147,23 +178,85 @@ static Elf64_Shdr shdr[] = {
         0,              /* sh_info */
         16,             /* sh_addralign */
         0               /* sh_entsize */
+    },
+    { /* .rodata.str1.1 */
+        87,             /* sh_name, index into shstrtab */
+        SHT_PROGBITS,   /* sh_type */
+        SHF_ALLOC | SHF_MERGE | SHF_STRINGS,
+        0x0,            /* Virtual address */
+        0x0,            /* Offset in file (TODO!) */
+        0,              /* Size of section (TODO!) */
+        SHN_UNDEF,      /* sh_link */
+        0,              /* sh_info */
+        1,              /* sh_addralign */
+        1               /* sh_entsize, size of each character */
+    },
+    { /* .bss */
+        82,             /* sh_name, index into shstrtab */
+        SHT_NOBITS,     /* sh_type */
+        SHF_WRITE | SHF_ALLOC,
+        0x0,            /* Virtual address */
+        0x0,            /* Offset in file, no data is stored */
+        0,              /* Size of section (TODO!) */
+        SHN_UNDEF,      /* sh_link */
+        0,              /* sh_info */
+        16,             /* sh_addralign */
+        0               /* sh_entsize */
     }
 };
 
+/* Ensure buffer has room for size bytes, growing capacity geometrically to
+ * keep appending to sections amortized constant time.
+ */
+static void *reserve(void *buf, size_t *cap, size_t size)
+{
+    if (size > *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        while (*cap < size)
+            *cap *= 2;
+        buf = realloc(buf, *cap);
+    }
+
+    return buf;
+}
+
 static unsigned char *data;
 static unsigned char *rodata;
+static unsigned char *rodata_str;
+static size_t data_cap, rodata_cap, rodata_str_cap;
+
+/* Section of object currently being defined, either .data or .rodata. Written
+ * to by elf_data and elf_bytes.
+ */
+static int data_section = SHID_DATA;
 
-/* Write bytes to .data or .rodata section. If ptr is NULL, fill with zeros.
+/* Write bytes to .data, .rodata or .rodata.str1.1 section. If ptr is NULL,
+ * fill with zeros.
  */
 static int elf_data_add(int shid, const char *ptr, size_t n)
 {
     size_t offset;
+    size_t *cap;
     unsigned char **buf;
-    assert(shid == SHID_DATA || shid == SHID_RODATA);
+
+    switch (shid) {
+    case SHID_DATA:
+        buf = &data;
+        cap = &data_cap;
+        break;
+    case SHID_RODATA:
+        buf = &rodata;
+        cap = &rodata_cap;
+        break;
+    default:
+        assert(shid == SHID_RODATA_STR);
+        buf = &rodata_str;
+        cap = &rodata_str_cap;
+        break;
+    }
 
     offset = shdr[shid].sh_size;
-    buf = (shid == SHID_DATA) ? &data : &rodata;
-    *buf = realloc(*buf, offset + n);
+    *buf = reserve(*buf, cap, offset + n);
     if (ptr)
         memcpy(*buf + offset, ptr, n);
     else
@@ -187,8 +280,18 @@ static int elf_data_align(int shid, int align)
 }
 
 static unsigned char *text;
+static size_t text_cap;
 
 static Elf64_Sym *symtab;
+static size_t symtab_cap;
+
+/* Keep track of function being assembled, updating st_size after each
+ * instruction. Internal functions have their entry in symtab, at the index
+ * stored in current_function_index, which must be refreshed if the table is
+ * moved. Otherwise the index is -1.
+ */
+static Elf64_Sym *current_function_entry;
+static int current_function_index = -1;
 
 /* Add entry to .symtab, returning index.
  */
@@ -203,15 +306,17 @@ static int elf_symtab_add(Elf64_Sym entry)
     int i;
 
     if (!symtab) {
-        symtab = calloc(1, sizeof(default_symbols));
+        symtab = reserve(symtab, &symtab_cap, sizeof(default_symbols));
         symtab = memcpy(symtab, default_symbols, sizeof(default_symbols));
         shdr[SHID_SYMTAB].sh_size = sizeof(default_symbols);
     }
 
     i = shdr[SHID_SYMTAB].sh_size / sizeof(Elf64_Sym);
     shdr[SHID_SYMTAB].sh_size += sizeof(Elf64_Sym);
-    symtab = realloc(symtab, shdr[SHID_SYMTAB].sh_size);
+    symtab = reserve(symtab, &symtab_cap, shdr[SHID_SYMTAB].sh_size);
     symtab[i] = entry;
+    if (current_function_index >= 0)
+        current_function_entry = &symtab[current_function_index];
 
     /* All STB_LOCAL must come before STB_GLOBAL. Index of the first non-local
      * symbol is stored in section header field. */
@@ -224,66 +329,78 @@ static int elf_symtab_add(Elf64_Sym entry)
 }
 
 static char *strtab;
+static size_t strtab_cap;
+
+/* Offsets of names in .strtab, used to find duplicates. Offset zero is the
+ * empty name, so a NULL value means the name is not yet added.
+ */
+static struct hash_table strtab_offsets;
 
 /* Add string to .strtab, returning its offset into the section for use in
- * references.
+ * references. Names already added are reused.
  */
 static int elf_strtab_add(const char *str)
 {
-    /* Current amount of padding in strtab, filled with zeroes. Section size is 
-     * padded to make it align to 0x10. Adding new strings first eat off any
-     * redundant padding. */
-    static size_t padding;
+    struct hash_entry *entry;
+    size_t len, off;
 
-    size_t
-        len = strlen(str) + 1, /* including zero byte */
-        off = shdr[SHID_STRTAB].sh_size - padding; /* pos of new string */
+    entry = hash_table_insert(&strtab_offsets, str);
+    if (entry->value)
+        return (size_t) entry->value;
 
-    /* First byte should be '\0' */
+    /* First byte should be '\0'. */
+    off = shdr[SHID_STRTAB].sh_size;
     if (!off)
         off = 1;
 
-    padding = 0x10 - ((off + len) % 0x10);
-    shdr[SHID_STRTAB].sh_size = off + len + padding;
-    assert(shdr[SHID_STRTAB].sh_size % 0x10 == 0);
-
-    strtab = realloc(strtab, shdr[SHID_STRTAB].sh_size);
-    strcpy(strtab + off, str);
-    memset(strtab + off + len, '\0', padding);
-    strtab[off - 1] = '\0';
-
+    len = strlen(str) + 1;
+    strtab = reserve(strtab, &strtab_cap, off + len);
+    strtab[0] = '\0';
+    memcpy(strtab + off, str, len);
+    shdr[SHID_STRTAB].sh_size = off + len;
+    entry->value = (void *) off;
     return off;
 }
 
 static Elf64_Rela
     *rela_text,
-    *rela_data;
+    *rela_data,
+    *rela_rodata;
 
 /* Pending relocations, waiting for sym->stack_offset to be resolved to index
- * into .symtab.
+ * into .symtab. References to labels are resolved at the end of each function,
+ * as labels are released after that. Symbol is then NULL, with index given.
  */
 static struct pending_relocation {
     const struct symbol *symbol;
+    int index;
     enum rel_type type;
     int section;                /* section id of .rela.X */
-    int offset;                 /* offset into .text */
+    int offset;                 /* offset into .text, .data or .rodata */
     int addend;                 /* offset into symbol ? */
 } *prl;
 
 static int
     n_rela_data,
-    n_rela_text;
+    n_rela_rodata,
+    n_rela_text,
+    n_prl,
+    n_prl_function;
+
+static size_t prl_cap;
 
 static void add_reloc(struct pending_relocation entry)
 {
     if (entry.section == SHID_RELA_TEXT)
         n_rela_text++;
-    else {
-        assert(entry.section == SHID_RELA_DATA);
+    else if (entry.section == SHID_RELA_DATA)
         n_rela_data++;
+    else {
+        assert(entry.section == SHID_RELA_RODATA);
+        n_rela_rodata++;
     }
-    prl = realloc(prl, (n_rela_text + n_rela_data) * sizeof(*prl));
-    prl[n_rela_text + n_rela_data - 1] = entry;
+    prl = reserve(prl, &prl_cap, (n_prl + 1) * sizeof(*prl));
+    prl[n_prl++] = entry;
 }
 
 void elf_add_reloc_text(
@@ -309,8 +426,9 @@ static void elf_add_reloc_data(
     struct pending_relocation r = {0};
     r.symbol = symbol;
     r.type = type;
-    r.section = SHID_RELA_DATA;
-    r.offset = shdr[SHID_DATA].sh_size;
+    r.section =
+        (data_section == SHID_DATA) ? SHID_RELA_DATA : SHID_RELA_RODATA;
+    r.offset = shdr[data_section].sh_size;
     r.addend = addend;
     add_reloc(r);
 }
@@ -326,8 +444,8 @@ static void elf_add_reloc_data(
 static void flush_relocations(void)
 {
     int i;
-    Elf64_Rela *entry, *data_entry, *text_entry;
-    assert(!rela_text && !rela_data);
+    Elf64_Rela *entry, *data_entry, *rodata_entry, *text_entry;
+    assert(!rela_text && !rela_data && !rela_rodata);
 
     rela_text = calloc(n_rela_text, sizeof(*rela_text));
     text_entry = rela_text;
@@ -337,10 +455,15 @@ static void flush_relocations(void)
     data_entry = rela_data;
     shdr[SHID_RELA_DATA].sh_size = n_rela_data * sizeof(Elf64_Rela);
 
-    for (i = 0; i < n_rela_text + n_rela_data; ++i) {
-        assert(prl[i].type == R_X86_64_PC32 || prl[i].type == R_X86_64_32S);
+    rela_rodata = calloc(n_rela_rodata, sizeof(*rela_rodata));
+    rodata_entry = rela_rodata;
+    shdr[SHID_RELA_RODATA].sh_size = n_rela_rodata * sizeof(Elf64_Rela);
+
+    for (i = 0; i < n_prl; ++i) {
         if (prl[i].section == SHID_RELA_DATA)
             entry = data_entry++;
+        else if (prl[i].section == SHID_RELA_RODATA)
+            entry = rodata_entry++;
         else {
             assert(prl[i].section == SHID_RELA_TEXT);
             entry = text_entry++;
@@ -348,6 +471,13 @@ static void flush_relocations(void)
 
         entry->r_offset = prl[i].offset;
         entry->r_addend = prl[i].addend;
+        if (!prl[i].symbol) {
+            entry->r_info = ELF64_R_INFO(prl[i].index, prl[i].type);
+            continue;
+        }
+
+        assert(prl[i].type == R_X86_64_PC32 || prl[i].type == R_X86_64_32S
+            || prl[i].type == R_X86_64_64);
         entry->r_info =
             ELF64_R_INFO(symtab_index_of(prl[i].symbol), prl[i].type);
 
@@ -358,10 +488,178 @@ static void flush_relocations(void)
     }
 }
 
-/* Keep track of function being assembled, updating st_size after each
- * instruction.
+/* Jumps to labels in the current function. Instructions are first written
+ * with 32 bit displacement, and rewritten to their final size and offset once
+ * all labels in the function are known.
  */
-static Elf64_Sym *current_function_entry;
+static struct branch {
+    const struct symbol *label;
+    int offset;                 /* offset of instruction in .text */
+    int size;                   /* 2 for rel8, otherwise same as near */
+    int near;                   /* 5 for jmp rel32, 6 for jcc rel32 */
+} *branches;
+static int n_branches, cap_branches;
+
+/* Labels defined in the current function, with stack_offset holding their
+ * position in .text.
+ */
+static const struct symbol **labels;
+static int n_labels, cap_labels;
+
+/* Total number of bytes saved by branches preceding each branch, with one
+ * extra element for the end of the function.
+ */
+static int *shrink;
+
+static void add_label(const struct symbol *label)
+{
+    if (n_labels == cap_labels) {
+        cap_labels = cap_labels ? cap_labels * 2 : 64;
+        labels = realloc(labels, cap_labels * sizeof(*labels));
+    }
+
+    labels[n_labels++] = label;
+}
+
+void elf_add_branch(const struct symbol *label, int disp_offset)
+{
+    struct branch *b;
+
+    assert(label->symtype == SYM_LABEL);
+    assert(disp_offset == 1 || disp_offset == 2);
+    if (n_branches == cap_branches) {
+        cap_branches = cap_branches ? cap_branches * 2 : 64;
+        branches = realloc(branches, cap_branches * sizeof(*branches));
+        shrink = realloc(shrink, (cap_branches + 1) * sizeof(*shrink));
+    }
+
+    b = &branches[n_branches++];
+    b->label = label;
+    b->offset = shdr[SHID_TEXT].sh_size;
+    b->near = disp_offset + 4;
+    b->size = 2;
+}
+
+/* Translate offset in .text as written to the position after relaxation,
+ * counting bytes saved by branches placed before the offset.
+ */
+static int relaxed_offset(int offset)
+{
+    int lo = 0, hi = n_branches, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (branches[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return offset - shrink[lo];
+}
+
+static void compute_shrink(void)
+{
+    int i;
+
+    shrink[0] = 0;
+    for (i = 0; i < n_branches; ++i)
+        shrink[i + 1] = shrink[i] + branches[i].near - branches[i].size;
+}
+
+static int branch_displacement(const struct branch *b, int i)
+{
+    int end = b->offset - shrink[i] + b->size;
+    return relaxed_offset(b->label->stack_offset) - end;
+}
+
+/* Find the size of each branch in the current function. All branches start
+ * out as rel8, and are extended to rel32 if the target is out of range. Growing
+ * a branch can only increase other displacements, so this is repeated until no
+ * branch changes.
+ */
+static void relax_branches(void)
+{
+    int i, disp, changed;
+
+    do {
+        changed = 0;
+        compute_shrink();
+        for (i = 0; i < n_branches; ++i) {
+            if (branches[i].size == 2) {
+                disp = branch_displacement(&branches[i], i);
+                if (disp < -128 || disp > 127) {
+                    branches[i].size = branches[i].near;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+}
+
+/* Rewrite text of current function with relaxed branches, moving code in place
+ * towards the start of the function. Labels and relocations in the function
+ * are moved accordingly.
+ */
+static void flush_branches(void)
+{
+    int i, n, src, dst, disp;
+    unsigned char op;
+    const struct branch *b;
+    struct pending_relocation *r;
+
+    if (!n_branches) {
+        n_labels = 0;
+        return;
+    }
+
+    relax_branches();
+    compute_shrink();
+    src = dst = branches[0].offset;
+    for (i = 0; i < n_branches; ++i) {
+        b = &branches[i];
+        n = b->offset - src;
+        memmove(text + dst, text + src, n);
+        dst += n;
+        src += n;
+
+        disp = branch_displacement(b, i);
+        op = (b->near == 5) ? 0xE9 : text[src + 1];
+        if (b->size == 2) {
+            text[dst] = (b->near == 5) ? 0xEB : 0x70 | (op & 0xF);
+            text[dst + 1] = (unsigned char) (signed char) disp;
+        } else {
+            n = b->near - 4;
+            if (n == 2)
+                text[dst] = 0x0F;
+            text[dst + n - 1] = op;
+            memcpy(text + dst + n, &disp, 4);
+        }
+
+        dst += b->size;
+        src += b->near;
+    }
+
+    n = shdr[SHID_TEXT].sh_size - src;
+    memmove(text + dst, text + src, n);
+    assert(src - dst == shrink[n_branches]);
+
+    for (i = n_prl_function; i < n_prl; ++i) {
+        r = &prl[i];
+        if (r->section == SHID_RELA_TEXT)
+            r->offset = relaxed_offset(r->offset);
+    }
+
+    for (i = 0; i < n_labels; ++i) {
+        ((struct symbol *) labels[i])->stack_offset =
+            relaxed_offset(labels[i]->stack_offset);
+    }
+
+    shdr[SHID_TEXT].sh_size -= src - dst;
+    current_function_entry->st_size -= src - dst;
+    n_branches = 0;
+    n_labels = 0;
+}
 
 /* List of pending global symbols, not yet added to .symtab. All globals have
  * to come after LOCAL symbols, according to spec. Also, ld will segfault(!)
@@ -372,6 +670,7 @@ static struct {
     Elf64_Sym entry;
 } *globals;
 static int n_globals;
+static size_t globals_cap;
 
 /* Associate symbol with symtab entry. Internal symbols are added to table right
  * away, but global symbols have to be buffered and flushed at the end. (Mis-)
@@ -382,15 +681,20 @@ static void elf_symtab_assoc(struct symbol *sym, Elf64_Sym entry)
 {
     if (sym->linkage == LINK_INTERN) {
         sym->stack_offset = elf_symtab_add(entry);
-        if (is_function(&sym->type))
+        if (is_function(&sym->type)) {
+            current_function_index = sym->stack_offset;
             current_function_entry = &symtab[sym->stack_offset];
+        }
     } else {
         assert((entry.st_info >> 4) == STB_GLOBAL);
-        globals = realloc(globals, (n_globals + 1) * sizeof(*globals));
+        globals = reserve(globals, &globals_cap,
+            (n_globals + 1) * sizeof(*globals));
         globals[n_globals].sym = sym;
         globals[n_globals].entry = entry;
-        if (is_function(&sym->type))
+        if (is_function(&sym->type)) {
+            current_function_index = -1;
             current_function_entry = &globals[n_globals].entry;
+        }
         n_globals += 1;
     }
 }
@@ -404,21 +708,57 @@ static void flush_symtab_globals(void)
         globals[i].sym->stack_offset = elf_symtab_add(globals[i].entry);
 }
 
-int elf_symbol(const struct symbol *sym)
+static Elf64_Sym symbol_entry(const struct symbol *sym)
 {
     Elf64_Sym entry = {0};
+
+    entry.st_name = elf_strtab_add(sym_name(sym));
+    entry.st_info = (sym->linkage == LINK_INTERN)
+        ? STB_LOCAL << 4 : STB_GLOBAL << 4;
+    return entry;
+}
+
+/* Allocate object in .bss, which takes no space in the object file.
+ */
+static void bss_allocate(const struct symbol *sym, Elf64_Sym *entry)
+{
+    size_t offset, align = sym_alignment(sym);
+
+    offset = shdr[SHID_BSS].sh_size;
+    offset = (offset + align - 1) / align * align;
+    entry->st_shndx = SHID_BSS;
+    entry->st_size = size_of(&sym->type);
+    entry->st_value = offset;
+    entry->st_info |= STT_OBJECT;
+    shdr[SHID_BSS].sh_size = offset + entry->st_size;
+}
+
+/* Allocate object at the end of .data or .rodata, with initial value written
+ * by following calls to elf_data and elf_bytes.
+ */
+static void data_allocate(int shid, const struct symbol *sym, Elf64_Sym *entry)
+{
+    elf_data_align(shid, sym_alignment(sym));
+    entry->st_shndx = shid;
+    entry->st_size = size_of(&sym->type);
+    entry->st_value = shdr[shid].sh_size;
+    entry->st_info |= STT_OBJECT;
+    data_section = shid;
+}
+
+int elf_symbol(const struct symbol *sym)
+{
+    Elf64_Sym entry;
     assert(sym->linkage != LINK_NONE);
     assert(!sym->stack_offset);
 
     if (sym->symtype == SYM_LABEL) {
         ((struct symbol *) sym)->stack_offset = shdr[SHID_TEXT].sh_size;
+        add_label(sym);
         return 0;
     }
 
-    entry.st_name = elf_strtab_add(sym_name(sym));
-    entry.st_info = (sym->linkage == LINK_INTERN)
-        ? STB_LOCAL << 4 : STB_GLOBAL << 4;
-
+    entry = symbol_entry(sym);
     if (is_function(&sym->type)) {
         entry.st_info |= STT_FUNC;
         if (sym->symtype == SYM_DEFINITION) {
@@ -427,74 +767,96 @@ int elf_symbol(const struct symbol *sym)
         }
         /* st_size is updated while assembling instructions. */
     } else if (sym->symtype == SYM_DEFINITION) {
-        elf_data_align(SHID_DATA, sym_alignment(sym));
-        entry.st_shndx = SHID_DATA;
-        entry.st_size = size_of(&sym->type);
-        entry.st_value = shdr[SHID_DATA].sh_size;
-        entry.st_info |= STT_OBJECT;
+        data_allocate(SHID_DATA, sym, &entry);
     } else if (sym->symtype == SYM_STRING_VALUE) {
-        elf_data_align(SHID_RODATA, sym_alignment(sym));
-        entry.st_shndx = SHID_RODATA;
+        entry.st_shndx = SHID_RODATA_STR;
         entry.st_size = size_of(&sym->type);
-        entry.st_value = shdr[SHID_RODATA].sh_size;
+        entry.st_value = shdr[SHID_RODATA_STR].sh_size;
         entry.st_info |= STT_OBJECT;
 
         /* String value symbols contain the actual string value; write to
-         * .rodata immediately. */
-        elf_data_add(SHID_RODATA, sym->string_value, size_of(&sym->type));
+         * .rodata.str1.1 immediately. Strings are not aligned, letting the
+         * linker merge equal strings across object files. */
+        elf_data_add(SHID_RODATA_STR, sym->string_value, size_of(&sym->type));
+    } else if (sym->symtype == SYM_TENTATIVE) {
+        /* Tentative definitions with external linkage are common symbols,
+         * merged by the linker. Value holds the alignment. */
+        if (sym->linkage == LINK_INTERN) {
+            bss_allocate(sym, &entry);
+        } else {
+            entry.st_shndx = SHN_COMMON;
+            entry.st_size = size_of(&sym->type);
+            entry.st_value = sym_alignment(sym);
+            entry.st_info |= STT_OBJECT;
+        }
     }
 
     elf_symtab_assoc((struct symbol *) sym, entry);
     return 0;
 }
 
-/* Text section contains offsets to labels, also in text. Forward references
- * cannot be resolved immediately, as translation is single pass. Store offsets
- * into .text, paired with symbol (label) which offsets should be calculated.
- */
-static struct pending_displacement {
-    const struct symbol *label;
-    int text_offset;
-} *toff;
-static int n_toff;
-
-int elf_text_displacement(const struct symbol *label, int instr_offset)
+int elf_bss(const struct symbol *sym)
 {
-    assert(label->symtype == SYM_LABEL);
+    Elf64_Sym entry;
+    assert(sym->symtype == SYM_DEFINITION);
+    assert(sym->linkage != LINK_NONE);
+    assert(!sym->stack_offset);
 
-    if (label->stack_offset) {
-        return label->stack_offset - shdr[SHID_TEXT].sh_size - instr_offset;
-    }
+    entry = symbol_entry(sym);
+    bss_allocate(sym, &entry);
+    elf_symtab_assoc((struct symbol *) sym, entry);
+    return 0;
+}
+
+int elf_rodata(const struct symbol *sym)
+{
+    Elf64_Sym entry;
+    assert(sym->symtype == SYM_DEFINITION);
+    assert(sym->linkage != LINK_NONE);
+    assert(!sym->stack_offset);
 
-    toff = realloc(toff, (n_toff + 1) * sizeof(*toff));
-    toff[n_toff].label = label;
-    toff[n_toff].text_offset = shdr[SHID_TEXT].sh_size + instr_offset;
-    n_toff += 1;
+    entry = symbol_entry(sym);
+    data_allocate(SHID_RODATA, sym, &entry);
+    elf_symtab_assoc((struct symbol *) sym, entry);
     return 0;
 }
 
-/* Must be called before writing text segment. Overwrite locations with offsets
- * now found in stack_offset member of label symbols.
+/* Resolve references to labels in relocations added for current function.
+ * Labels in .rodata are offsets into .text, relative to the section symbol.
+ * Labels referenced from .text are jump tables, with their own symbol.
  */
-static void flush_text_displacements(void)
+static void flush_label_relocations(void)
 {
-    int i, *ptr;
-    const struct pending_displacement *entry;
+    int i;
+    struct pending_relocation *r;
+
+    for (i = n_prl_function; i < n_prl; ++i) {
+        r = &prl[i];
+        if (r->symbol->symtype != SYM_LABEL)
+            continue;
+
+        if (r->section == SHID_RELA_RODATA) {
+            assert(r->type == R_X86_64_64);
+            r->addend += r->symbol->stack_offset;
+            r->index = SYMTAB_TEXT;
+        } else {
+            assert(r->type == R_X86_64_PC32 || r->type == R_X86_64_32S);
+            r->index = symtab_index_of(r->symbol);
+            if (r->type == R_X86_64_PC32)
+                r->addend -= 4;
+        }
 
-    if (!toff)
-        return;
+        r->symbol = NULL;
+    }
 
-    assert(n_toff);
-    for (i = 0; i < n_toff; ++i) {
-        entry = &toff[i];
-        assert(entry->label->stack_offset);
+    n_prl_function = n_prl;
+}
 
-        ptr = (int *) (text + entry->text_offset);
-        *ptr += entry->label->stack_offset - entry->text_offset;
-    }
-    free(toff);
-    toff = NULL;
-    n_toff = 0;
+int elf_flush_function(void)
+{
+    flush_branches();
+    flush_label_relocations();
+    return 0;
 }
 
 int elf_text(struct instruction instr)
@@ -505,7 +867,7 @@ int elf_text(struct instruction instr)
     if (c.val[0] == 0x90)
         return 0;
 
-    text = realloc(text, shdr[SHID_TEXT].sh_size + c.len);
+    text = reserve(text, &text_cap, shdr[SHID_TEXT].sh_size + c.len);
     memcpy(text + shdr[SHID_TEXT].sh_size, &c.val, c.len);
 
     shdr[SHID_TEXT].sh_size += c.len;
@@ -514,6 +876,11 @@ int elf_text(struct instruction instr)
     return 0;
 }
 
+int elf_bytes(const char *ptr, size_t n)
+{
+    return elf_data_add(data_section, ptr, n);
+}
+
 int elf_data(struct immediate imm)
 {
     const void *ptr = NULL;
@@ -532,8 +899,8 @@ int elf_data(struct immediate imm)
         break;
     case IMM_ADDR:
         assert(imm.d.addr.sym);
-        elf_add_reloc_data(imm.d.addr.sym, R_X86_64_32S, imm.d.addr.disp);
-        w = 4;
+        assert(w == 8);
+        elf_add_reloc_data(imm.d.addr.sym, R_X86_64_64, imm.d.addr.disp);
         break;
     case IMM_STRING:
         assert(w == strlen(imm.d.string) + 1);
@@ -541,40 +908,125 @@ int elf_data(struct immediate imm)
         break;
     }
 
-    return elf_data_add(SHID_DATA, ptr, w);
+    return elf_data_add(data_section, ptr, w);
+}
+
+/* Jump tables are written to .rodata, with one relocation for each entry to
+ * be resolved to the absolute address of the label. The table symbol is added
+ * as a local object, referenced from .text.
+ */
+int elf_jump_table(
+    const struct symbol *table,
+    const struct symbol **labels,
+    int n)
+{
+    int i;
+    Elf64_Sym entry = {0};
+    struct pending_relocation r = {0};
+
+    assert(table->symtype == SYM_LABEL);
+    assert(!table->stack_offset);
+
+    elf_data_align(SHID_RODATA, 8);
+    entry.st_name = elf_strtab_add(sym_name(table));
+    entry.st_info = (STB_LOCAL << 4) | STT_OBJECT;
+    entry.st_shndx = SHID_RODATA;
+    entry.st_value = shdr[SHID_RODATA].sh_size;
+    entry.st_size = n * 8;
+    ((struct symbol *) table)->stack_offset = elf_symtab_add(entry);
+
+    r.type = R_X86_64_64;
+    r.section = SHID_RELA_RODATA;
+    for (i = 0; i < n; ++i) {
+        r.symbol = labels[i];
+        r.offset = elf_data_add(SHID_RODATA, NULL, 8);
+        add_reloc(r);
+    }
+
+    return 0;
+}
+
+/* Write object file with a single system call, retrying until all parts are
+ * written.
+ */
+static void write_object(struct iovec *iov, int n)
+{
+    int fd;
+    ssize_t w;
+
+    fflush(object_file_output);
+    fd = fileno(object_file_output);
+    while (n) {
+        w = writev(fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            error("Failed to write object file.");
+            exit(1);
+        }
+
+        while (n && (size_t) w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+
+        if (n) {
+            iov->iov_base = (char *) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
 }
 
 int elf_flush(void)
 {
+    int i;
+    struct iovec iov[SHID_BSS + 1];
+
     assert(shdr[SHID_SHSTRTAB].sh_size % 16 == 0);
     flush_symtab_globals();
     flush_relocations();
-    flush_text_displacements();
     elf_data_align(SHID_DATA, 0x10);
     elf_data_align(SHID_RODATA, 0x10);
 
-    fwrite(&header, sizeof(header), 1, object_file_output);
+    /* Pad string table, so that the following sections are aligned. */
+    if (shdr[SHID_STRTAB].sh_size % 0x10) {
+        i = 0x10 - shdr[SHID_STRTAB].sh_size % 0x10;
+        strtab = reserve(strtab, &strtab_cap, shdr[SHID_STRTAB].sh_size + i);
+        memset(strtab + shdr[SHID_STRTAB].sh_size, '\0', i);
+        shdr[SHID_STRTAB].sh_size += i;
+    }
 
     /* Fill in missing offset and size values */
     SHDR_CHAIN_OFFSET(SHID_STRTAB, SHID_SYMTAB);
     SHDR_CHAIN_OFFSET(SHID_SYMTAB, SHID_RELA_TEXT);
     SHDR_CHAIN_OFFSET(SHID_RELA_TEXT, SHID_RELA_DATA);
-    SHDR_CHAIN_OFFSET(SHID_RELA_DATA, SHID_DATA);
+    SHDR_CHAIN_OFFSET(SHID_RELA_DATA, SHID_RELA_RODATA);
+    SHDR_CHAIN_OFFSET(SHID_RELA_RODATA, SHID_DATA);
     SHDR_CHAIN_OFFSET(SHID_DATA, SHID_RODATA);
     SHDR_CHAIN_OFFSET(SHID_RODATA, SHID_TEXT);
-
-    /* Section headers */
-    fwrite(&shdr, sizeof(shdr), 1, object_file_output);
-
-    /* Section data */
-    fwrite(shstrtab, shdr[SHID_SHSTRTAB].sh_size, 1, object_file_output);
-    fwrite(strtab, shdr[SHID_STRTAB].sh_size, 1, object_file_output);
-    fwrite(symtab, shdr[SHID_SYMTAB].sh_size, 1, object_file_output);
-    fwrite(rela_text, shdr[SHID_RELA_TEXT].sh_size, 1, object_file_output);
-    fwrite(rela_data, shdr[SHID_RELA_DATA].sh_size, 1, object_file_output);
-    fwrite(data, shdr[SHID_DATA].sh_size, 1, object_file_output);
-    fwrite(rodata, shdr[SHID_RODATA].sh_size, 1, object_file_output);
-    fwrite(text, shdr[SHID_TEXT].sh_size, 1, object_file_output);
-
+    SHDR_CHAIN_OFFSET(SHID_TEXT, SHID_RODATA_STR);
+    shdr[SHID_BSS].sh_offset = shdr[SHID_RODATA_STR].sh_offset;
+
+    /* Header and section headers, followed by contents of each section in
+     * order of section id. */
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = &shdr;
+    iov[1].iov_len = sizeof(shdr);
+    iov[1 + SHID_SHSTRTAB].iov_base = shstrtab;
+    iov[1 + SHID_STRTAB].iov_base = strtab;
+    iov[1 + SHID_SYMTAB].iov_base = symtab;
+    iov[1 + SHID_RELA_TEXT].iov_base = rela_text;
+    iov[1 + SHID_RELA_DATA].iov_base = rela_data;
+    iov[1 + SHID_RELA_RODATA].iov_base = rela_rodata;
+    iov[1 + SHID_DATA].iov_base = data;
+    iov[1 + SHID_RODATA].iov_base = rodata;
+    iov[1 + SHID_TEXT].iov_base = text;
+    iov[1 + SHID_RODATA_STR].iov_base = rodata_str;
+    for (i = SHID_SHSTRTAB; i < SHID_BSS; ++i)
+        iov[1 + i].iov_len = shdr[i].sh_size;
+
+    write_object(iov, SHID_BSS + 1);
     return 0;
 }
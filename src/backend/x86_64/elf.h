@@ -52,6 +52,7 @@ typedef struct {
 } Elf64_Shdr;
 
 #define SHN_UNDEF 0
+#define SHN_COMMON 0xFFF2
 
 /* Section types, sh_type.
  */
@@ -63,6 +64,7 @@ typedef struct {
 #define SHT_HASH 5
 #define SHT_DYNAMIC 6
 #define SHT_NOTE 7
+#define SHT_NOBITS 8
 #define SHT_DYNSYM 11
 
 /* Section attributes, sh_flags.
@@ -70,6 +72,8 @@ typedef struct {
 #define SHF_WRITE 0x1
 #define SHF_ALLOC 0x2
 #define SHF_EXECINSTR 0x4
+#define SHF_MERGE 0x10
+#define SHF_STRINGS 0x20
 
 typedef struct {
     Elf64_Word      st_name;        /* Symbol name */
@@ -103,6 +107,7 @@ typedef struct {
  */
 enum rel_type {
     R_X86_64_NONE = 0,
+    R_X86_64_64 = 1,                /* word64   S + A */
     R_X86_64_PC32 = 2,              /* word32   S + A - P */
     R_X86_64_32S = 11               /* word32   S + A */
 };
@@ -117,8 +122,30 @@ int elf_text(struct instruction instr);
 
 int elf_data(struct immediate data);
 
+/* Add n bytes to .data or .rodata, or zeros if ptr is NULL.
+ */
+int elf_bytes(const char *ptr, size_t n);
+
+/* Define object in .bss, with all bytes zero.
+ */
+int elf_bss(const struct symbol *sym);
+
+/* Define object in .rodata, with data following like for elf_symbol.
+ */
+int elf_rodata(const struct symbol *sym);
+
+int elf_jump_table(
+    const struct symbol *table,
+    const struct symbol **labels,
+    int n);
+
 int elf_flush(void);
 
+/* Resolve references to labels of the function just written, which must not
+ * be used after this.
+ */
+int elf_flush_function(void);
+
 /* Insert relocation entry to symbol at the current position of .text.
  */
 void elf_add_reloc_text(
@@ -127,10 +154,10 @@ void elf_add_reloc_text(
     int offset,
     int addend);
 
-/* Return offset between label and current position in text segment, if label
- * has already been calculated. For forward references, return 0 and store this
- * location as pending. All pending displacements are written on flush.
+/* Add jump to label at the current position of .text, with 32 bit
+ * displacement at given offset into the instruction. Jumps are shortened to
+ * rel8 where possible, and resolved when the function is flushed.
  */
-int elf_text_displacement(const struct symbol *label, int instr_offset);
+void elf_add_branch(const struct symbol *label, int disp_offset);
 
 #endif
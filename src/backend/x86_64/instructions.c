@@ -62,10 +62,15 @@
 /* Conditional test field.
  */
 enum tttn {
+    TEST_B = 0x2,
     TEST_AE = 0x3,
     TEST_Z = 0x4,
+    TEST_NZ = 0x5,
+    TEST_BE = 0x6,
     TEST_A = 0x7,
+    TEST_L = 0xC,
     TEST_GE = 0xD,
+    TEST_LE = 0xE,
     TEST_G = 0xF
 };
 
@@ -74,49 +79,121 @@ enum tttn {
 static int requires_prefix(struct address addr)
 {
     if (addr.sym)
-        return 0;
+        return is_64_bit_reg(addr.offset);
     return is_64_bit_reg(addr.base) || is_64_bit_reg(addr.offset);
 }
 
+/* Byte registers spl, bpl, sil and dil can only be addressed with a REX prefix,
+ * the same encoding otherwise referring to ah, ch, dh and bh.
+ */
+static int is_rex_byte_reg(struct registr r)
+{
+    return r.w == 1 && r.r >= SP && r.r <= DI;
+}
+
+/* Emit operand size and REX prefix for instruction with register operand in
+ * ModR/M reg field, and register operand in r/m field. Prefix is only added if
+ * necessary to encode the operands.
+ */
+static void encode_prefix_reg_reg(
+    struct code *c,
+    int w,
+    struct registr r,
+    struct registr rm)
+{
+    unsigned char rex = REX;
+    if (w == 2)
+        c->val[c->len++] = 0x66;
+
+    rex |= (w == 8) << 3;
+    rex |= is_64_bit_reg(r.r) << 2;
+    rex |= is_64_bit_reg(rm.r);
+    if (rex != REX || is_rex_byte_reg(r) || is_rex_byte_reg(rm))
+        c->val[c->len++] = rex;
+}
+
+/* Emit operand size and REX prefix for instruction with register operand in
+ * ModR/M reg field, and memory operand. Base and index registers of the
+ * address are extended through REX.B and REX.X.
+ */
+static void encode_prefix_reg_mem(
+    struct code *c,
+    int w,
+    struct registr r,
+    struct address addr)
+{
+    unsigned char rex = REX;
+    if (w == 2)
+        c->val[c->len++] = 0x66;
+
+    rex |= (w == 8) << 3;
+    rex |= is_64_bit_reg(r.r) << 2;
+    if (requires_prefix(addr)) {
+        rex |= is_64_bit_reg(addr.offset) << 1;
+        rex |= is_64_bit_reg(addr.base);
+    }
+    if (rex != REX || is_rex_byte_reg(r))
+        c->val[c->len++] = rex;
+}
+
 /* Encode address using ModR/M, SIB and Displacement bytes. Based on Table 2.2
  * and Table 2.3 in reference manual.
  *
- * Only using ModR/M for now.
+ * SIB byte is required for index registers, and for base registers encoded as
+ * 0b100 (SP, R12). Base registers encoded as 0b101 (BP, R13) always need a
+ * displacement, as mod 00 means no base.
+ *
+ * Symbol addresses are RIP-relative, except when indexed by a register. The
+ * absolute address is then encoded as displacement with no base register.
  */
 static void encode_sib_addr(
     struct code *c,
     unsigned char reg,
     struct address addr)
 {
-    if (addr.sym) {
+    if (addr.sym && addr.offset) {
+        int scale = addr.mult == 8 ? 3 : addr.mult == 4 ? 2
+            : addr.mult == 2 ? 1 : 0;
+        assert(!addr.base);
+        c->val[c->len++] = ((reg & 0x7) << 3) | 0x4;
+        c->val[c->len++] = (scale << 6) | (((addr.offset - 1) % 8) << 3) | 0x5;
+        elf_add_reloc_text(addr.sym, R_X86_64_32S, c->len, addr.disp);
+        memset(&c->val[c->len], 0, 4);
+        c->len += 4;
+    } else if (addr.sym) {
         /* 2.2.1.6 RIP-relative addressing */
         c->val[c->len++] = ((reg & 0x7) << 3) | 0x5;
         elf_add_reloc_text(addr.sym, R_X86_64_PC32, c->len, addr.disp);
         memset(&c->val[c->len], 0, 4);
         c->len += 4;
     } else {
-        c->val[c->len] = ((reg & 0x7) << 3) | ((addr.base - 1) % 8);
-        if (addr.disp) {
+        int base = (addr.base - 1) % 8;
+        int sib = base == 4 || addr.offset;
+
+        c->val[c->len] = ((reg & 0x7) << 3) | (sib ? 4 : base);
+        if (sib) {
+            int scale = addr.mult == 8 ? 3 : addr.mult == 4 ? 2
+                : addr.mult == 2 ? 1 : 0;
+            int index = addr.offset ? (addr.offset - 1) % 8 : 4;
+            c->val[c->len + 1] = (scale << 6) | (index << 3) | base;
+        }
+        if (addr.disp || base == 5) {
+            c->val[c->len++] |= in_byte_range(addr.disp) ? 0x40 : 0x80;
+            c->len += sib;
             if (in_byte_range(addr.disp)) {
-                c->val[c->len++] |= 0x40;
                 c->val[c->len++] = addr.disp;
             } else {
-                c->val[c->len++] |= 0x80;
                 memcpy(&c->val[c->len], &addr.disp, 4);
                 c->len += 4;
             }
         } else
-            c->len++;
+            c->len += 1 + sib;
     }
 }
 
-static int is_byte_imm(struct immediate imm)
-{
-    return imm.type == IMM_INT && (imm.w == 1 || 
-        (imm.w == 2 && in_byte_range(imm.d.word)) ||
-        (imm.w == 4 && in_byte_range(imm.d.dword)) ||
-        (in_byte_range(imm.d.qword)));
-}
+/* Placeholder for ModR/M reg field used as opcode extension.
+ */
+static const struct registr reg_none;
 
 static int is_32bit_imm(struct immediate imm)
 {
@@ -129,6 +206,61 @@ static struct code nop(void)
     return c;
 }
 
+static struct code basic_register_only_encode(
+    unsigned int opcode,
+    struct registr a,
+    struct registr b)
+{
+    struct code c = {{0}};
+    encode_prefix_reg_reg(&c, a.w, a, b);
+    c.val[c.len++] = opcode | w(a);
+    c.val[c.len++] = 0xC0 | reg(a) << 3 | reg(b);
+    return c;
+}
+
+/* Encode instruction from group 1 (add, or, adc, sbb, and, sub, xor, cmp) with
+ * immediate operand, using opcode extension ext in ModR/M reg field. Immediate
+ * is sign extended from byte if possible.
+ */
+static struct code encode_imm_reg(
+    int ext,
+    struct immediate imm,
+    struct registr r)
+{
+    long val;
+    struct code c = {{0}};
+    assert(imm.type == IMM_INT);
+
+    val = imm.w == 1 ? imm.d.byte
+        : imm.w == 2 ? imm.d.word
+        : imm.w == 4 ? imm.d.dword : imm.d.qword;
+
+    encode_prefix_reg_reg(&c, r.w, reg_none, r);
+    if (r.w == 1) {
+        c.val[c.len++] = 0x80;
+        c.val[c.len++] = 0xC0 | ext << 3 | reg(r);
+        c.val[c.len++] = val;
+    } else if (in_byte_range(val)) {
+        c.val[c.len++] = 0x83;
+        c.val[c.len++] = 0xC0 | ext << 3 | reg(r);
+        c.val[c.len++] = val;
+    } else {
+        c.val[c.len++] = 0x81;
+        c.val[c.len++] = 0xC0 | ext << 3 | reg(r);
+        if (r.w == 2) {
+            memcpy(&c.val[c.len], &imm.d.word, 2);
+            c.len += 2;
+        } else {
+            int dword = val;
+            assert(in_32bit_range(val));
+            memcpy(&c.val[c.len], &dword, 4);
+            c.len += 4;
+        }
+    }
+
+    return c;
+}
+
 static struct code mov(
     enum instr_optype optype,
     union operand a,
@@ -175,26 +307,20 @@ static struct code mov(
         break;
     case OPT_REG_REG:
         assert(a.reg.w == b.reg.w);
-        c.len = 3;
-        c.val[0] = REX | W(a.reg) | R(a.reg) | B(b.reg);
-        c.val[1] = 0x88 + is_64_bit(a.reg);
-        c.val[2] = 0xC0 | reg(a.reg) << 3 | reg(b.reg);
+        c.len = 0;
+        encode_prefix_reg_reg(&c, a.reg.w, a.reg, b.reg);
+        c.val[c.len++] = 0x88 + w(a.reg);
+        c.val[c.len++] = 0xC0 | reg(a.reg) << 3 | reg(b.reg);
         break;
     case OPT_REG_MEM:
         c.len = 0;
-        if (is_16_bit(a.reg))
-            c.val[c.len++] = 0x66; /* Legacy prefix */
-        else if (is_64_bit(a.reg) ||
-            is_64_bit_reg(a.reg.r) || requires_prefix(b.mem.addr)) {
-            c.val[c.len++] = REX | W(a.reg) | is_64_bit_reg(b.mem.addr.base);
-        }
+        encode_prefix_reg_mem(&c, a.reg.w, a.reg, b.mem.addr);
         c.val[c.len++] = 0x88 + w(a.reg);
         encode_sib_addr(&c, reg(a.reg), b.mem.addr);
         break;
     case OPT_MEM_REG:
         c.len = 0;
-        if (is_64_bit(b.reg) || is_64_bit_reg(b.reg.r))
-            c.val[c.len++] = REX | W(b.reg) | R(b.reg);
+        encode_prefix_reg_mem(&c, b.reg.w, b.reg, a.mem.addr);
         c.val[c.len++] = 0x8A + w(b.reg);
         encode_sib_addr(&c, reg(b.reg), a.mem.addr);
         break;
@@ -210,21 +336,30 @@ static struct code movsx(
     union operand b)
 {
     struct code c = {{0}};
-    assert(optype == OPT_MEM_REG);
 
-    if (is_64_bit(b.reg) || is_64_bit_reg(b.reg.r) ||
-        is_64_bit_reg(a.mem.addr.base)) {
-        c.val[c.len] = REX | W(b.reg) | R(b.reg);
-        c.val[c.len++] |= is_64_bit_reg(a.mem.addr.base); /* B(..) */
-    }
-    if (is_32_bit(a.mem) && is_64_bit(b.reg)) {
-        c.val[c.len++] = 0x63;
+    if (optype == OPT_REG_REG) {
+        encode_prefix_reg_reg(&c, b.reg.w, b.reg, a.reg);
+        if (is_rex_byte_reg(a.reg) && !c.len)
+            c.val[c.len++] = REX;
+        if (is_32_bit(a.reg) && is_64_bit(b.reg)) {
+            c.val[c.len++] = 0x63;
+        } else {
+            c.val[c.len++] = 0x0F;
+            c.val[c.len++] = 0xBE | w(a.reg);
+        }
+        c.val[c.len++] = 0xC0 | reg(b.reg) << 3 | reg(a.reg);
     } else {
-        c.val[c.len++] = 0x0F;
-        c.val[c.len++] = 0xBE | w(a.mem);
+        assert(optype == OPT_MEM_REG);
+        encode_prefix_reg_mem(&c, b.reg.w, b.reg, a.mem.addr);
+        if (is_32_bit(a.mem) && is_64_bit(b.reg)) {
+            c.val[c.len++] = 0x63;
+        } else {
+            c.val[c.len++] = 0x0F;
+            c.val[c.len++] = 0xBE | w(a.mem);
+        }
+        encode_sib_addr(&c, reg(b.reg), a.mem.addr);
     }
 
-    encode_sib_addr(&c, reg(b.reg), a.mem.addr);
     return c;
 }
 
@@ -235,14 +370,17 @@ static struct code movzx(
 {
     struct code c = {{0}};
 
-    if (is_64_bit(b.reg))
-        c.val[c.len++] = REX | W(b.reg) | R(b.reg);
-    c.val[c.len++] = 0x0F;
     if (optype == OPT_REG_REG) {
+        encode_prefix_reg_reg(&c, b.reg.w, b.reg, a.reg);
+        if (is_rex_byte_reg(a.reg) && !c.len)
+            c.val[c.len++] = REX;
+        c.val[c.len++] = 0x0F;
         c.val[c.len++] = 0xB6 | w(a.reg);
         c.val[c.len++] = 0xC0 | reg(b.reg) << 3 | reg(a.reg);
     } else {
         assert(optype == OPT_MEM_REG);
+        encode_prefix_reg_mem(&c, b.reg.w, b.reg, a.mem.addr);
+        c.val[c.len++] = 0x0F;
         c.val[c.len++] = 0xB6 | w(a.mem);
         encode_sib_addr(&c, reg(b.reg), a.mem.addr);
     }
@@ -280,26 +418,10 @@ static struct code sub(
 
     switch (optype) {
     case OPT_IMM_REG:
-        assert(is_64_bit(b.reg));
-        c.val[0] = REX | W(b.reg) | B(b.reg);
-        c.val[1] = 0x81 | is_byte_imm(a.imm) << 1;
-        c.val[2] = 0xE8 | reg(b.reg);
-        if (is_byte_imm(a.imm)) {
-            c.val[3] = a.imm.d.byte;
-            c.len = 4;
-        } else if (is_32bit_imm(a.imm)) {
-            memcpy(&c.val[3], &a.imm.d.dword, 4);
-            c.len = 7;
-        }
+        c = encode_imm_reg(0x5, a.imm, b.reg);
         break;
     case OPT_REG_REG:
-        c.len = 0;
-        if (is_64_bit(a.reg)) {
-            c.val[0] = REX | W(a.reg) | R(a.reg) | B(b.reg);
-            c.len = 1;
-        }
-        c.val[c.len++] = 0x28 | w(a.reg);
-        c.val[c.len++] = 0xC0 | reg(a.reg) << 3 | reg(b.reg);
+        c = basic_register_only_encode(0x28, a.reg, b.reg);
         break;
     default:
         assert(0);
@@ -318,14 +440,10 @@ static struct code add(
 
     switch (optype) {
     case OPT_REG_REG:
-        c.len = 0;
-        if (is_64_bit(a.reg)) {
-            c.val[c.len++] = REX | W(a.reg) | R(a.reg) | B(b.reg);
-        }
-        c.val[c.len++] = 0x00 | w(a.reg);
-        c.val[c.len++] = 0xC0 | reg(a.reg) << 3 | reg(b.reg);
+        c = basic_register_only_encode(0x00, a.reg, b.reg);
         break;
     case OPT_IMM_REG:
+        c = encode_imm_reg(0x0, a.imm, b.reg);
         break;
     case OPT_IMM_MEM:
         break;
@@ -370,28 +488,11 @@ static struct code cmp(
     c.len = 0;
     switch (optype) {
     case OPT_IMM_REG:
-        if (!is_64_bit(b.reg) && !is_64_bit_reg(b.reg.r)) {
-            c.val[c.len++] = 0x80 | w(b.reg);
-            c.val[c.len++] = 0xF8 | reg(b.reg);
-            if (is_byte_imm(a.imm)) {
-                c.val[0] |= 2; /* Sign extend byte to 32 bit */
-                c.val[c.len++] = a.imm.d.byte;
-            } else {
-                assert(a.imm.w == 4);
-                memcpy(&c.val[c.len], &a.imm.d.dword, 4);
-                c.len += 4;
-            }
-        } else {
-            assert(0);
-        }
+        c = encode_imm_reg(0x7, a.imm, b.reg);
         break;
     case OPT_REG_REG:
         assert(a.reg.w == b.reg.w);
-        if (!is_64_bit(a.reg) && !is_64_bit_reg(a.reg.r)) {
-            c.val[c.len++] = 0x38 | w(a.reg);
-            c.val[c.len++] = 0xC0 | reg(a.reg) << 3 | reg(b.reg);
-        } else
-            assert(0);
+        c = basic_register_only_encode(0x38, a.reg, b.reg);
         break;
     default:
         assert(0);
@@ -406,36 +507,42 @@ static struct code jcc(
     enum tttn cond,
     union operand op)
 {
-    int disp, *ptr;
     struct code c = {{0x0F, 0x80}, 2};
     const struct address *addr = &op.imm.d.addr;
 
     assert(optype == OPT_IMM);
     assert(addr->sym);
+    assert(!addr->disp);
 
+    /* Displacement is written when the function is flushed, and the jump
+     * is then shortened to rel8 if possible. */
     c.val[1] |= cond;
-
-    /* Existing value will be added to offset. Subtract 4 to account for
-     * instruction length, offset is counted after the immediate. */
-    disp = elf_text_displacement(addr->sym, c.len) + addr->disp - 4;
-    ptr = (int *) (c.val + c.len);
-    *ptr = disp;
+    elf_add_branch(addr->sym, c.len);
+    memset(c.val + c.len, 0, 4);
     c.len += 4;
     return c;
 }
 
 static struct code jmp(enum instr_optype optype, union operand op)
 {
-    int disp, *ptr;
     struct code c = {{0xE9}, 1};
     const struct address *addr = &op.imm.d.addr;
 
+    if (optype == OPT_MEM) {
+        /* Indirect near jump, default 64 bit operand size. */
+        c.len = 0;
+        encode_prefix_reg_mem(&c, 4, reg_none, op.mem.addr);
+        c.val[c.len++] = 0xFF;
+        encode_sib_addr(&c, 0x4, op.mem.addr);
+        return c;
+    }
+
     assert(optype == OPT_IMM);
     assert(addr->sym);
+    assert(!addr->disp);
 
-    disp = elf_text_displacement(addr->sym, c.len) + addr->disp - 4;
-    ptr = (int *) (c.val + c.len);
-    *ptr = disp;
+    elf_add_branch(addr->sym, c.len);
+    memset(c.val + c.len, 0, 4);
     c.len += 4;
     return c;
 }
@@ -455,7 +562,7 @@ static struct code lea(
     assert(optype == OPT_MEM_REG);
     assert(is_64_bit(b.reg));
 
-    c.val[c.len++] = REX | W(b.reg) | R(b.reg);
+    encode_prefix_reg_mem(&c, b.reg.w, b.reg, a.mem.addr);
     c.val[c.len++] = 0x8D;
     encode_sib_addr(&c, reg(b.reg), a.mem.addr);
 
@@ -468,6 +575,12 @@ static struct code rep_movsq(void)
     return c;
 }
 
+static struct code rep_stosq(void)
+{
+    struct code c = {{0xF3, REX + 8, 0xAB}, 3};
+    return c;
+}
+
 static struct code ret(void)
 {
     /* Only 'Near return' is used, returning to a function with address in the
@@ -482,8 +595,10 @@ static struct code setcc(
     union operand op)
 {
     struct code c = {{0}};
-    assert(optype == OPT_REG && !is_64_bit(op.reg));
+    assert(optype == OPT_REG && op.reg.w == 1);
 
+    if (is_64_bit_reg(op.reg.r) || is_rex_byte_reg(op.reg))
+        c.val[c.len++] = REX | B(op.reg);
     c.val[c.len++] = 0x0F;
     c.val[c.len++] = 0x90 | cond;
     c.val[c.len++] = 0xC0 | reg(op.reg);
@@ -496,8 +611,9 @@ static struct code test(
     union operand b)
 {
     struct code c = {{0}};
-    assert(optype == OPT_REG_REG && !is_64_bit_reg(a.reg.r));
+    assert(optype == OPT_REG_REG);
 
+    encode_prefix_reg_reg(&c, a.reg.w, a.reg, b.reg);
     c.val[c.len++] = 0x84 | w(a.reg);
     c.val[c.len++] = 0xC0 | reg(a.reg) << 3 | reg(b.reg);
     return c;
@@ -527,8 +643,7 @@ static struct code mul(enum instr_optype optype, union operand op)
     } else {
         assert(optype == OPT_MEM);
 
-        if (op.mem.w > 4)
-            c.val[c.len++] = REX | W(op.mem) | is_64_bit_reg(op.mem.addr.base);
+        encode_prefix_reg_mem(&c, op.mem.w, reg_none, op.mem.addr);
         c.val[c.len++] = 0xF6 | w(op.mem);
         encode_sib_addr(&c, 0x4, op.mem.addr);
     }
@@ -548,8 +663,7 @@ static struct code encode_div(enum instr_optype optype, union operand op)
     } else {
         assert(optype == OPT_MEM);
 
-        if (op.mem.w > 4)
-            c.val[c.len++] = REX | W(op.mem) | is_64_bit_reg(op.mem.addr.base);
+        encode_prefix_reg_mem(&c, op.mem.w, reg_none, op.mem.addr);
         c.val[c.len++] = 0xF6 | w(op.mem);
         encode_sib_addr(&c, 0x6, op.mem.addr);
     }
@@ -557,19 +671,6 @@ static struct code encode_div(enum instr_optype optype, union operand op)
     return c;
 }
 
-static struct code basic_register_only_encode(
-    unsigned int opcode,
-    struct registr a,
-    struct registr b)
-{
-    struct code c = {{0}};
-    if (is_64_bit_reg(a.r) || a.w > 4)
-        c.val[c.len++] = REX | W(a) | R(a) | B(b);
-    c.val[c.len++] = opcode | w(a);
-    c.val[c.len++] = 0xC0 | reg(a) << 3 | reg(b);
-    return c;
-}
-
 static struct code xor(
     enum instr_optype optype,
     union operand a,
@@ -626,7 +727,7 @@ static struct code shr(
     if (is_64_bit_reg(b.reg.r) || b.reg.w > 4)
         c.val[c.len++] = REX | W(b.reg) | B(b.reg);
     c.val[c.len++] = 0xD2 | w(b.reg);
-    c.val[c.len++] = 0xF8 | reg(b.reg);
+    c.val[c.len++] = 0xE8 | reg(b.reg);
 
     return c;
 }
@@ -694,6 +795,9 @@ struct code encode(struct instruction instr)
     case INSTR_REP_MOVSQ:
         assert(instr.optype == OPT_NONE);
         return rep_movsq();
+    case INSTR_REP_STOSQ:
+        assert(instr.optype == OPT_NONE);
+        return rep_stosq();
     case INSTR_RET:
         return ret();
     case INSTR_JMP:
@@ -708,6 +812,16 @@ struct code encode(struct instruction instr)
         return jcc(instr.optype, TEST_AE, instr.source);
     case INSTR_JGE:
         return jcc(instr.optype, TEST_GE, instr.source);
+    case INSTR_JNZ:
+        return jcc(instr.optype, TEST_NZ, instr.source);
+    case INSTR_JB:
+        return jcc(instr.optype, TEST_B, instr.source);
+    case INSTR_JL:
+        return jcc(instr.optype, TEST_L, instr.source);
+    case INSTR_JBE:
+        return jcc(instr.optype, TEST_BE, instr.source);
+    case INSTR_JLE:
+        return jcc(instr.optype, TEST_LE, instr.source);
     case INSTR_SETZ:
         return setcc(instr.optype, TEST_Z, instr.source);
     case INSTR_SETA:
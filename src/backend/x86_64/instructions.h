@@ -110,10 +110,16 @@ enum opcode {
     INSTR_JZ,
     INSTR_JAE,
     INSTR_JGE,
+    INSTR_JNZ,
+    INSTR_JB,
+    INSTR_JL,
+    INSTR_JBE,
+    INSTR_JLE,
     INSTR_CALL,
     INSTR_LEAVE,
     INSTR_RET,
-    INSTR_REP_MOVSQ /* Repeat move string to string (qword) */
+    INSTR_REP_MOVSQ,/* Repeat move string to string (qword) */
+    INSTR_REP_STOSQ /* Repeat store %rax to string (qword) */
 };
 
 /* Instructions with register, memory or immediate operands.
@@ -0,0 +1,343 @@
+#include "peephole.h"
+#include <lacc/cli.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Instruction or jump target label, in the order they are emitted.
+ */
+struct item {
+    const struct symbol *label;
+    struct instruction instr;
+};
+
+/* Backend receiving output after optimization.
+ */
+static int (*emit_symbol)(const struct symbol *);
+static int (*emit_text)(struct instruction);
+
+/* Optimized output of current function. Rules are matched against the last
+ * items each time a new item is added, rewriting the end of the window.
+ */
+static struct item *window;
+static int length, capacity;
+
+#define top(i) (&window[length - 1 - (i)])
+
+/* Determine if i-th last item in window is instruction with given opcode.
+ */
+static int is_instr(int i, enum opcode opcode)
+{
+    return i < length && !top(i)->label && top(i)->instr.opcode == opcode;
+}
+
+static int is_setcc(int i)
+{
+    return is_instr(i, INSTR_SETZ) || is_instr(i, INSTR_SETA)
+        || is_instr(i, INSTR_SETG) || is_instr(i, INSTR_SETAE)
+        || is_instr(i, INSTR_SETGE);
+}
+
+static int is_jcc(int i)
+{
+    return is_instr(i, INSTR_JZ) || is_instr(i, INSTR_JA)
+        || is_instr(i, INSTR_JG) || is_instr(i, INSTR_JAE)
+        || is_instr(i, INSTR_JGE) || is_instr(i, INSTR_JNZ)
+        || is_instr(i, INSTR_JB) || is_instr(i, INSTR_JL)
+        || is_instr(i, INSTR_JBE) || is_instr(i, INSTR_JLE);
+}
+
+/* Registers used only within the instructions selected for a single IR
+ * operation or branch, never holding values from one basic block to the next.
+ */
+static int is_scratch(enum reg r)
+{
+    return r == AX || r == CX || r == DX || r == SI || r == DI || r == R11;
+}
+
+static int is_general(struct registr r)
+{
+    return r.r >= AX && r.r <= R15;
+}
+
+static int equal_reg(struct registr a, struct registr b)
+{
+    return a.r == b.r && a.w == b.w;
+}
+
+static int equal_address(struct address a, struct address b)
+{
+    return a.sym == b.sym && a.disp == b.disp && a.base == b.base
+        && a.offset == b.offset && (!a.offset || a.mult == b.mult);
+}
+
+static long value_of(struct immediate imm)
+{
+    assert(imm.type == IMM_INT);
+    return imm.w == 1 ? imm.d.byte
+        : imm.w == 2 ? imm.d.word
+        : imm.w == 4 ? imm.d.dword : imm.d.qword;
+}
+
+/* Load from stack slot that was just written is replaced by copying the stored
+ * register.
+ *
+ *      mov %reg, -N(%rbp)          mov %reg, -N(%rbp)
+ *      mov -N(%rbp), %reg2    =>   mov %reg, %reg2
+ */
+static int store_load(void)
+{
+    struct instruction *store, *load;
+
+    if (!is_instr(0, INSTR_MOV) || !is_instr(1, INSTR_MOV))
+        return 0;
+
+    store = &top(1)->instr;
+    load = &top(0)->instr;
+    if (store->optype != OPT_REG_MEM || load->optype != OPT_MEM_REG
+        || !is_general(store->source.reg)
+        || !is_general(load->dest.reg)
+        || store->source.reg.w != load->dest.reg.w
+        || store->dest.mem.addr.sym
+        || store->dest.mem.addr.base != BP
+        || store->dest.mem.addr.offset
+        || !equal_address(store->dest.mem.addr, load->source.mem.addr))
+    {
+        return 0;
+    }
+
+    load->optype = OPT_REG_REG;
+    load->source.reg = store->source.reg;
+    return 1;
+}
+
+/* Remove move from register to itself. Moves with 32 bit width clear the upper
+ * half of the 64 bit register, and must be kept.
+ *
+ *      mov %rax, %rax          =>
+ */
+static int self_move(void)
+{
+    const struct instruction *mov;
+
+    if (!is_instr(0, INSTR_MOV))
+        return 0;
+
+    mov = &top(0)->instr;
+    if (mov->optype != OPT_REG_REG
+        || !equal_reg(mov->source.reg, mov->dest.reg)
+        || mov->dest.reg.w == 4)
+    {
+        return 0;
+    }
+
+    length--;
+    return 1;
+}
+
+/* Remove unconditional jump to one of the labels immediately following.
+ *
+ *      jmp .L1                 =>   .L1:
+ *  .L1:
+ */
+static int jump_next(void)
+{
+    int i, j;
+    const struct instruction *jmp;
+
+    for (i = 0; i < length && top(i)->label; ++i)
+        ;
+
+    if (!i || !is_instr(i, INSTR_JMP))
+        return 0;
+
+    jmp = &top(i)->instr;
+    if (jmp->optype != OPT_IMM || jmp->source.imm.d.addr.disp)
+        return 0;
+
+    for (j = 0; j < i; ++j) {
+        if (top(j)->label == jmp->source.imm.d.addr.sym) {
+            memmove(top(i), top(i - 1), i * sizeof(*window));
+            length--;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Compare with zero is replaced by shorter test instruction, setting the same
+ * flags.
+ *
+ *      cmp $0, %eax            =>   test %eax, %eax
+ */
+static int compare_zero(void)
+{
+    struct instruction *cmp;
+
+    if (!is_instr(0, INSTR_CMP))
+        return 0;
+
+    cmp = &top(0)->instr;
+    if (cmp->optype != OPT_IMM_REG
+        || cmp->source.imm.type != IMM_INT
+        || value_of(cmp->source.imm) != 0)
+    {
+        return 0;
+    }
+
+    cmp->opcode = INSTR_TEST;
+    cmp->optype = OPT_REG_REG;
+    cmp->source.reg = cmp->dest.reg;
+    return 1;
+}
+
+/* Result of setcc that is only tested before a conditional jump does not need
+ * to be extended. Scratch registers are dead after the jump.
+ *
+ *      setz %al                     setz %al
+ *      movzx %al, %eax         =>   test %al, %al
+ *      test %eax, %eax              jz .L1
+ *      jz .L1
+ */
+static int setcc_test(void)
+{
+    struct instruction *set, *ext, *test;
+
+    if (!is_jcc(0) || !is_instr(1, INSTR_TEST) || !is_instr(2, INSTR_MOVZX)
+        || !is_setcc(3))
+    {
+        return 0;
+    }
+
+    set = &top(3)->instr;
+    ext = &top(2)->instr;
+    test = &top(1)->instr;
+    if (ext->optype != OPT_REG_REG
+        || !equal_reg(ext->source.reg, set->source.reg)
+        || ext->dest.reg.r != set->source.reg.r
+        || !is_scratch(set->source.reg.r)
+        || test->optype != OPT_REG_REG
+        || !equal_reg(test->source.reg, ext->dest.reg)
+        || !equal_reg(test->dest.reg, ext->dest.reg))
+    {
+        return 0;
+    }
+
+    test->source.reg = set->source.reg;
+    test->dest.reg = set->source.reg;
+    *top(2) = *top(1);
+    *top(1) = *top(0);
+    length--;
+    return 1;
+}
+
+static struct rule {
+    const char *name;
+    int (*apply)(void);
+    int enabled;
+    int count;
+} rules[] = {
+    {"store-load", store_load, 1, 0},
+    {"self-move", self_move, 1, 0},
+    {"jump-next", jump_next, 1, 0},
+    {"compare-zero", compare_zero, 1, 0},
+    {"setcc-test", setcc_test, 1, 0}
+};
+
+#define N_RULES (sizeof(rules) / sizeof(rules[0]))
+
+/* Add item to window, and apply rules until no more changes can be made.
+ */
+static void push(struct item item)
+{
+    int i, changed;
+
+    if (length == capacity) {
+        capacity = (capacity) ? capacity * 2 : 256;
+        window = realloc(window, capacity * sizeof(*window));
+    }
+
+    window[length++] = item;
+    do {
+        changed = 0;
+        for (i = 0; i < N_RULES; ++i) {
+            if (rules[i].enabled && rules[i].apply()) {
+                rules[i].count++;
+                changed = 1;
+            }
+        }
+    } while (changed);
+}
+
+void peephole_init(
+    int (*symbol)(const struct symbol *),
+    int (*text)(struct instruction))
+{
+    emit_symbol = symbol;
+    emit_text = text;
+}
+
+int peephole_symbol(const struct symbol *sym)
+{
+    struct item item = {0};
+
+    if (sym->symtype == SYM_LABEL) {
+        item.label = sym;
+        push(item);
+        return 0;
+    }
+
+    peephole_flush();
+    return emit_symbol(sym);
+}
+
+int peephole_text(struct instruction instr)
+{
+    struct item item = {0};
+
+    item.instr = instr;
+    push(item);
+    return 0;
+}
+
+int peephole_flush(void)
+{
+    int i;
+
+    for (i = 0; i < length; ++i) {
+        if (window[i].label)
+            emit_symbol(window[i].label);
+        else
+            emit_text(window[i].instr);
+    }
+
+    free(window);
+    window = NULL;
+    length = 0;
+    capacity = 0;
+    return 0;
+}
+
+int peephole_enable(const char *name, int enable)
+{
+    int i;
+
+    for (i = 0; i < N_RULES; ++i) {
+        if (!strcmp(rules[i].name, name)) {
+            rules[i].enabled = enable;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void peephole_report(void)
+{
+    int i;
+
+    for (i = 0; i < N_RULES; ++i)
+        verbose("peephole %s: %d", rules[i].name, rules[i].count);
+}
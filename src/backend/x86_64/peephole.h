@@ -0,0 +1,35 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "instructions.h"
+
+/* Set backend receiving instructions and symbols after optimization. Must be
+ * called before any other peephole function.
+ */
+void peephole_init(
+    int (*symbol)(const struct symbol *),
+    int (*text)(struct instruction));
+
+/* Start processing symbol. Labels are buffered together with instructions of
+ * the current function, while other symbols first flush any pending output.
+ */
+int peephole_symbol(const struct symbol *sym);
+
+/* Add instruction to window of current function.
+ */
+int peephole_text(struct instruction instr);
+
+/* Write buffered instructions and labels to backend.
+ */
+int peephole_flush(void);
+
+/* Enable or disable rewrite rule by name. Return non-zero if no rule with the
+ * name exists.
+ */
+int peephole_enable(const char *name, int enable);
+
+/* Print number of times each rule has been applied, if verbose.
+ */
+void peephole_report(void);
+
+#endif
@@ -0,0 +1,552 @@
+#include "registers.h"
+#include "../liveness.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Registers available for allocation. Values that are live across function
+ * calls must be kept in callee saved registers, while other values can also
+ * use %r10, %r9 and %r8. Scratch registers %rax, %rcx, %rdx, %rsi, %rdi and
+ * %r11 are used directly by instruction selection, and never handed out.
+ */
+static const enum reg callee_saved[MAX_CALLEE_SAVED] = {BX, R12, R13, R14, R15};
+static const enum reg caller_saved[] = {R10, R9, R8};
+
+#define N_CALLER_SAVED (sizeof(caller_saved) / sizeof(caller_saved[0]))
+
+/* Live interval of a variable, spanning the first and last position in the
+ * linear order of operations where the value must be preserved.
+ */
+struct interval {
+    struct symbol *sym;
+    int start;
+    int end;
+    int is_param;
+    int global;     /* Index in liveness sets, or -1 if local to one block. */
+    enum reg reg;
+};
+
+/* Basic block in linear order, with liveness sets over global variables. The
+ * branch or return at the end of the block has its own position.
+ */
+struct node {
+    struct block *block;
+    int start;
+    int end;
+    int *succ;
+    int n_succ;
+    unsigned long *use, *def, *in, *out;
+};
+
+static struct node *nodes;
+static int n_nodes, cap_nodes;
+
+static struct interval *intervals;
+static int n_vars;
+
+/* Number of call positions up to and including a given position, used to
+ * determine whether an interval is live across a function call.
+ */
+static int *calls;
+
+static void number_blocks(struct block *block)
+{
+    int i;
+
+    if (block->color == BLACK)
+        return;
+
+    block->color = BLACK;
+    if (n_nodes == cap_nodes) {
+        cap_nodes = (cap_nodes) ? cap_nodes * 2 : 64;
+        nodes = realloc(nodes, cap_nodes * sizeof(*nodes));
+    }
+
+    memset(nodes + n_nodes, 0, sizeof(*nodes));
+    nodes[n_nodes++].block = block;
+    for (i = 0; i < N_SUCCESSORS(block); ++i)
+        if (SUCCESSOR(block, i))
+            number_blocks(SUCCESSOR(block, i));
+}
+
+static int compare_start(const void *a, const void *b)
+{
+    const struct interval
+        *l = *(const struct interval **) a,
+        *r = *(const struct interval **) b;
+
+    return l->start - r->start;
+}
+
+/* Resolve jump targets to index in linear order.
+ */
+static void link_nodes(void)
+{
+    int i, j;
+    struct block_index key, *map, *found;
+
+    map = calloc(n_nodes, sizeof(*map));
+    for (i = 0; i < n_nodes; ++i) {
+        map[i].block = nodes[i].block;
+        map[i].i = i;
+    }
+
+    qsort(map, n_nodes, sizeof(*map), compare_block);
+    for (i = 0; i < n_nodes; ++i) {
+        nodes[i].n_succ = N_SUCCESSORS(nodes[i].block);
+        nodes[i].succ = calloc(nodes[i].n_succ, sizeof(*nodes[i].succ));
+        for (j = 0; j < nodes[i].n_succ; ++j) {
+            nodes[i].succ[j] = -1;
+            if (SUCCESSOR(nodes[i].block, j)) {
+                key.block = SUCCESSOR(nodes[i].block, j);
+                found = bsearch(&key, map, n_nodes, sizeof(*map),
+                    compare_block);
+                assert(found);
+                nodes[i].succ[j] = found->i;
+            }
+        }
+    }
+
+    free(map);
+}
+
+/* Index of variable tracked for register allocation, or -1. Dereferencing a
+ * pointer is considered a use of the pointer variable.
+ */
+static int var_index(struct var var)
+{
+    if (var.kind == IMMEDIATE || !var.symbol)
+        return -1;
+
+    return var.symbol->regno - 1;
+}
+
+/* Variables must be referenced as a whole, and not have their address taken,
+ * to be kept in register.
+ */
+static void exclude_escaping(struct var var, int is_addr, int *excluded)
+{
+    int i = var_index(var);
+
+    if (i >= 0 && is_escaping(var, is_addr))
+        excluded[i] = 1;
+}
+
+/* Write indices of variables read by operation to output list, returning the
+ * number of elements written.
+ */
+static int var_uses(struct op *op, int *list)
+{
+    int i, n, m = 0;
+    struct var *uses[3];
+
+    n = op_uses(op, uses);
+    for (i = 0; i < n; ++i) {
+        list[m] = var_index(*uses[i]);
+        m += list[m] >= 0;
+    }
+
+    return m;
+}
+
+/* Index of variable written by operation, or -1.
+ */
+static int var_def(struct op *op)
+{
+    struct var *def = op_def(op);
+
+    return (def) ? var_index(*def) : -1;
+}
+
+/* Index of variable read by branch or return at the end of block, or -1.
+ */
+static int tail_use(const struct block *block)
+{
+    return has_tail_use(block) ? var_index(block->expr) : -1;
+}
+
+/* Operations that are compiled to function calls, clobbering caller saved
+ * registers.
+ */
+static int is_call(const struct op *op)
+{
+    switch (op->type) {
+    case IR_CALL:
+    case IR_VA_ARG:
+        return 1;
+    case IR_ASSIGN:
+        return size_of(op->a.type) > COPY_CALL_LIMIT;
+    default:
+        return 0;
+    }
+}
+
+/* Parameters are loaded to registers when compiling the call, so operands of
+ * IR_PARAM are live until the following IR_CALL in the same block.
+ */
+static int use_position(const struct block *block, int j, int pos)
+{
+    int i;
+
+    if (j < block->n && block->code[j].type == IR_PARAM) {
+        for (i = j; block->code[i].type != IR_CALL; ++i)
+            assert(i < block->n - 1);
+        pos += i - j;
+    }
+
+    return pos;
+}
+
+static void extend(struct interval *it, int pos)
+{
+    if (it->start < 0 || pos < it->start)
+        it->start = pos;
+    if (pos > it->end)
+        it->end = pos;
+}
+
+/* Assign positions to operations, and find intervals of variables that are
+ * only live within a single block. Variables read before being written in
+ * some block are live across blocks, and given an index in liveness sets.
+ * Return total number of positions.
+ */
+static int scan_positions(int *n_globals)
+{
+    int i, j, k, n, u, pos = 0, list[3], *seen;
+    struct block *block;
+
+    seen = calloc(n_vars, sizeof(*seen));
+    for (i = 0; i < n_nodes; ++i) {
+        block = nodes[i].block;
+        nodes[i].start = pos;
+        for (j = 0; j <= block->n; ++j, ++pos) {
+            if (j < block->n) {
+                n = var_uses(block->code + j, list);
+                k = var_def(block->code + j);
+            } else {
+                list[0] = tail_use(block);
+                n = list[0] >= 0;
+                k = -1;
+            }
+
+            u = use_position(block, j, pos);
+            while (n--) {
+                if (seen[list[n]] != i + 1
+                    && intervals[list[n]].global < 0)
+                {
+                    intervals[list[n]].global = (*n_globals)++;
+                }
+                extend(&intervals[list[n]], u);
+            }
+
+            if (k >= 0) {
+                seen[k] = i + 1;
+                extend(&intervals[k], pos);
+            }
+        }
+
+        nodes[i].end = pos - 1;
+    }
+
+    free(seen);
+    return pos;
+}
+
+/* Compute live in and live out sets of each block by iterating to a fixed
+ * point, then extend intervals of variables live across blocks.
+ */
+static void compute_liveness(int n_globals)
+{
+    int i, j, k, n, w, changed, words, list[3], *global;
+    unsigned long *sets, *in, u;
+    struct node *node;
+    struct block *block;
+
+    words = (n_globals + BITS - 1) / BITS;
+    sets = calloc(4 * n_nodes * words, sizeof(*sets));
+    global = calloc(n_globals, sizeof(*global));
+    for (i = 0; i < n_vars; ++i)
+        if (intervals[i].global >= 0)
+            global[intervals[i].global] = i;
+
+    for (i = 0; i < n_nodes; ++i) {
+        node = &nodes[i];
+        block = node->block;
+        node->use = sets + (4 * i) * words;
+        node->def = sets + (4 * i + 1) * words;
+        node->in = sets + (4 * i + 2) * words;
+        node->out = sets + (4 * i + 3) * words;
+        for (j = 0; j <= block->n; ++j) {
+            if (j < block->n) {
+                n = var_uses(block->code + j, list);
+                k = var_def(block->code + j);
+            } else {
+                list[0] = tail_use(block);
+                n = list[0] >= 0;
+                k = -1;
+            }
+
+            while (n--) {
+                w = intervals[list[n]].global;
+                if (w >= 0 && !bit_test(node->def, w))
+                    bit_set(node->use, w);
+            }
+
+            if (k >= 0 && intervals[k].global >= 0)
+                bit_set(node->def, intervals[k].global);
+        }
+    }
+
+    do {
+        changed = 0;
+        for (i = n_nodes - 1; i >= 0; --i) {
+            node = &nodes[i];
+            for (w = 0; w < words; ++w) {
+                u = 0;
+                for (j = 0; j < node->n_succ; ++j)
+                    if (node->succ[j] >= 0)
+                        u |= nodes[node->succ[j]].in[w];
+                node->out[w] = u;
+                u = node->use[w] | (u & ~node->def[w]);
+                if (u != node->in[w]) {
+                    node->in[w] = u;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    for (i = 0; i < n_nodes; ++i) {
+        for (j = 0; j < 2; ++j) {
+            in = (j == 0) ? nodes[i].in : nodes[i].out;
+            for (w = 0; w < words; ++w) {
+                for (k = 0, u = in[w]; u; ++k, u >>= 1) {
+                    if (u & 1) {
+                        extend(&intervals[global[w * BITS + k]],
+                            (j == 0) ? nodes[i].start : nodes[i].end);
+                    }
+                }
+            }
+        }
+    }
+
+    free(global);
+    free(sets);
+}
+
+/* Count call positions, such that an interval spans a call if there are any
+ * calls after the first position, up to and including the last.
+ */
+static void count_calls(int n_positions)
+{
+    int i, j, pos, n = 0;
+    struct block *block;
+
+    calls = calloc(n_positions, sizeof(*calls));
+    for (i = 0; i < n_nodes; ++i) {
+        block = nodes[i].block;
+        pos = nodes[i].start;
+        for (j = 0; j < block->n; ++j, ++pos) {
+            n += is_call(block->code + j);
+            calls[pos] = n;
+        }
+
+        /* Returning objects in memory calls memcpy. */
+        if (!block->jump[0] && block->has_return_value
+            && !is_scalar(block->expr.type))
+        {
+            n++;
+        }
+
+        calls[pos] = n;
+    }
+}
+
+static int spans_call(const struct interval *it)
+{
+    return calls[it->end] - calls[it->start] > 0;
+}
+
+/* Linear scan over intervals sorted by start position. When running out of
+ * registers, spill the interval ending last.
+ */
+static int linear_scan(struct interval **sorted, int n, enum reg *saved)
+{
+    int i, j, k, callee_only, n_active = 0, n_saved = 0;
+    struct interval *it, *active[MAX_CALLEE_SAVED + N_CALLER_SAVED];
+    char taken[R15 + 1] = {0};
+    enum reg r;
+
+    for (i = 0; i < n; ++i) {
+        it = sorted[i];
+        for (j = 0; j < n_active; ++j) {
+            if (active[j]->end < it->start) {
+                taken[active[j]->reg] = 0;
+                active[j--] = active[--n_active];
+            }
+        }
+
+        /* Parameters are written on entering the function, where the
+         * parameter registers are still live. */
+        callee_only = it->is_param || spans_call(it);
+        r = 0;
+        if (!callee_only) {
+            for (k = 0; k < N_CALLER_SAVED && !r; ++k)
+                if (!taken[caller_saved[k]])
+                    r = caller_saved[k];
+        }
+
+        for (k = 0; k < MAX_CALLEE_SAVED && !r; ++k)
+            if (!taken[callee_saved[k]])
+                r = callee_saved[k];
+
+        if (!r) {
+            for (j = 0, k = -1; j < n_active; ++j) {
+                if ((!callee_only
+                        || active[j]->reg < R8 || active[j]->reg > R10)
+                    && (k < 0 || active[j]->end > active[k]->end))
+                {
+                    k = j;
+                }
+            }
+
+            if (k < 0 || active[k]->end <= it->end)
+                continue;
+
+            r = active[k]->reg;
+            active[k]->reg = 0;
+            active[k] = active[--n_active];
+        }
+
+        it->reg = r;
+        taken[r] = 1;
+        active[n_active++] = it;
+    }
+
+    for (i = 0; i < n; ++i) {
+        r = sorted[i]->reg;
+        for (k = 0; k < MAX_CALLEE_SAVED; ++k) {
+            if (r == callee_saved[k]) {
+                for (j = 0; j < n_saved && saved[j] != r; ++j)
+                    ;
+                if (j == n_saved)
+                    saved[n_saved++] = r;
+            }
+        }
+    }
+
+    return n_saved;
+}
+
+static void add_candidates(struct symbol_list list, int is_param)
+{
+    int i;
+    struct symbol *sym;
+
+    for (i = 0; i < list.length; ++i) {
+        sym = list.symbol[i];
+        sym->regno = 0;
+        if (is_candidate(sym)) {
+            intervals[n_vars].sym = sym;
+            intervals[n_vars].is_param = is_param;
+            sym->regno = ++n_vars;
+        }
+    }
+}
+
+/* Compute live intervals of all candidate variables, and assign registers.
+ */
+static int allocate(struct definition def, enum reg *saved)
+{
+    int i, j, n, n_saved, n_globals = 0, *excluded;
+    struct interval **sorted;
+    struct block *block;
+    struct op *op;
+
+    n_nodes = 0;
+    number_blocks(def.body);
+    for (i = 0; i < n_nodes; ++i)
+        nodes[i].block->color = WHITE;
+
+    /* Remove variables that escape, and number the remaining ones. */
+    excluded = calloc(n_vars, sizeof(*excluded));
+    for (i = 0; i < n_nodes; ++i) {
+        block = nodes[i].block;
+        for (j = 0; j < block->n; ++j) {
+            op = block->code + j;
+            exclude_escaping(op->a, 0, excluded);
+            if (n_operands(op) > 0)
+                exclude_escaping(op->b, op->type == IR_ADDR, excluded);
+            if (n_operands(op) > 1)
+                exclude_escaping(op->c, 0, excluded);
+        }
+
+        if (has_tail_use(block))
+            exclude_escaping(block->expr, 0, excluded);
+    }
+
+    for (i = 0, j = 0; i < n_vars; ++i) {
+        if (excluded[i]) {
+            intervals[i].sym->regno = 0;
+        } else {
+            intervals[j] = intervals[i];
+            intervals[j].sym->regno = j + 1;
+            j++;
+        }
+    }
+
+    free(excluded);
+    n_vars = j;
+    for (i = 0; i < n_vars; ++i) {
+        intervals[i].start = -1;
+        intervals[i].end = -1;
+        intervals[i].global = -1;
+    }
+
+    link_nodes();
+    n = scan_positions(&n_globals);
+    if (n_globals)
+        compute_liveness(n_globals);
+    count_calls(n);
+
+    sorted = calloc(n_vars, sizeof(*sorted));
+    for (i = 0, j = 0; i < n_vars; ++i) {
+        if (intervals[i].end >= 0) {
+            if (intervals[i].is_param)
+                intervals[i].start = 0;
+            sorted[j++] = &intervals[i];
+        }
+    }
+
+    qsort(sorted, j, sizeof(*sorted), compare_start);
+    n_saved = linear_scan(sorted, j, saved);
+    for (i = 0; i < n_vars; ++i)
+        intervals[i].sym->regno = intervals[i].reg;
+
+    for (i = 0; i < n_nodes; ++i)
+        free(nodes[i].succ);
+
+    free(sorted);
+    free(calls);
+    free(nodes);
+    nodes = NULL;
+    cap_nodes = 0;
+    return n_saved;
+}
+
+int allocate_registers(struct definition def, enum reg *saved)
+{
+    int n_saved = 0;
+
+    intervals = calloc(def.params.length + def.locals.length,
+        sizeof(*intervals));
+    n_vars = 0;
+    add_candidates(def.params, 1);
+    add_candidates(def.locals, 0);
+    if (n_vars)
+        n_saved = allocate(def, saved);
+
+    free(intervals);
+    return n_saved;
+}
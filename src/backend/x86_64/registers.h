@@ -0,0 +1,28 @@
+#ifndef REGISTERS_H
+#define REGISTERS_H
+
+#include "instructions.h"
+#include <lacc/ir.h>
+
+/* Maximum number of callee saved registers handed out by the allocator.
+ */
+#define MAX_CALLEE_SAVED 5
+
+/* Objects larger than this number of bytes are copied by calling memcpy,
+ * clobbering caller saved registers. Smaller copies are done inline, using
+ * only registers not handed out by the allocator.
+ */
+#define COPY_CALL_LIMIT 4096
+
+/* Assign registers to parameters and local variables of scalar type that never
+ * have their address taken, using linear scan over live intervals computed on
+ * the control flow graph. Symbols kept in register get regno set, all others
+ * are left to be assigned stack storage.
+ *
+ * Callee saved registers that are used by the function are written to output
+ * list, which must have room for MAX_CALLEE_SAVED elements. Return number of
+ * such registers.
+ */
+int allocate_registers(struct definition def, enum reg *saved);
+
+#endif
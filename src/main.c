@@ -11,6 +11,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 static char *input;
@@ -20,19 +21,20 @@ static void help(const char *prog)
 {
     fprintf(
         stderr,
-        "Usage: %s [-(S|E|c)] [-v] [-I <path>] [-o <file>] <file>\n",
+        "Usage: %s [-(S|E|c)] [-v] [-f[no-]<rule>] [-I <path>] [-o <file>] "
+        "<file>\n",
         prog);
 }
 
 static enum compile_target parse_args(int argc, char *argv[])
 {
     enum compile_target target;
-    int c;
+    int c, enable;
 
     target = TARGET_IR_DOT;
     output = stdout;
 
-    while ((c = getopt(argc, argv, "SEco:vI:")) != -1) {
+    while ((c = getopt(argc, argv, "SEco:vf:I:")) != -1) {
         switch (c) {
         case 'c':
             target = TARGET_x86_64_ELF;
@@ -49,6 +51,13 @@ static enum compile_target parse_args(int argc, char *argv[])
         case 'v':
             verbose_level += 1;
             break;
+        case 'f':
+            enable = strncmp(optarg, "no-", 3) != 0;
+            if (set_optimization(enable ? optarg : optarg + 3, enable)) {
+                help(argv[0]);
+                exit(1);
+            }
+            break;
         case 'I':
             add_include_search_path(optarg);
             break;
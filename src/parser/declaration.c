@@ -39,19 +39,8 @@ static struct definition *push_back_definition(const struct symbol *sym)
 
 static void clear_definition(struct definition *def)
 {
-    int i;
-    struct block *block;
-    if (def->params.capacity) free(def->params.symbol);
-    if (def->locals.capacity) free(def->locals.symbol);
-    if (def->nodes.capacity) {
-        for (i = 0; i < def->nodes.length; ++i) {
-            block = def->nodes.block[i];
-            if (block->n)
-                free(block->code);
-            free(block);
-        }
-        free(def->nodes.block);
-    }
+    if (def->arena)
+        arena_free(def->arena);
     memset(def, 0, sizeof(*def));
 }
 
@@ -73,13 +62,18 @@ static struct var var_zero(int size)
 }
 
 static struct block_list block_list_add(
+    struct arena *arena,
     struct block_list list,
     struct block *block)
 {
+    int cap;
+
     assert(block);
     if (list.capacity <= list.length) {
-        list.capacity += 32;
-        list.block = realloc(list.block, list.capacity * sizeof(*block));
+        cap = (list.capacity) ? list.capacity * 2 : 32;
+        list.block = arena_realloc(arena, list.block,
+            list.capacity * sizeof(*list.block), cap * sizeof(*list.block));
+        list.capacity = cap;
     }
 
     list.block[list.length++] = block;
@@ -87,13 +81,18 @@ static struct block_list block_list_add(
 }
 
 static struct symbol_list sym_list_add(
+    struct arena *arena,
     struct symbol_list list,
     struct symbol *sym)
 {
+    int cap;
+
     assert(sym);
     if (list.capacity <= list.length) {
-        list.capacity += 32;
-        list.symbol = realloc(list.symbol, list.capacity * sizeof(*sym));
+        cap = (list.capacity) ? list.capacity * 2 : 32;
+        list.symbol = arena_realloc(arena, list.symbol,
+            list.capacity * sizeof(*list.symbol), cap * sizeof(*list.symbol));
+        list.capacity = cap;
     }
 
     list.symbol[list.length++] = sym;
@@ -200,7 +199,7 @@ static struct typetree *direct_declarator(
             error("Unexpected identifier in abstract declarator.");
             exit(1);
         }
-        *symbol = ident.strval;
+        *symbol = tokstr(ident);
         break;
     case '(':
         consume('(');
@@ -240,11 +239,12 @@ static struct typetree *direct_declarator(
 static struct typetree *pointer(const struct typetree *base)
 {
     struct typetree *type = type_init(T_POINTER, base);
+    enum qualifier qual = Q_NONE;
 
     #define set_qualifier(d) \
-        if (type->qualifier & d) \
-            error("Duplicate type qualifier '%s'.", peek().strval); \
-        type->qualifier |= d;
+        if (qual & d) \
+            error("Duplicate type qualifier '%s'.", tokstr(peek())); \
+        qual |= d;
 
     consume('*');
     while (1) {
@@ -258,6 +258,14 @@ static struct typetree *pointer(const struct typetree *base)
 
     #undef set_qualifier
 
+    /* Pointers are shared, except when base is not yet known. */
+    if (qual) {
+        if (base)
+            type = (struct typetree *) type_qualified(type, qual);
+        else
+            type->qualifier = qual;
+    }
+
     return type;
 }
 
@@ -317,7 +325,7 @@ static struct typetree *struct_or_union_declaration(void)
         (next().token == STRUCT) ? T_STRUCT : T_UNION;
 
     if (peek().token == IDENTIFIER) {
-        const char *name = consume(IDENTIFIER).strval;
+        const char *name = tokstr(consume(IDENTIFIER));
         sym = sym_lookup(&ns_tag, name);
         if (!sym) {
             type = type_init(kind);
@@ -367,7 +375,7 @@ static void enumerator_list(void)
 
     consume('{');
     do {
-        const char *name = consume(IDENTIFIER).strval;
+        const char *name = tokstr(consume(IDENTIFIER));
 
         if (peek().token == '=') {
             consume('=');
@@ -400,7 +408,7 @@ static struct typetree *enum_declaration(void)
     consume(ENUM);
     if (peek().token == IDENTIFIER) {
         struct symbol *tag = NULL;
-        const char *name = consume(IDENTIFIER).strval;
+        const char *name = tokstr(consume(IDENTIFIER));
 
         tag = sym_lookup(&ns_tag, name);
         if (!tag || tag->depth < ns_tag.current_depth) {
@@ -485,7 +493,7 @@ static struct typetree get_basic_type_from_specifier(unsigned short spec)
  */
 struct typetree *declaration_specifiers(int *stc)
 {
-    struct typetree *type = NULL;
+    struct typetree *type = NULL, basic;
     struct token tok;
     int done = 0;
 
@@ -496,11 +504,11 @@ struct typetree *declaration_specifiers(int *stc)
     if (stc)       *stc =    '$';
 
     #define set_specifier(d) \
-        if (spec & d) error("Duplicate type specifier '%s'.", tok.strval); \
+        if (spec & d) error("Duplicate type specifier '%s'.", tokstr(tok)); \
         next(); spec |= d;
 
     #define set_qualifier(d) \
-        if (qual & d) error("Duplicate type qualifier '%s'.", tok.strval); \
+        if (qual & d) error("Duplicate type qualifier '%s'.", tokstr(tok)); \
         next(); qual |= d;
 
     #define set_storage_class(t) \
@@ -528,11 +536,10 @@ struct typetree *declaration_specifiers(int *stc)
         case CONST:     set_qualifier(Q_CONST); break;
         case VOLATILE:  set_qualifier(Q_VOLATILE); break;
         case IDENTIFIER: {
-            struct symbol *tag = sym_lookup(&ns_ident, tok.strval);
+            struct symbol *tag = sym_lookup(&ns_ident, tokstr(tok));
             if (tag && tag->symtype == SYM_TYPEDEF && !type) {
                 consume(IDENTIFIER);
-                type = type_init(T_STRUCT);
-                *type = tag->type;
+                type = &tag->type;
             } else {
                 done = 1;
             }
@@ -582,48 +589,36 @@ struct typetree *declaration_specifiers(int *stc)
                 (qual & Q_VOLATILE) ? " volatile" : "");
         }
     } else if (spec) {
-        type = type_init(T_STRUCT);
-        *type = get_basic_type_from_specifier(spec);
+        basic = get_basic_type_from_specifier(spec);
+        type = &basic;
     } else {
         error("Missing type specifier.");
         exit(1);
     }
 
-    type->qualifier |= qual;
-    return type;
+    /* Return shared instance, which is not modified by the caller. */
+    return (struct typetree *) type_qualified(type, type->qualifier | qual);
 }
 
-/* Set var = 0, using simple assignment on members for composite types. This
- * rule does not consume any input, but generates a series of assignments on the
- * given variable. Point is to be able to zero initialize using normal simple
- * assignment rules, although IR can become verbose for large structures.
+/* Set var = 0, using simple assignment for scalar types, and clearing the
+ * memory of composite types in a single operation. This rule does not consume
+ * any input. Objects with static storage are zero filled by backend, and need
+ * no assignment.
  */
 static void zero_initialize(struct block *block, struct var target)
 {
-    int i;
     struct var var;
     assert(target.kind == DIRECT);
 
+    if (target.symbol->linkage != LINK_NONE)
+        return;
+
     switch (target.type->type) {
     case T_STRUCT:
     case T_UNION:
-        target.type = unwrapped(target.type);
-        var = target;
-        for (i = 0; i < nmembers(var.type); ++i) {
-            target.type = get_member(var.type, i)->type;
-            target.offset = var.offset + get_member(var.type, i)->offset;
-            zero_initialize(block, target);
-        }
-        break;
     case T_ARRAY:
-        assert(target.type->size);
-        var = target;
-        target.type = target.type->next;
-        assert(is_struct(target.type) || !target.type->next);
-        for (i = 0; i < var.type->size / var.type->next->size; ++i) {
-            target.offset = var.offset + i * var.type->next->size;
-            zero_initialize(block, target);
-        }
+        assert(size_of(target.type));
+        eval_zero(block, target);
         break;
     case T_POINTER:
         var = var_zero(8);
@@ -641,6 +636,22 @@ static void zero_initialize(struct block *block, struct var target)
     }
 }
 
+/* Zero initialize remaining bytes of target, starting at offset relative to
+ * the object being initialized, and up to size.
+ */
+static void zero_initialize_tail(
+    struct block *block,
+    struct var target,
+    int offset,
+    int size)
+{
+    if (offset < size) {
+        target.offset += offset;
+        target.type = type_init(T_ARRAY, &basic_type__char, size - offset);
+        zero_initialize(block, target);
+    }
+}
+
 static struct block *object_initializer(struct block *block, struct var target)
 {
     int i,
@@ -654,20 +665,16 @@ static struct block *object_initializer(struct block *block, struct var target)
     switch (type->type) {
     case T_UNION:
         /* C89 states that only the first element of a union can be
-         * initialized. Zero the whole thing first if there is padding. */
-        if (size_of(get_member(type, 0)->type) < type->size) {
-            target.type =
-                (type->size % 8) ?
-                    type_init(T_ARRAY, &basic_type__char, type->size) :
-                    type_init(T_ARRAY, &basic_type__long, type->size / 8);
-            zero_initialize(block, target);
-        }
+         * initialized. Zero the rest if there is padding. */
         target.type = get_member(type, 0)->type;
         block = initializer(block, target);
         if (peek().token != '}') {
             error("Excess elements in union initializer.");
             exit(1);
         }
+        target.offset = filled;
+        zero_initialize_tail(
+            block, target, size_of(get_member(type, 0)->type), type->size);
         break;
     case T_STRUCT:
         for (i = 0; i < nmembers(type); ++i) {
@@ -681,10 +688,10 @@ static struct block *object_initializer(struct block *block, struct var target)
                 break;
             }
         }
-        while (++i < nmembers(type)) {
-            target.type = get_member(type, i)->type;
-            target.offset = filled + get_member(type, i)->offset;
-            zero_initialize(block, target);
+        if (++i < nmembers(type)) {
+            target.offset = filled;
+            zero_initialize_tail(
+                block, target, get_member(type, i)->offset, type->size);
         }
         break;
     case T_ARRAY:
@@ -708,10 +715,9 @@ static struct block *object_initializer(struct block *block, struct var target)
             ((struct symbol *) target.symbol)->type.size =
                 (i + 1) * size_of(type->next);
         } else {
-            while (++i < type->size / size_of(type->next)) {
-                target.offset = filled + i * size_of(type->next);
-                zero_initialize(block, target);
-            }
+            target.offset = filled;
+            zero_initialize_tail(
+                block, target, (i + 1) * size_of(type->next), type->size);
         }
         break;
     default:
@@ -723,9 +729,71 @@ static struct block *object_initializer(struct block *block, struct var target)
     return block;
 }
 
+/* Ensure image of static object being defined can hold size bytes. Capacity
+ * is grown geometrically, as the size of incomplete arrays is not known until
+ * the whole initializer is parsed.
+ */
+static void reserve_data(struct definition *def, size_t size)
+{
+    size_t cap = def->data_capacity;
+
+    if (size > cap) {
+        cap = cap ? cap * 2 : 16;
+        if (cap < size)
+            cap = size;
+        if (cap < (size_t) size_of(&def->symbol->type))
+            cap = size_of(&def->symbol->type);
+        def->data = arena_realloc(def->arena, def->data,
+            def->data_capacity, cap);
+        def->data_capacity = cap;
+    }
+}
+
+/* Move constant value assigned by the last operation in block to the image of
+ * static object being defined, removing the assignment. Addresses are kept,
+ * and resolved by relocation in backend.
+ */
+static void pack_initializer(struct block *block)
+{
+    int i, w;
+    long value;
+    const char *str;
+    struct definition *def;
+    const struct op *op = block->code + block->n - 1;
+
+    assert(defs.len);
+    assert(op->type == IR_ASSIGN);
+    def = &defs.def[defs.len - 1];
+    if (def->symbol != op->a.symbol || op->b.kind != IMMEDIATE)
+        return;
+
+    w = size_of(op->a.type);
+    if (is_string(op->b)) {
+        if (!is_array(op->a.type))
+            return;
+        str = op->b.symbol->string_value;
+        reserve_data(def, op->a.offset + w);
+        for (i = 0; i < w && str[i]; ++i)
+            def->data[op->a.offset + i] = str[i];
+    } else if (is_integer(op->a.type) || is_pointer(op->a.type)) {
+        if (!is_integer(op->b.type) && !is_pointer(op->b.type))
+            return;
+        value = op->b.imm.i;
+        if (value) {
+            reserve_data(def, op->a.offset + w);
+            for (i = 0; i < w; ++i)
+                def->data[op->a.offset + i] = (value >> (i * 8)) & 0xFF;
+        }
+    } else
+        return;
+
+    block->n--;
+}
+
 /* Parse and emit initializer code for target variable in statements such as
  * int b[] = {0, 1, 2, 3}. Generate a series of assignment operations on
- * references to target variable.
+ * references to target variable. Constant values assigned to objects with
+ * static storage are packed directly into the image of the definition.
  */
 static struct block *initializer(struct block *block, struct var target)
 {
@@ -754,6 +822,8 @@ static struct block *initializer(struct block *block, struct var target)
             target.type = block->expr.type;
         }
         eval_assign(block, target, block->expr);
+        if (target.symbol->linkage != LINK_NONE)
+            pack_initializer(block);
     }
 
     return block;
@@ -825,7 +895,7 @@ struct block *declaration(struct block *parent)
         if (ns_ident.current_depth) {
             assert(ns_ident.current_depth > 1);
             def = current_func();
-            def->locals = sym_list_add(def->locals, sym);
+            def->locals = sym_list_add(def->arena, def->locals, sym);
         }
 
         switch (peek().token) {
@@ -850,6 +920,8 @@ struct block *declaration(struct block *parent)
                 assert(sym->depth || !parent);
                 def = push_back_definition(sym);
                 initializer(def->body, var_direct(sym));
+                if (def->data)
+                    reserve_data(def, size_of(&sym->type));
             }
             assert(size_of(&sym->type) > 0);
             if (peek().token != ',') {
@@ -878,7 +950,7 @@ struct block *declaration(struct block *parent)
                     error("Missing parameter name at position %d.", i + 1);
                     exit(1);
                 }
-                def->params = sym_list_add(def->params,
+                def->params = sym_list_add(def->arena, def->params,
                     sym_add(&ns_ident, name, type, symtype, linkage));
             }
             parent = block(def->body);
@@ -908,24 +980,41 @@ struct var create_var(const struct typetree *type)
     struct symbol *temp = sym_create_tmp(type);
     struct var res = var_direct(temp);
 
-    def->locals = sym_list_add(def->locals, temp);
+    def->locals = sym_list_add(def->arena, def->locals, temp);
     res.lvalue = 1;
     return res;
 }
 
+/* Block is owned by last added definition, also non-functions. The fallback
+ * solution is to get some owner for expressiong like enum { A = 1 } foo;
+ * where the constant expression is evaluated by instantiating blocks.
+ */
+static struct definition *current_owner(void)
+{
+    struct definition *def;
+
+    def = (defs.len) ? &defs.def[defs.len - 1] : &fallback;
+    if (!def->arena) {
+        def->arena = arena_init();
+    }
+
+    return def;
+}
+
+struct arena *cfg_arena(void)
+{
+    return current_owner()->arena;
+}
+
 struct block *cfg_block_init(void)
 {
     struct definition *def;
     struct block *block;
 
-    block = calloc(1, sizeof(*block));
+    def = current_owner();
+    block = arena_alloc(def->arena, sizeof(*block));
     block->label = sym_create_label();
-
-    /* Block is owned by last added definition, also non-functions. The fallback
-     * solution is to get some owner for expressiong like enum { A = 1 } foo;
-     * where the constant expression is evaluated by instantiating blocks. */
-    def = (defs.len) ? &defs.def[defs.len - 1] : &fallback;
-    def->nodes = block_list_add(def->nodes, block);
+    def->nodes = block_list_add(def->arena, def->nodes, block);
 
     return block;
 }
@@ -935,6 +1024,11 @@ struct definition parse(void)
     static struct definition last_def_returned;
     struct definition def = {0};
 
+    /* All definitions returned so far are compiled, and no longer need their
+     * local symbols. */
+    if (!defs.len)
+        sym_release_locals();
+
     while (!defs.len && peek().token != END) {
         /* Parse a declaration, which can include definitions that will fill
          * up the buffer. Tentative declarations will only affect the symbol
@@ -8,6 +8,11 @@
  */
 struct block *cfg_block_init(void);
 
+/* Arena of the definition owning blocks created at this point, where their
+ * operations and jump tables are also allocated.
+ */
+struct arena *cfg_arena(void);
+
 /* Create temporary variable for evaluation. Added to current function
  * definition context, can only be called while parsing a function.
  */
@@ -24,12 +24,19 @@ static int is_string(struct var val)
 
 static void ir_append(struct block *block, struct op op)
 {
+    int cap;
+
     /* Current block can be NULL when parsing an expression that should not be
      * evaluated, for example argument to sizeof. */
     if (block) {
-        block->n += 1;
-        block->code = realloc(block->code, sizeof(*block->code) * block->n);
-        block->code[block->n - 1] = op;
+        if (block->n == block->capacity) {
+            cap = (block->capacity) ? block->capacity * 2 : 8;
+            block->code = arena_realloc(cfg_arena(), block->code,
+                block->capacity * sizeof(*block->code),
+                cap * sizeof(*block->code));
+            block->capacity = cap;
+        }
+        block->code[block->n++] = op;
     }
 }
 
@@ -733,33 +740,148 @@ struct var eval_conditional(struct var a, struct block *b, struct block *c)
     return result;
 }
 
+/* List of jump slots in blocks, to be set to the same target.
+ */
+struct jump_list {
+    struct jump {
+        struct block **slot;
+        struct jump *next;
+    } *head, *tail;
+};
+
+/* Branches leaving a logical expression when the result is known to be true
+ * or false, and the variable holding the result.
+ */
+struct logical_exits {
+    struct var value;
+    struct jump_list t, f;
+};
+
+static void jump_list_add(struct jump_list *list, struct block **slot)
+{
+    struct jump *jump;
+
+    jump = arena_alloc(cfg_arena(), sizeof(*jump));
+    jump->slot = slot;
+    if (list->tail) {
+        list->tail->next = jump;
+    } else {
+        list->head = jump;
+    }
+
+    list->tail = jump;
+}
+
+static void jump_list_join(struct jump_list *list, struct jump_list other)
+{
+    if (!other.head)
+        return;
+
+    if (list->tail) {
+        list->tail->next = other.head;
+    } else {
+        list->head = other.head;
+    }
+
+    list->tail = other.tail;
+}
+
+static void jump_list_patch(struct jump_list list, struct block *target)
+{
+    struct jump *jump;
+
+    for (jump = list.head; jump; jump = jump->next)
+        *jump->slot = target;
+}
+
+/* Result of logical expression can be branched on directly, as long as the
+ * value has not been used in any operation.
+ */
+static int is_logical_result(const struct block *block)
+{
+    const struct logical_exits *exits = block->exits;
+
+    return exits && !block->n
+        && block->expr.kind == exits->value.kind
+        && block->expr.symbol == exits->value.symbol
+        && block->expr.type == exits->value.type
+        && block->expr.offset == exits->value.offset;
+}
+
+/* Add branches on value of block to lists of jumps taken when the value is
+ * true or false. Jumps are not set until the lists are patched.
+ */
+static void branch(
+    struct block *block,
+    struct jump_list *t,
+    struct jump_list *f)
+{
+    struct var value = block->expr;
+
+    if (is_logical_result(block)) {
+        jump_list_join(t, block->exits->t);
+        jump_list_join(f, block->exits->f);
+        block->exits = NULL;
+    } else if (value.kind == IMMEDIATE && is_integer(value.type)) {
+        jump_list_add(value.imm.i ? t : f, &block->jump[0]);
+    } else {
+        jump_list_add(f, &block->jump[0]);
+        jump_list_add(t, &block->jump[1]);
+    }
+}
+
+void eval_branch(struct block *block, struct block *t, struct block *f)
+{
+    struct jump_list lt = {0}, lf = {0};
+
+    branch(block, &lt, &lf);
+    jump_list_patch(lt, t);
+    jump_list_patch(lf, f);
+}
+
+/* Evaluate logical expression with short circuiting, where operands branch
+ * directly to the next operand or to the result. The value is assigned 1 or 0
+ * in separate blocks, which are bypassed if the result is used as branch
+ * condition.
+ */
 static struct block *eval_logical_expression(
     int is_and,
     struct block *left,
     struct block *right_top,
     struct block *right)
 {
+    struct logical_exits *exits;
+    struct jump_list lt = {0}, lf = {0}, rt = {0}, rf = {0};
     struct block
         *t = cfg_block_init(),
         *f = cfg_block_init(),
         *r = cfg_block_init();
 
-    /* Result is integer type, assigned in true and false branches to numeric
-     * constant 1 or 0. */
-    r->expr = create_var(&basic_type__int);
-    left->expr = eval_expr(left, IR_OP_EQ, left->expr, var_int(0));
+    exits = arena_alloc(cfg_arena(), sizeof(*exits));
+    branch(left, &lt, &lf);
     if (is_and) {
-        left->jump[0] = right_top;
-        left->jump[1] = f;
+        jump_list_patch(lt, right_top);
+        exits->f = lf;
     } else {
-        left->jump[0] = t;
-        left->jump[1] = right_top;
+        jump_list_patch(lf, right_top);
+        exits->t = lt;
     }
 
-    right->expr = eval_expr(right, IR_OP_EQ, right->expr, var_int(0));
-    right->jump[0] = t;
-    right->jump[1] = f;
+    branch(right, &rt, &rf);
+    if (is_and) {
+        exits->t = rt;
+        jump_list_join(&exits->f, rf);
+    } else {
+        jump_list_join(&exits->t, rt);
+        exits->f = rf;
+    }
 
+    jump_list_patch(exits->t, t);
+    jump_list_patch(exits->f, f);
+
+    /* Result is integer type, assigned in true and false branches to numeric
+     * constant 1 or 0. */
+    r->expr = create_var(&basic_type__int);
     r->expr.lvalue = 1;
     eval_assign(t, r->expr, var_int(1));
     eval_assign(f, r->expr, var_int(0));
@@ -767,6 +889,8 @@ static struct block *eval_logical_expression(
 
     t->jump[0] = r;
     f->jump[0] = r;
+    exits->value = r->expr;
+    r->exits = exits;
     return r;
 }
 
@@ -810,6 +934,15 @@ void param(struct block *block, struct var p)
     ir_append(block, op);
 }
 
+void eval_zero(struct block *block, struct var target)
+{
+    struct op op = {IR_ZERO};
+
+    assert(target.kind == DIRECT);
+    op.a = target;
+    ir_append(block, op);
+}
+
 struct var eval__builtin_va_start(struct block *block, struct var arg)
 {
     struct op op = {IR_VA_START};
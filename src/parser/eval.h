@@ -52,6 +52,11 @@ void param(struct block *, struct var);
  */
 struct var eval_return(struct block *block, const struct typetree *type);
 
+/* Branch to t if block->expr is nonzero, and to f otherwise. The result of a
+ * logical expression is not evaluated, but branches directly to the targets.
+ */
+void eval_branch(struct block *block, struct block *t, struct block *f);
+
 /* Evaluate left->expr || right->expr, where right_top is a pointer to the top
  * of the block chain ending up with right. Returns the next block of execution.
  */
@@ -67,6 +72,10 @@ struct block *eval_logical_and(
     struct block *right_top,
     struct block *right);
 
+/* Set all bytes of target to zero.
+ */
+void eval_zero(struct block *block, struct var target);
+
 /* Evaluate va_start builtin function.
  */
 struct var eval__builtin_va_start(struct block *block, struct var arg);
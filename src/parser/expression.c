@@ -5,8 +5,11 @@
 #include "type.h"
 #include <lacc/token.h>
 #include <lacc/cli.h>
+#include <lacc/hash.h>
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define FIRST_type_qualifier \
     CONST: case VOLATILE
@@ -23,6 +26,44 @@
 
 static struct block *cast_expression(struct block *block);
 
+/* Symbols of string literals, keyed by string value.
+ */
+static struct hash_table literals;
+
+static void cleanup(void)
+{
+    hash_table_free(&literals, NULL);
+}
+
+/* Get symbol holding string literal, shared by all occurrences of the same
+ * string in the translation unit.
+ */
+static const struct symbol *string_literal(const char *str)
+{
+    struct hash_entry *entry;
+    struct symbol *sym;
+
+    if (!literals.capacity)
+        atexit(cleanup);
+
+    entry = hash_table_insert(&literals, str);
+    if (!entry->value) {
+        sym = sym_add(&ns_ident,
+            ".LC",
+            type_init(T_ARRAY, &basic_type__char, strlen(str) + 1),
+            SYM_STRING_VALUE,
+            LINK_INTERN);
+
+        /* Store string value directly on symbol, memory ownership is in
+         * string table from previously called str_register. The symbol now
+         * exists as if it was declared static char .LC[] = "...". */
+        sym->string_value = str;
+        entry->value = sym;
+    }
+
+    return entry->value;
+}
+
 /* Parse call to builtin symbol __builtin_va_start, which is the result of
  * calling va_start(arg, s). Return type depends on second input argument.
  */
@@ -37,12 +78,12 @@ static struct block *parse__builtin_va_start(struct block *block)
     block = assignment_expression(block);
     consume(',');
     param = consume(IDENTIFIER);
-    sym = sym_lookup(&ns_ident, param.strval);
+    sym = sym_lookup(&ns_ident, tokstr(param));
 
     type = &current_func()->symbol->type;
     is_invalid = !sym || sym->depth != 1 || !is_function(type);
     is_invalid = is_invalid || !nmembers(type) || strcmp(
-        get_member(type, nmembers(type) - 1)->name, param.strval);
+        get_member(type, nmembers(type) - 1)->name, tokstr(param));
 
     if (is_invalid) {
         error("Second parameter of va_start must be last function argument.");
@@ -80,9 +121,9 @@ static struct block *primary_expression(struct block *block)
 
     switch ((tok = next()).token) {
     case IDENTIFIER:
-        sym = sym_lookup(&ns_ident, tok.strval);
+        sym = sym_lookup(&ns_ident, tokstr(tok));
         if (!sym) {
-            error("Undefined symbol '%s'.", tok.strval);
+            error("Undefined symbol '%s'.", tokstr(tok));
             exit(1);
         }
         /* Special handling for builtin pseudo functions. These are expected to
@@ -98,33 +139,23 @@ static struct block *primary_expression(struct block *block)
         }
         break;
     case INTEGER_CONSTANT:
-        block->expr = var_int(tok.intval);
+        block->expr = var_int(tokval(tok));
         break;
     case '(':
         block = expression(block);
         consume(')');
         break;
     case STRING:
-        sym =
-            sym_add(&ns_ident,
-                ".LC",
-                type_init(T_ARRAY, &basic_type__char, strlen(tok.strval) + 1),
-                SYM_STRING_VALUE,
-                LINK_INTERN);
-
-        /* Store string value directly on symbol, memory ownership is in string
-         * table from previously called str_register. The symbol now exists as
-         * if it was declared static char .LC[] = "...". */
-        ((struct symbol *) sym)->string_value = tok.strval;
-
-        /* Result is an IMMEDIATE of type [] char, with a reference to the new
+        sym = string_literal(tokstr(tok));
+
+        /* Result is an IMMEDIATE of type [] char, with a reference to the
          * symbol containing the string literal. Will decay into char * on
          * evaluation. */
         block->expr = var_direct(sym);
         assert(block->expr.kind == IMMEDIATE);
         break;
     default:
-        error("Unexpected '%s', not a valid primary expression.", tok.strval);
+        error("Unexpected '%s', not a valid primary expression.", tokstr(tok));
         exit(1);
     }
 
@@ -197,10 +228,10 @@ static struct block *postfix_expression(struct block *block)
         case '.':
             consume('.');
             tok = consume(IDENTIFIER);
-            field = find_type_member(root.type, tok.strval);
+            field = find_type_member(root.type, tokstr(tok));
             if (!field) {
                 error("Invalid field access, no member named '%s'.",
-                    tok.strval);
+                    tokstr(tok));
                 exit(1);
             }
             root.type = field->type;
@@ -210,10 +241,10 @@ static struct block *postfix_expression(struct block *block)
             consume(ARROW);
             tok = consume(IDENTIFIER);
             if (is_pointer(root.type) && is_struct_or_union(root.type->next)) {
-                field = find_type_member(type_deref(root.type), tok.strval);
+                field = find_type_member(type_deref(root.type), tokstr(tok));
                 if (!field) {
                     error("Invalid field access, no member named '%s'.",
-                        tok.strval);
+                        tokstr(tok));
                     exit(1);
                 }
 
@@ -351,7 +382,7 @@ static struct block *cast_expression(struct block *block)
         tok = peekn(2);
         switch (tok.token) {
         case IDENTIFIER:
-            sym = sym_lookup(&ns_ident, tok.strval);
+            sym = sym_lookup(&ns_ident, tokstr(tok));
             if (!sym || sym->symtype != SYM_TYPEDEF)
                 break;
         case FIRST(type_name):
@@ -580,8 +611,7 @@ static struct block *conditional_expression(struct block *block)
             *next = cfg_block_init();
 
         consume('?');
-        block->jump[0] = f;
-        block->jump[1] = t;
+        eval_branch(block, t, f);
 
         t = expression(t);
         t->jump[0] = next;
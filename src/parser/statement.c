@@ -30,12 +30,29 @@ static struct block
     *break_target,
     *continue_target;
 
-/* Keep track of nested switch statements and their case labels.
+/* Switch statements are dispatched through a jump table for ranges of at
+ * least this many cases, where the span of values is no more than a factor
+ * larger than the number of cases. Values without a case label in range jump
+ * to default.
+ */
+#define JUMP_TABLE_MIN_CASES 4
+#define JUMP_TABLE_MAX_SPAN 3
+
+/* Cases that are not dense enough for a jump table are split in half by a
+ * binary decision tree, and compared one by one when only a few remain.
+ */
+#define LINEAR_SEARCH_MAX_CASES 3
+
+/* Keep track of nested switch statements and their case labels. Case values
+ * are converted to the promoted type of the controlling expression.
  */
 static struct switch_context {
+    const struct typetree *type;
     struct block *default_label;
-    struct block **case_label;
-    struct var *case_value;
+    struct switch_case {
+        struct block *label;
+        struct var value;
+    } *cases;
     int n;
 } *switch_ctx;
 
@@ -43,63 +60,143 @@ static void add_switch_case(struct block *label, struct var value)
 {
     struct switch_context *ctx = switch_ctx;
 
-    ctx->n++;
-    ctx->case_label =
-        realloc(ctx->case_label, ctx->n * sizeof(*ctx->case_label));
-    ctx->case_value =
-        realloc(ctx->case_value, ctx->n * sizeof(*ctx->case_value));
+    if (!is_integer(value.type)) {
+        error("Case label must be an integer constant.");
+        return;
+    }
 
-    ctx->case_label[ctx->n - 1] = label;
-    ctx->case_value[ctx->n - 1] = value;
+    /* Truncate to width of controlling expression. */
+    value.type = ctx->type;
+    if (size_of(value.type) == 4) {
+        if (is_unsigned(value.type))
+            value.imm.u = (unsigned int) value.imm.u;
+        else
+            value.imm.i = (int) value.imm.i;
+    }
+
+    ctx->n++;
+    ctx->cases = realloc(ctx->cases, ctx->n * sizeof(*ctx->cases));
+    ctx->cases[ctx->n - 1].label = label;
+    ctx->cases[ctx->n - 1].value = value;
 }
 
 static void free_switch_context(struct switch_context *ctx)
 {
     assert(ctx);
-    if (ctx->n) {
-        free(ctx->case_label);
-        free(ctx->case_value);
-    }
+    if (ctx->n)
+        free(ctx->cases);
     free(ctx);
 }
 
-static int is_immediate_true(struct var e)
+static int compare_case(const void *a, const void *b)
 {
-    return e.kind == IMMEDIATE && is_integer(e.type) && e.imm.i;
+    const struct var
+        *l = &((const struct switch_case *) a)->value,
+        *r = &((const struct switch_case *) b)->value;
+
+    if (is_unsigned(l->type))
+        return (l->imm.u > r->imm.u) - (l->imm.u < r->imm.u);
+
+    return (l->imm.i > r->imm.i) - (l->imm.i < r->imm.i);
 }
 
-static int is_immediate_false(struct var e)
+/* Difference between largest and smallest value of sorted cases.
+ */
+static unsigned long case_range(const struct switch_case *cases, int n)
+{
+    return cases[n - 1].value.imm.u - cases[0].value.imm.u;
+}
+
+/* Create jump table indexed by expr minus the smallest case value. Values out
+ * of range, including negative differences, go to default.
+ */
+static struct block *switch_table(
+    struct var expr,
+    const struct switch_case *cases,
+    int n,
+    struct block *default_label)
 {
-    return e.kind == IMMEDIATE && is_integer(e.type) && !e.imm.i;
+    int i;
+    struct block *block = cfg_block_init();
+
+    block->expr = eval_expr(block, IR_OP_SUB, expr, cases[0].value);
+    block->jump[0] = default_label;
+    block->n_table = case_range(cases, n) + 1;
+    block->table =
+        arena_alloc(cfg_arena(), block->n_table * sizeof(*block->table));
+    for (i = 0; i < block->n_table; ++i)
+        block->table[i] = default_label;
+
+    for (i = 0; i < n; ++i)
+        block->table[cases[i].value.imm.u - cases[0].value.imm.u] =
+            cases[i].label;
+
+    return block;
+}
+
+/* Create blocks dispatching expr to sorted list of case labels, returning the
+ * first block to evaluate.
+ */
+static struct block *switch_dispatch(
+    struct var expr,
+    const struct switch_case *cases,
+    int n,
+    struct block *default_label)
+{
+    int i, m;
+    struct block *cond, *next;
+
+    if (n >= JUMP_TABLE_MIN_CASES
+        && case_range(cases, n) < (unsigned long) JUMP_TABLE_MAX_SPAN * n)
+    {
+        return switch_table(expr, cases, n, default_label);
+    }
+
+    if (n <= LINEAR_SEARCH_MAX_CASES) {
+        next = default_label;
+        for (i = n - 1; i >= 0; --i) {
+            cond = cfg_block_init();
+            cond->expr = eval_expr(cond, IR_OP_EQ, cases[i].value, expr);
+            cond->jump[0] = next;
+            cond->jump[1] = cases[i].label;
+            next = cond;
+        }
+        return next;
+    }
+
+    m = n / 2;
+    cond = cfg_block_init();
+    cond->expr = eval_expr(cond, IR_OP_GE, expr, cases[m].value);
+    cond->jump[0] = switch_dispatch(expr, cases, m, default_label);
+    cond->jump[1] = switch_dispatch(expr, cases + m, n - m, default_label);
+    return cond;
 }
 
+/* Branch targets are set after parsing the statements, when it is known if
+ * there is an else clause.
+ */
 static struct block *if_statement(struct block *parent)
 {
     struct block
-        *right = cfg_block_init(),
+        *top = cfg_block_init(),
+        *right,
         *next  = cfg_block_init();
 
     consume(IF);
     consume('(');
     parent = expression(parent);
     consume(')');
-    if (is_immediate_true(parent->expr)) {
-        parent->jump[0] = right;
-    } else if (is_immediate_false(parent->expr)) {
-        parent->jump[0] = next;
-    } else {
-        parent->jump[0] = next;
-        parent->jump[1] = right;
-    }
 
-    right = statement(right);
+    right = statement(top);
     right->jump[0] = next;
     if (peek().token == ELSE) {
         struct block *left = cfg_block_init();
         consume(ELSE);
-        parent->jump[0] = left;
+        eval_branch(parent, top, left);
         left = statement(left);
         left->jump[0] = next;
+    } else {
+        eval_branch(parent, top, next);
     }
 
     return next;
@@ -129,14 +226,7 @@ static struct block *do_statement(struct block *parent)
     consume('(');
     tail = expression(cond);
     consume(')');
-    if (is_immediate_true(tail->expr)) {
-        tail->jump[0] = top;
-    } else if (is_immediate_false(tail->expr)) {
-        tail->jump[0] = next;
-    } else {
-        tail->jump[0] = next;
-        tail->jump[1] = top;
-    }
+    eval_branch(tail, top, next);
 
     restore_break_target(old_break_target);
     restore_continue_target(old_continue_target);
@@ -163,14 +253,7 @@ static struct block *while_statement(struct block *parent)
     consume('(');
     cond = expression(top);
     consume(')');
-    if (is_immediate_true(cond->expr)) {
-        cond->jump[0] = body;
-    } else if (is_immediate_false(cond->expr)) {
-        cond->jump[0] = next;
-    } else {
-        cond->jump[0] = next;
-        cond->jump[1] = body;
-    }
+    eval_branch(cond, body, next);
 
     body = statement(body);
     body->jump[0] = top;
@@ -205,14 +288,7 @@ static struct block *for_statement(struct block *parent)
     if (peek().token != ';') {
         parent->jump[0] = top;
         top = expression(top);
-        if (is_immediate_true(top->expr)) {
-            top->jump[0] = body;
-        } else if (is_immediate_false(top->expr)) {
-            top->jump[0] = next;
-        } else {
-            top->jump[0] = next;
-            top->jump[1] = body;
-        }
+        eval_branch(top, body, next);
         top = (struct block *) parent->jump[0];
     } else {
         /* Infinite loop */
@@ -243,6 +319,7 @@ static struct block *switch_statement(struct block *parent)
 
     struct switch_context *old_switch_ctx;
     struct block *old_break_target;
+    struct var expr;
 
     set_break_target(old_break_target, next);
     old_switch_ctx = switch_ctx;
@@ -252,6 +329,14 @@ static struct block *switch_statement(struct block *parent)
     consume('(');
     parent = expression(parent);
     consume(')');
+    if (!is_integer(parent->expr.type)) {
+        error("Switch expression must have integer type, was %t.",
+            parent->expr.type);
+        exit(1);
+    }
+
+    switch_ctx->type = promote_integer(parent->expr.type);
+    expr = eval_cast(parent, parent->expr, switch_ctx->type);
     last = statement(body);
     last->jump[0] = next;
 
@@ -259,21 +344,18 @@ static struct block *switch_statement(struct block *parent)
         parent->jump[0] = next;
     } else {
         int i;
-        struct block *cond = parent;
-
-        for (i = 0; i < switch_ctx->n; ++i) {
-            struct block *prev_cond = cond;
-            struct block *label = switch_ctx->case_label[i];
-            struct var value = switch_ctx->case_value[i];
-
-            cond = cfg_block_init();
-            cond->expr = eval_expr(cond, IR_OP_EQ, value, parent->expr);
-            cond->jump[1] = label;
-            prev_cond->jump[0] = cond;
+        struct switch_case *cases = switch_ctx->cases;
+
+        qsort(cases, switch_ctx->n, sizeof(*cases), compare_case);
+        for (i = 1; i < switch_ctx->n; ++i) {
+            if (!compare_case(&cases[i - 1], &cases[i])) {
+                error("Duplicate case value %ld in switch statement.",
+                    cases[i].value.imm.i);
+            }
         }
 
-        cond->jump[0] = (switch_ctx->default_label) ?
-            switch_ctx->default_label : next;
+        parent->jump[0] = switch_dispatch(expr, cases, switch_ctx->n,
+            (switch_ctx->default_label) ? switch_ctx->default_label : next);
     }
 
     free_switch_context(switch_ctx);
@@ -365,7 +447,7 @@ struct block *statement(struct block *parent)
         }
         break;
     case IDENTIFIER:
-        sym = sym_lookup(&ns_ident, tok.strval);
+        sym = sym_lookup(&ns_ident, tokstr(tok));
         if (sym && sym->symtype == SYM_TYPEDEF) {
             parent = declaration(parent);
             break;
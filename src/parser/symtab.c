@@ -4,8 +4,9 @@
 #endif
 #include "symtab.h"
 #include "type.h"
+#include <lacc/arena.h>
 #include <lacc/cli.h>
-#include <lacc/hash.h>
+#include <lacc/strtab.h>
 
 #include <assert.h>
 #include <stdio.h>
@@ -20,65 +21,71 @@ struct namespace
 const struct symbol
     *decl_memcpy = NULL;
 
-/* Initialize hash table with initial size heuristic based on scope depth.
- * As a special case, depth 1 containing function arguments is assumed to
- * contain fewer symbols.
+/* Symbols local to functions, which are not needed after the function is
+ * compiled. Peak memory is then bounded by the largest function, rather than
+ * the size of the translation unit.
  */
-static size_t hash_cap[] = {256, 16, 128, 64, 32, 16};
-static size_t hash_cap_default = 8;
+static struct arena *local_symbols;
+
+/* Initial hash table size, used for all scopes except translation unit. Tables
+ * grow as needed, and most block scopes declare only a few symbols.
+ */
+#define SCOPE_INITIAL_CAPACITY 16
+#define SCOPE_FILE_CAPACITY 1024
 
 void push_scope(struct namespace *ns)
 {
     struct scope *scope;
 
     ns->current_depth = (ns->scope) ? ns->current_depth + 1 : 0;
-    ns->scope = realloc(ns->scope, sizeof(*ns->scope)*(ns->current_depth + 1));
+    if (ns->current_depth == ns->scope_capacity) {
+        ns->scope_capacity = (ns->scope_capacity) ? ns->scope_capacity * 2 : 8;
+        ns->scope =
+            realloc(ns->scope, sizeof(*ns->scope) * ns->scope_capacity);
+        memset(ns->scope + ns->current_depth, 0,
+            sizeof(*ns->scope) * (ns->scope_capacity - ns->current_depth));
+    }
 
     scope = &ns->scope[ns->current_depth];
-    scope->hash_length = hash_cap_default;
-    if (ns->current_depth < sizeof(hash_cap) / sizeof(hash_cap[0]))
-        scope->hash_length = hash_cap[ns->current_depth];
-
-    scope->hash_tab = calloc(scope->hash_length, sizeof(*scope->hash_tab));
-}
-
-static void ref_list_free(struct sym_ref *ref)
-{
-    if (ref->next)
-        ref_list_free(ref->next);
-    free(ref);
+    assert(!scope->count);
 }
 
 void pop_scope(struct namespace *ns)
 {
-    size_t i;
+    int i;
     struct scope *scope;
 
     assert(ns->current_depth >= 0);
     scope = &ns->scope[ns->current_depth];
-    for (i = 0; i < scope->hash_length; ++i)
-        if (scope->hash_tab[i].next)
-            ref_list_free(scope->hash_tab[i].next);
+    if (scope->count) {
+        memset(scope->table, 0, sizeof(*scope->table) * scope->capacity);
+        scope->count = 0;
+    }
 
-    free(scope->hash_tab);
     ns->current_depth--;
 
     /* Popping last scope frees the whole symbol table. This only happens once,
      * after reaching the end of the translation unit. */
     if (ns->current_depth == -1) {
+        for (i = 0; i < ns->scope_capacity; ++i)
+            free(ns->scope[i].table);
         free(ns->scope);
+        ns->scope = NULL;
+        ns->scope_capacity = 0;
         if (ns->symbol) {
             for (i = 0; i < ns->length; ++i)
                 free(ns->symbol[i]);
             free(ns->symbol);
         }
+        if (ns == &ns_ident)
+            sym_release_locals();
     }
 }
 
 /* Create and add symbol to symbol table, but not to any scope. Symbol address
  * needs to be stable, so they are stored as a realloc-safe list of pointers.
  */
-static size_t create_symbol(struct namespace *ns, struct symbol arg)
+static struct symbol *create_symbol(struct namespace *ns, struct symbol arg)
 {
     struct symbol *sym;
 
@@ -90,9 +97,63 @@ static size_t create_symbol(struct namespace *ns, struct symbol arg)
 
     sym = calloc(1, sizeof(*sym));
     *sym = arg;
-    ns->symbol[ns->length] = sym;
+    ns->symbol[ns->length++] = sym;
+    return sym;
+}
+
+/* Create symbol local to a function, owned by the pool of local symbols and
+ * not added to any namespace list.
+ */
+static struct symbol *create_local_symbol(
+    struct namespace *ns,
+    struct symbol arg)
+{
+    struct symbol *sym;
+
+    if (!local_symbols) {
+        local_symbols = arena_init();
+    }
+
+    arg.depth = ns->current_depth;
+    sym = arena_alloc(local_symbols, sizeof(*sym));
+    *sym = arg;
+    return sym;
+}
 
-    return ns->length++;
+void sym_release_locals(void)
+{
+    if (local_symbols) {
+        arena_free(local_symbols);
+        local_symbols = NULL;
+    }
+}
+
+static void scope_insert(struct scope *scope, struct symbol *sym)
+{
+    size_t i, mask;
+
+    mask = scope->capacity - 1;
+    i = str_hash(sym->name) & mask;
+    while (scope->table[i])
+        i = (i + 1) & mask;
+
+    scope->table[i] = sym;
+}
+
+static void scope_grow(struct scope *scope, size_t capacity)
+{
+    size_t i, prev_cap;
+    struct symbol **prev;
+
+    prev = scope->table;
+    prev_cap = scope->capacity;
+    scope->table = calloc(capacity, sizeof(*scope->table));
+    scope->capacity = capacity;
+    for (i = 0; i < prev_cap; ++i)
+        if (prev[i])
+            scope_insert(scope, prev[i]);
+
+    free(prev);
 }
 
 /* Add symbol to current scope hash table, making it possible to look up.
@@ -100,36 +161,23 @@ static size_t create_symbol(struct namespace *ns, struct symbol arg)
  * Here we don't need to care about collisions; adding a symbol to scope will
  * always create a new entry in the hash table.
  */
-static struct symbol *register_in_scope(struct namespace *ns, size_t index)
+static struct symbol *register_in_scope(
+    struct namespace *ns,
+    struct symbol *sym)
 {
     struct scope *scope;
-    struct symbol *sym;
-    struct sym_ref *ref;
-    size_t pos;
-    unsigned long hash;
-
-    assert(index < ns->length);
 
     scope = &ns->scope[ns->current_depth];
-    sym = ns->symbol[index];
-    hash = djb2_hash(sym->name);
-    pos = hash % scope->hash_length;
-    ref = &scope->hash_tab[pos];
-
-    /* If direct slot is not available, allocate a new sym_ref structure and
-     * hook it up last in the chain. */
-    if (ref->index) {
-        while (ref->next)
-            ref = ref->next;
-        ref->next = calloc(1, sizeof(*ref));
-        ref = ref->next;
+    if (!scope->capacity) {
+        scope_grow(scope, (ns->current_depth)
+            ? SCOPE_INITIAL_CAPACITY
+            : SCOPE_FILE_CAPACITY);
+    } else if (2 * (scope->count + 1) > scope->capacity) {
+        scope_grow(scope, scope->capacity * 2);
     }
 
-    assert(!ref->index);
-    assert(!ref->next);
-
-    ref->index = index + 1;
-    ref->hash = hash;
+    scope_insert(scope, sym);
+    scope->count++;
     return sym;
 }
 
@@ -137,28 +185,24 @@ struct symbol *sym_lookup(struct namespace *ns, const char *name)
 {
     struct scope *scope;
     struct symbol *sym;
-    struct sym_ref *ref;
-    size_t pos;
+    size_t i, mask;
     int depth;
-    unsigned long hash;
+    unsigned hash;
 
     depth = ns->current_depth;
-    hash = djb2_hash(name);
+    hash = str_hash(name);
 
     do {
         scope = &ns->scope[depth];
-        pos = hash % scope->hash_length;
-        ref = &scope->hash_tab[pos];
-
-        /* Move ref until both hash value and symbol name matches, or we reach
-         * end of list. */
-        while (ref && ref->index) {
-            if (ref->hash == hash) {
-                sym = ns->symbol[ref->index - 1];
-                if (!strcmp(name, sym->name))
-                    return sym;
-            }
-            ref = ref->next;
+        if (!scope->count)
+            continue;
+
+        mask = scope->capacity - 1;
+        i = hash & mask;
+        while ((sym = scope->table[i]) != NULL) {
+            if (sym->name == name)
+                return sym;
+            i = (i + 1) & mask;
         }
     } while (depth--);
 
@@ -241,6 +285,7 @@ struct symbol *sym_add(
 
     assert(symtype != SYM_LABEL);
 
+    name = str_register(name);
     if (symtype != SYM_STRING_VALUE && (sym = sym_lookup(ns, name))) {
         if (linkage == LINK_EXTERN && symtype == SYM_DECLARATION
             && (sym->symtype == SYM_TENTATIVE
@@ -293,7 +338,22 @@ struct symbol *sym_add(
         arg.n = ++counter;
     }
 
-    sym = register_in_scope(ns, create_symbol(ns, arg));
+    /* Local variables are not referenced after the function is compiled, and
+     * can be released together with temporaries. Type definitions are kept, as
+     * static variables can have types that refer to them. */
+    if (ns == &ns_ident && ns->current_depth && linkage == LINK_NONE
+        && symtype != SYM_TYPEDEF)
+    {
+        sym = create_local_symbol(ns, arg);
+    } else {
+        sym = create_symbol(ns, arg);
+    }
+
+    /* Names starting with '.', like '.LC' for string literals, can never be
+     * looked up, and are not registered in any scope. */
+    if (name[0] != '.')
+        sym = register_in_scope(ns, sym);
+
     verbose(
         "\t[type: %s, link: %s]\n"
         "\t%s :: %t",
@@ -316,7 +376,6 @@ struct symbol *sym_create_tmp(const struct typetree *type)
      * by setting the counter instead of creating a string. */
     static int n;
 
-    int i;
     struct symbol sym = {0};
 
     sym.symtype = SYM_DEFINITION;
@@ -325,27 +384,26 @@ struct symbol *sym_create_tmp(const struct typetree *type)
     sym.n = ++n;
     sym.type = *type;
 
-    /* Add temporary to normal identifier namespace, but do not make it
-     * searchable through any scope. */
-    i = create_symbol(&ns_ident, sym);
-    return ns_ident.symbol[i];
+    /* Add temporary to pool of local symbols, but do not make it searchable
+     * through any scope. */
+    return create_local_symbol(&ns_ident, sym);
 }
 
 struct symbol *sym_create_label(void)
 {
-    int i;
+    static int n;
+
     struct symbol sym = {0};
 
     sym.type = basic_type__void;
     sym.symtype = SYM_LABEL;
     sym.linkage = LINK_INTERN;
     sym.name = ".L";
-    sym.n = ns_label.length + 1;
+    sym.n = ++n;
 
-    /* Construct symbol in label namespace, but do not add it to any scope.
-     * No need or use for searching in labels. */
-    i = create_symbol(&ns_label, sym);
-    return ns_label.symbol[i];
+    /* Construct symbol in pool of local symbols, but do not add it to any
+     * scope. No need or use for searching in labels. */
+    return create_local_symbol(&ns_label, sym);
 }
 
 void register_builtin_types(struct namespace *ns)
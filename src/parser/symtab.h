@@ -13,15 +13,19 @@ struct namespace {
      * anonymous. */
     const char *name;
 
-    /* All symbols, regardless of scope, are stored in the same list. Pointers
-     * must not be affected by reallocation, so store list of pointers. */
+    /* Symbols that can be referenced after the function they are declared in
+     * is compiled are stored in the same list, regardless of scope. Pointers
+     * must not be affected by reallocation, so store list of pointers. Local
+     * variables, temporaries and labels are instead kept in a separate pool,
+     * released between top level declarations. */
     struct symbol **symbol;
     size_t length;
     size_t capacity;
 
-    /* Hold a list of symbols per depth, optimizing lookup. Store indices into
-     * list of symbols. */
+    /* Hold a table of symbols per depth, optimizing lookup. Scopes are kept
+     * allocated when popped, and reused when pushed again. */
     struct scope *scope;
+    int scope_capacity;
 
     /* Current depth, and number of scopes. Depth 0 is translation unit, 1 is 
      * function arguments, and n is local or member variables. */
@@ -29,18 +33,15 @@ struct namespace {
 };
 
 struct scope {
-    /* Each scope maintains a hash table of indices into the global symbol
-     * list. Index 0 is used as sentinel value meaning empty. */
-    struct sym_ref {
-        size_t index;
-        unsigned long hash;
-        struct sym_ref *next;
-    } *hash_tab;
-
-    /* The size of the hash table is determined dynamically, based on the
-     * scope depth. More nested scopes are generally assumed to contain fewer
-     * symbols. */
-    size_t hash_length;
+    /* Each scope maintains a hash table of symbols, which can be either in the
+     * list of the namespace or local to a function. Names are interned, and
+     * compared by address. Open addressing with linear probing, where empty
+     * slots are NULL. Allocated on first symbol added to the scope. */
+    struct symbol **table;
+
+    /* Capacity is a power of two, doubled when more than half full. */
+    size_t count;
+    size_t capacity;
 };
 
 extern struct namespace
@@ -52,7 +53,7 @@ void push_scope(struct namespace *ns);
 void pop_scope(struct namespace *ns);
 
 /* Retrieve a symbol based on identifier name, or NULL of not registered or
- * visible from current scope.
+ * visible from current scope. Name must be registered in string table.
  */
 struct symbol *sym_lookup(struct namespace *ns, const char *name);
 
@@ -71,6 +72,11 @@ struct symbol *sym_add(
  */
 struct symbol *sym_create_tmp(const struct typetree *type);
 
+/* Free local variables, temporaries and labels of functions. Must not be called
+ * until all definitions referencing them are compiled.
+ */
+void sym_release_locals(void);
+
 /* Register compiler internal builtin symbols, that are assumed to exists by
  * standard library headers.
  */
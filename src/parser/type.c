@@ -41,6 +41,16 @@ static size_t cap;
 static struct member_list **mem_list_registry;
 static size_t mem_length, mem_cap;
 
+/* Hash set of interned types, with open addressing. Types are equal if all
+ * fields are equal, comparing pointers to member lists and next types without
+ * looking at their contents.
+ */
+static struct {
+    const struct typetree **slot;
+    size_t count;
+    size_t cap;
+} interned;
+
 static void cleanup(void)
 {
     size_t i = 0;
@@ -68,6 +78,9 @@ static void cleanup(void)
         mem_length = 0;
         mem_cap = 0;
     }
+
+    free(interned.slot);
+    memset(&interned, 0, sizeof(interned));
 }
 
 static struct typetree *calloc_type(void)
@@ -84,6 +97,65 @@ static struct typetree *calloc_type(void)
     return type_registry[length++];
 }
 
+static unsigned long type_hash(const struct typetree *type)
+{
+    unsigned long h;
+
+    h = (unsigned long) type->next;
+    h = h * 31 + (unsigned long) type->member_list;
+    h = h * 31 + (unsigned long) type->tag_name;
+    h = h * 31 + type->size;
+    h = h * 31 + type->type * 4 + type->qualifier;
+    return h ^ (h >> 16);
+}
+
+static int type_identical(const struct typetree *a, const struct typetree *b)
+{
+    return a->type == b->type
+        && a->size == b->size
+        && a->qualifier == b->qualifier
+        && a->member_list == b->member_list
+        && a->next == b->next
+        && a->tag_name == b->tag_name;
+}
+
+/* Return shared instance of type with the same fields as the one given,
+ * creating it if it does not exist. Interned types must never be modified.
+ */
+static const struct typetree *type_intern(const struct typetree *type)
+{
+    size_t i, j, cap;
+    const struct typetree **slot, *t;
+
+    if (interned.count * 2 >= interned.cap) {
+        cap = (interned.cap) ? interned.cap * 2 : 256;
+        slot = calloc(cap, sizeof(*slot));
+        for (i = 0; i < interned.cap; ++i) {
+            if ((t = interned.slot[i]) != NULL) {
+                j = type_hash(t) & (cap - 1);
+                while (slot[j])
+                    j = (j + 1) & (cap - 1);
+                slot[j] = t;
+            }
+        }
+        free(interned.slot);
+        interned.slot = slot;
+        interned.cap = cap;
+    }
+
+    i = type_hash(type) & (interned.cap - 1);
+    while ((t = interned.slot[i]) != NULL) {
+        if (type_identical(t, type))
+            return t;
+        i = (i + 1) & (interned.cap - 1);
+    }
+
+    interned.slot[i] = t = calloc_type();
+    *((struct typetree *) t) = *type;
+    interned.count++;
+    return t;
+}
+
 static struct member_list *allocmembers(void)
 {
     if (!length && !mem_length)
@@ -226,19 +298,29 @@ int is_vararg(const struct typetree *type)
 
 struct typetree *type_init(enum type tt, ...)
 {
-    struct typetree *type;
+    struct typetree *type, derived = {0};
     va_list args;
     va_start(args, tt);
 
-    type = calloc_type();
-    type->type = tt;
     if (tt == T_POINTER || tt == T_ARRAY) {
-        type->next = va_arg(args, const struct typetree *);
-        type->size = 8;
+        derived.type = tt;
+        derived.next = va_arg(args, const struct typetree *);
+        derived.size = 8;
         if (tt == T_ARRAY) {
-            type->size = size_of(type->next) * va_arg(args, int);
+            derived.size = size_of(derived.next) * va_arg(args, int);
+        }
+        va_end(args);
+        if (!derived.next) {
+            type = calloc_type();
+            *type = derived;
+            return type;
         }
-    } else if (tt == T_UNSIGNED || tt == T_SIGNED) {
+        return (struct typetree *) type_intern(&derived);
+    }
+
+    type = calloc_type();
+    type->type = tt;
+    if (tt == T_UNSIGNED || tt == T_SIGNED) {
         type->size = va_arg(args, int);
         assert(
             type->size == 8 || type->size == 4 ||
@@ -256,16 +338,15 @@ const struct typetree *unwrapped(const struct typetree *type)
 
 struct typetree *type_tagged_copy(const struct typetree *type, const char *name)
 {
-    struct typetree *tag;
+    struct typetree tag = {0};
 
     assert(!is_tagged(type));
     assert(is_struct_or_union(type));
 
-    tag = calloc_type();
-    tag->type = type->type;
-    tag->tag_name = name;
-    tag->next = type;
-    return tag;
+    tag.type = type->type;
+    tag.tag_name = name;
+    tag.next = type;
+    return (struct typetree *) type_intern(&tag);
 }
 
 /* Determine whether two types are the same. Disregarding qualifiers, and names
@@ -273,7 +354,7 @@ struct typetree *type_tagged_copy(const struct typetree *type, const char *name)
  */
 int type_equal(const struct typetree *a, const struct typetree *b)
 {
-    if (!a && !b) return 1;
+    if (a == b) return 1;
     if (!a || !b) return 0;
     if (is_tagged(a) && is_tagged(b))
         return a->next == b->next;
@@ -305,15 +386,21 @@ int type_equal(const struct typetree *a, const struct typetree *b)
     return 0;
 }
 
+const struct typetree *type_qualified(
+    const struct typetree *type,
+    enum qualifier qualifier)
+{
+    struct typetree copy = *type;
+
+    copy.qualifier = qualifier;
+    return type_intern(&copy);
+}
+
 static const struct typetree *remove_qualifiers(const struct typetree *type)
 {
     if (type->qualifier) {
-        struct typetree *copy = calloc_type();
         assert(!nmembers(type));
-
-        *copy = *type;
-        copy->qualifier = 0;
-        type = copy;
+        type = type_qualified(type, Q_NONE);
     }
 
     return type;
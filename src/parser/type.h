@@ -29,11 +29,22 @@ const struct member *find_type_member(
  *      type_init(T_SIGNED, [size])
  *      type_init(T_POINTER, [next])
  *      type_init(T_ARRAY, [next], [count])
+ *
+ * Pointer and array types are interned, returning the same instance each time
+ * for the same next type and size. These must not be modified. A new instance
+ * is only created if next is NULL, to be filled in later.
  */
 struct typetree *type_init(enum type tt, ...);
 
+/* Get interned instance of type with the given qualifiers, and otherwise the
+ * same fields. The result must not be modified.
+ */
+const struct typetree *type_qualified(
+    const struct typetree *type,
+    enum qualifier qualifier);
+
 /* Create a tag type pointing to the provided object. Input type must be of
- * struct or union type.
+ * struct or union type. Tag types are interned, and must not be modified.
  *
  * Usage of this is to avoid circular typetree graphs, and to let tagged types
  * be cv-qualified without mutating the original definition.
@@ -3,14 +3,19 @@
 #  define _XOPEN_SOURCE 700 /* strndup */
 #endif
 #include "input.h"
-#include "strtab.h"
+#include "macro.h"
+#include <lacc/strtab.h>
 #include <lacc/cli.h>
+#include <lacc/hash.h>
 
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 /* Globally exposed for diagnostics info and default macro values.
@@ -29,18 +34,156 @@ static size_t search_path_count;
 static char *inc_path;
 static size_t inc_path_len;
 
-/* Scratchpad buffer for assembling lines to return. The same buffer is
- * resized if needed, enforcing no specific limit on how long a line can be.
- */
-static char *input_line;
-static size_t input_line_len;
-
 /* Keep stack of file descriptors as resolved by includes. Push and pop from
  * the end of the list.
  */
 static struct source *src_stack;
 static size_t src_count;
 
+/* Files found to be wrapped in an include guard, by path.
+ */
+static struct guard {
+    const char *path;
+    const char *macro;
+} *guards;
+static size_t guard_count;
+
+/* Files marked with #pragma once, by device and inode.
+ */
+static struct once {
+    dev_t dev;
+    ino_t ino;
+} *once;
+static size_t once_count;
+
+/* Resolved path of include directives, or NULL if the file was not found. Key
+ * is '<' followed by name for system includes, or '"' followed by the path
+ * relative to the including file.
+ */
+static struct hash_table resolved;
+
+/* Listing of each directory probed for include files, with all entry names.
+ * Reading a directory once is cheaper than trying to open files that do not
+ * exist in each directory on the search path.
+ */
+static struct hash_table directories;
+
+static void free_directory(void *listing)
+{
+    hash_table_free(listing, NULL);
+    free(listing);
+}
+
+/* Get listing of directory, reading it on first use. Return NULL if the
+ * directory can not be opened.
+ */
+static struct hash_table *directory_listing(const char *path)
+{
+    struct hash_entry *entry;
+    struct hash_table *listing = NULL;
+    struct dirent *ent;
+    DIR *dir;
+
+    entry = hash_table_lookup(&directories, path);
+    if (entry) {
+        return entry->value;
+    }
+
+    dir = opendir(path);
+    if (dir) {
+        listing = calloc(1, sizeof(*listing));
+        while ((ent = readdir(dir)) != NULL) {
+            hash_table_insert(listing, ent->d_name);
+        }
+        closedir(dir);
+    }
+
+    hash_table_insert(&directories, path)->value = listing;
+    return listing;
+}
+
+/* Determine if file exists by looking up the name in a listing of the
+ * directory it is in. Path is temporarily modified to split directory and file
+ * name. Names found are checked to be regular files, as the listing also
+ * includes directories and broken links.
+ */
+static int file_exists(char *path)
+{
+    char *sep;
+    const char *name;
+    struct hash_table *listing;
+    struct stat st;
+
+    sep = strrchr(path, '/');
+    if (!sep) {
+        name = path;
+        listing = directory_listing(".");
+    } else if (sep == path) {
+        name = path + 1;
+        listing = directory_listing("/");
+    } else {
+        name = sep + 1;
+        *sep = '\0';
+        listing = directory_listing(path);
+        *sep = '/';
+    }
+
+    if (!listing || !hash_table_lookup(listing, name)) {
+        return 0;
+    }
+
+    return !stat(path, &st) && S_ISREG(st.st_mode);
+}
+
+static void add_guard(const char *path, const char *macro)
+{
+    int i;
+
+    for (i = 0; i < guard_count; ++i) {
+        if (!strcmp(guards[i].path, path)) {
+            guards[i].macro = macro;
+            return;
+        }
+    }
+
+    guard_count++;
+    guards = realloc(guards, guard_count * sizeof(*guards));
+    guards[guard_count - 1].path = path;
+    guards[guard_count - 1].macro = macro;
+}
+
+/* Determine if file at path does not need to be included again, either
+ * because its include guard is defined, or it is marked with #pragma once.
+ */
+static int is_skipped(const char *path)
+{
+    int i;
+    struct stat st;
+    struct token t = {IDENTIFIER};
+
+    for (i = 0; i < guard_count; ++i) {
+        if (!strcmp(guards[i].path, path)) {
+            t.str = str_index(guards[i].macro, str_len(guards[i].macro));
+            if (definition(t)) {
+                verbose("Skipping %s, guarded by %s.", path, tokstr(t));
+                return 1;
+            }
+            break;
+        }
+    }
+
+    if (once_count && !stat(path, &st)) {
+        for (i = 0; i < once_count; ++i) {
+            if (once[i].dev == st.st_dev && once[i].ino == st.st_ino) {
+                verbose("Skipping %s, marked with #pragma once.", path);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
 static struct source push(struct source source)
 {
     src_count++;
@@ -53,9 +196,10 @@ static int pop(void)
 {
     if (src_count) {
         struct source *source = &src_stack[--src_count];
-        if (source->file != stdin) {
-            fclose(source->file);
+        if (source->guard_state == GUARD_CLOSED) {
+            add_guard(source->path, source->guard);
         }
+        free(source->buffer);
         memset(source, 0, sizeof(*source));
         if (src_count) {
             current_file = src_stack[src_count - 1];
@@ -73,6 +217,10 @@ static void finalize(void)
         ;
 
     free(src_stack);
+    free(guards);
+    free(once);
+    hash_table_free(&resolved, NULL);
+    hash_table_free(&directories, free_directory);
 
     if (search_path) {
         free(search_path);
@@ -85,85 +233,265 @@ static void finalize(void)
         inc_path = NULL;
         inc_path_len = 0;
     }
+}
+
+/* Read all of file into memory, with a null byte following the last
+ * character. The buffer is written to when cleaning lines, and must be
+ * writable.
+ */
+static int load(struct source *source, int fd)
+{
+    struct stat st;
+    size_t size = 0, cap = 4096;
+    ssize_t n;
+    int regular;
+
+    if (fstat(fd, &st) == 0) {
+        source->dev = st.st_dev;
+        source->ino = st.st_ino;
+        regular = S_ISREG(st.st_mode);
+    } else {
+        regular = 0;
+    }
+
+    if (regular) {
+        cap = st.st_size + 1;
+    }
+
+    source->buffer = malloc(cap);
+    do {
+        if (size + 1 == cap) {
+            cap *= 2;
+            source->buffer = realloc(source->buffer, cap);
+        }
+        n = read(fd, source->buffer + size, cap - size - 1);
+        if (n > 0) {
+            size += n;
+        }
+    } while (n > 0 && !(regular && size == st.st_size));
 
-    if (input_line) {
-        free(input_line);
-        input_line = NULL;
-        input_line_len = 0;
+    if (n < 0) {
+        free(source->buffer);
+        source->buffer = NULL;
+        return 1;
     }
+
+    source->buffer[size] = '\0';
+    source->pos = source->buffer;
+    source->end = source->buffer + size;
+    return 0;
 }
 
-void include_file(const char *name)
+/* Open and read file at path. Return non-zero on failure.
+ */
+static int open_source(struct source *source, const char *path)
 {
-    struct source source = {0};
+    int fd, err;
 
-    /* Construct path by combining current directory and include name, which
-     * itself can include folders. */
-    if (current_file.dirlen) {
-        int length = current_file.dirlen + strlen(name) + 1;
-        char *path = calloc(length + 1, sizeof(*path));
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 1;
+    }
 
-        strncpy(path, current_file.path, current_file.dirlen);
-        path[current_file.dirlen] = '/';
-        strcpy(path + current_file.dirlen + 1, name);
-        source.path = str_register_n(path, length);
-        free(path);
+    err = load(source, fd);
+    close(fd);
+    return err;
+}
 
-        path = strrchr(source.path, '/');
-        source.dirlen = path - source.path;
-    } else {
-        source.path = name;
+/* Make sure static path buffer has room for string of given length.
+ */
+static char *path_buffer(size_t len)
+{
+    if (len + 1 > inc_path_len) {
+        inc_path_len = (len + 1) * 2;
+        inc_path = realloc(inc_path, inc_path_len * sizeof(*inc_path));
     }
 
-    source.file = fopen(source.path, "r");
-    if (source.file) {
-        current_file = push(source);
-    } else {
-        include_system_file(name);
-    }
+    return inc_path;
 }
 
-void include_system_file(const char *name)
+/* Find file in directories on search path, returning registered string with
+ * full path, or NULL if not found.
+ */
+static const char *resolve_system_file(const char *name)
 {
-    struct source source = {0};
     int i;
+    struct hash_entry *entry;
+    const char *path = NULL;
+    char *buf;
+    size_t dir, len;
 
     assert(search_path_count);
 
-    for (i = 0; i < search_path_count; ++i) {
-        size_t dir = strlen(search_path[i]);
-        size_t len = dir + strlen(name) + 1;
-
-        if (len > inc_path_len) {
-            inc_path_len = len * 2;
-            inc_path = realloc(inc_path, inc_path_len * sizeof(*inc_path));
-        }
+    len = strlen(name);
+    buf = path_buffer(len + 1);
+    buf[0] = '<';
+    strcpy(buf + 1, name);
+    entry = hash_table_lookup(&resolved, buf);
+    if (entry) {
+        return entry->value;
+    }
 
-        strcpy(inc_path, search_path[i]);
-        if (inc_path[dir - 1] == '/') {
+    for (i = 0; i < search_path_count; ++i) {
+        dir = strlen(search_path[i]);
+        buf = path_buffer(dir + len + 1);
+        strcpy(buf, search_path[i]);
+        if (buf[dir - 1] == '/') {
             /* Include paths can be specified with or without trailing slash.
              * Do not normalize initially, but handle it here. */
             dir--;
         } else {
-            inc_path[dir] = '/';
+            buf[dir] = '/';
         }
 
-        strcpy(inc_path + dir + 1, name);
-        source.file = fopen(inc_path, "r");
-        if (source.file) {
-            char *end = strrchr(inc_path, '/');
-            source.path = str_register_n(inc_path, len);
-            source.dirlen = end - inc_path;
+        strcpy(buf + dir + 1, name);
+        if (file_exists(buf)) {
+            path = str_register(buf);
             break;
         }
     }
 
-    if (source.file) {
-        current_file = push(source);
+    buf = path_buffer(len + 1);
+    buf[0] = '<';
+    strcpy(buf + 1, name);
+    hash_table_insert(&resolved, buf)->value = (void *) path;
+    return path;
+}
+
+/* Find file relative to directory of current file, or on the search path if
+ * not found there.
+ */
+static const char *resolve_file(const char *name)
+{
+    struct hash_entry *entry;
+    const char *path;
+    char *buf, *key;
+    size_t len;
+
+    /* Construct path by combining current directory and include name, which
+     * itself can include folders. */
+    len = current_file.dirlen + strlen(name) + 1;
+    buf = path_buffer(len + 1);
+    buf[0] = '"';
+    if (current_file.dirlen) {
+        strncpy(buf + 1, current_file.path, current_file.dirlen);
+        buf[current_file.dirlen + 1] = '/';
+        strcpy(buf + current_file.dirlen + 2, name);
     } else {
+        strcpy(buf + 1, name);
+    }
+
+    entry = hash_table_lookup(&resolved, buf);
+    if (entry) {
+        return entry->value;
+    }
+
+    if (file_exists(buf + 1)) {
+        path = str_register(buf + 1);
+        hash_table_insert(&resolved, buf)->value = (void *) path;
+    } else {
+        key = strdup(buf);
+        path = resolve_system_file(name);
+        hash_table_insert(&resolved, key)->value = (void *) path;
+        free(key);
+    }
+
+    return path;
+}
+
+/* Push file at resolved path, unless it can be skipped.
+ */
+static void include_path(const char *name, const char *path)
+{
+    struct source source = {0};
+    const char *sep;
+
+    if (!path) {
         error("Unable to resolve include file '%s'.", name);
         exit(1);
     }
+
+    if (is_skipped(path)) {
+        return;
+    }
+
+    if (open_source(&source, path)) {
+        error("Unable to read include file '%s'.", path);
+        exit(1);
+    }
+
+    source.path = path;
+    sep = strrchr(path, '/');
+    if (sep) {
+        source.dirlen = sep - path;
+    }
+
+    current_file = push(source);
+}
+
+void include_file(const char *name)
+{
+    include_path(name, resolve_file(name));
+}
+
+void include_system_file(const char *name)
+{
+    include_path(name, resolve_system_file(name));
+}
+
+void track_include_guard(enum guard_line line, const char *macro, int depth)
+{
+    struct source *source;
+
+    if (!src_count) {
+        return;
+    }
+
+    source = &src_stack[src_count - 1];
+    switch (source->guard_state) {
+    case GUARD_START:
+        if (line == LINE_IFNDEF) {
+            source->guard_state = GUARD_OPEN;
+            source->guard = macro;
+            source->guard_depth = depth;
+        } else {
+            source->guard_state = GUARD_NONE;
+        }
+        break;
+    case GUARD_OPEN:
+        if (depth == source->guard_depth + 1) {
+            if (line == LINE_ENDIF) {
+                source->guard_state = GUARD_CLOSED;
+            } else if (line == LINE_ELSE) {
+                source->guard_state = GUARD_NONE;
+            }
+        }
+        break;
+    case GUARD_CLOSED:
+        source->guard_state = GUARD_NONE;
+        break;
+    default:
+        break;
+    }
+}
+
+void pragma_once(void)
+{
+    int i;
+    struct source *source;
+
+    assert(src_count);
+    source = &src_stack[src_count - 1];
+    for (i = 0; i < once_count; ++i) {
+        if (once[i].dev == source->dev && once[i].ino == source->ino) {
+            return;
+        }
+    }
+
+    once_count++;
+    once = realloc(once, once_count * sizeof(*once));
+    once[once_count - 1].dev = source->dev;
+    once[once_count - 1].ino = source->ino;
 }
 
 void add_include_search_path(const char *path)
@@ -190,17 +518,19 @@ void init(const char *path)
     if (path) {
         const char *sep = strrchr(path, '/');
         source.path = path;
-        source.file = fopen(path, "r");
         if (sep) {
             source.dirlen = sep - path;
         }
-        if (!source.file) {
+        if (open_source(&source, path)) {
             error("Unable to open file %s.", path);
             exit(1);
         }
     } else {
-        source.file = stdin;
         source.path = "<stdin>";
+        if (load(&source, STDIN_FILENO)) {
+            error("Unable to read from stdin.");
+            exit(1);
+        }
     }
 
     current_file = push(source);
@@ -209,119 +539,236 @@ void init(const char *path)
     atexit(finalize);
 }
 
-/* Read characters from stream and assemble a line.
- *
- *  - Keep track of and remove comments.
- *  - Join lines ending with '\'.
- *
- * Increment line counter in fnt structure for each line consumed. Ignore all-
- * whitespace lines.
+/* Determine if all characters in range are space or tab.
  */
-static int getcleanline(char **lineptr, size_t *n, struct source *fn)
+static int is_blank(const char *str, size_t len)
 {
-    enum { NORMAL, COMMENT } state = 0;
-    int c, next;            /* Return value of getc. */
-    int i = 0,              /* Number of chars written to output buffer. */
-        last = '\0';        /* Last non-whitespace character consumed. */
-    assert(fn);
+    size_t i;
 
-    /* Need to have room for terminating '\0' byte. */
-    if (!*n) {
-        *n = 1;
-        *lineptr = calloc(1, sizeof(**lineptr));
-    }
+    for (i = 0; i < len; ++i)
+        if (!isblank(str[i]))
+            return 0;
+
+    return 1;
+}
 
-    while ((c = getc(fn->file)) != EOF) {
+/* Remove comments and join lines ending with '\', copying characters in place
+ * towards the start of the line. The result is never longer than the input
+ * consumed, so the write position can not overtake the read position.
+ *
+ * Whitespace of lines without other content is discarded.
+ */
+static char *cleanline(struct source *fn, size_t *length)
+{
+    enum { NORMAL, COMMENT } state = NORMAL;
+    char c, last = '\0',   /* Last non-whitespace character consumed. */
+         *line = fn->pos,   /* Start of output. */
+         *w = fn->pos;      /* Next position to write output. */
+
+    while (fn->pos < fn->end) {
+        c = *fn->pos++;
         /* Line continuation */
         if (c == '\\') {
-            next = getc(fn->file);
-            if (next == EOF) {
+            if (fn->pos == fn->end) {
                 error("Invalid end of file after line continuation.");
                 exit(1);
             }
-            if (next == '\n') {
+            if (*fn->pos == '\n') {
+                fn->pos++;
                 fn->line++;
                 continue;
             }
-            ungetc(next, fn->file);
         }
         /* End of comment. */
         if (state == COMMENT) {
-            if (c == '*') {
-                next = getc(fn->file);
-                if (next == '/')
-                    state = NORMAL;
-                else
-                    ungetc(next, fn->file);
+            if (c == '*' && *fn->pos == '/') {
+                fn->pos++;
+                state = NORMAL;
             } else if (c == '\n')
                 fn->line++;
             continue;
         }
         /* Start of comment. */
-        if (c == '/') {
-            next = getc(fn->file);
-            if (next == '*') {
-                state = COMMENT;
-                continue;
-            }
-            ungetc(next, fn->file);
+        if (c == '/' && *fn->pos == '*') {
+            fn->pos++;
+            state = COMMENT;
+            continue;
         }
         /* End of line, return if we have some content. */
         if (c == '\n') {
             fn->line++;
             if (last != '\0')
                 break;
-            else
-                continue;
+            line = w = fn->pos;
+            continue;
         }
         /* Count non-whitespace. */
         if (!isblank(c)) {
             last = c;
         }
+        *w++ = c;
+    }
 
-        /* Make sure we have room for trailing null byte, and copy character. */
-        if (i + 1 >= *n) {
-            *n = (i + 1) * 2;
-            *lineptr = realloc(*lineptr, (*n) * sizeof(**lineptr));
+    *w = '\0';
+    *length = (last != '\0') ? w - line : 0;
+    return line;
+}
+
+/* Get next line with content from source buffer.
+ *
+ *  - Keep track of and remove comments.
+ *  - Join lines ending with '\'.
+ *
+ * Increment line counter in fnt structure for each line consumed. Ignore all-
+ * whitespace lines.
+ *
+ * Lines without any comment or continuation are returned directly by
+ * terminating them in the buffer, which is the common case. Scanning for line
+ * endings and special characters is done with memchr, which is typically
+ * vectorized by the C library.
+ */
+static int getcleanline(char **lineptr, struct source *fn)
+{
+    char *line, *end;
+    size_t len;
+    assert(fn);
+
+    while (fn->pos < fn->end) {
+        line = fn->pos;
+        end = memchr(line, '\n', fn->end - line);
+        len = (end ? end : fn->end) - line;
+        if (memchr(line, '/', len) || memchr(line, '\\', len)) {
+            line = cleanline(fn, &len);
+            if (!len)
+                continue;
+        } else {
+            fn->pos = line + len;
+            if (end) {
+                fn->pos++;
+                fn->line++;
+            }
+            if (is_blank(line, len))
+                continue;
+            line[len] = '\0';
         }
-        (*lineptr)[i++] = c;
+
+        *lineptr = line;
+        return len;
     }
 
-    (*lineptr)[i] = '\0';
-    return i;
+    return 0;
 }
 
-int getprepline(char **buffer)
+/* Read next line from top of stack, popping files that are completely read.
+ * Return -1 on end of input.
+ */
+static int readline(char **buffer)
 {
-    int read,
-        processed;
+    int read;
 
     while (1) {
         if (!src_count) {
             return -1;
         }
 
-        read =
-            getcleanline(
-                &input_line,
-                &input_line_len,
-                &src_stack[src_count - 1]);
-
-        if (read == 0) {
-            if (pop() == EOF) {
-                return -1;
-            }
-            continue;
+        read = getcleanline(buffer, &src_stack[src_count - 1]);
+        if (read) {
+            break;
         }
 
-        processed = read;
-        break;
+        if (pop() == EOF) {
+            return -1;
+        }
     }
 
-    *buffer = input_line;
     current_file = src_stack[src_count - 1];
+    return read;
+}
+
+int getprepline(char **buffer)
+{
+    int processed;
 
-    verbose("(%s, %d): `%s`", current_file.path, current_file.line, input_line);
+    processed = readline(buffer);
+    if (processed != -1) {
+        verbose("(%s, %d): `%s`",
+            current_file.path, current_file.line, *buffer);
+    }
 
     return processed;
 }
+
+enum conditional {
+    NOT_CONDITIONAL,
+    CONDITIONAL_IF,
+    CONDITIONAL_ELSE,
+    CONDITIONAL_ENDIF
+};
+
+/* Classify line as conditional directive, looking only at the directive
+ * name.
+ */
+static enum conditional conditional(const char *line)
+{
+    const char *end;
+
+    while (isblank(*line))
+        line++;
+
+    if (*line != '#')
+        return NOT_CONDITIONAL;
+
+    do {
+        line++;
+    } while (isblank(*line));
+
+    for (end = line; isalnum(*end) || *end == '_'; ++end)
+        ;
+
+    switch (end - line) {
+    case 2:
+        if (!strncmp("if", line, 2))
+            return CONDITIONAL_IF;
+        break;
+    case 4:
+        if (!strncmp("elif", line, 4) || !strncmp("else", line, 4))
+            return CONDITIONAL_ELSE;
+        break;
+    case 5:
+        if (!strncmp("ifdef", line, 5))
+            return CONDITIONAL_IF;
+        if (!strncmp("endif", line, 5))
+            return CONDITIONAL_ENDIF;
+        break;
+    case 6:
+        if (!strncmp("ifndef", line, 6))
+            return CONDITIONAL_IF;
+        break;
+    }
+
+    return NOT_CONDITIONAL;
+}
+
+int skip_inactive_lines(char **buffer)
+{
+    int read, depth = 0;
+    enum conditional type;
+
+    while ((read = readline(buffer)) != -1) {
+        type = conditional(*buffer);
+        if (type == CONDITIONAL_IF) {
+            depth++;
+        } else if (type != NOT_CONDITIONAL) {
+            if (!depth) {
+                verbose("(%s, %d): `%s`",
+                    current_file.path, current_file.line, *buffer);
+                break;
+            }
+            if (type == CONDITIONAL_ENDIF) {
+                depth--;
+            }
+        }
+    }
+
+    return read;
+}
@@ -1,11 +1,17 @@
 #ifndef INPUT_H
 #define INPUT_H
 
-#include <stdio.h>
+#include <sys/types.h>
 #include <stddef.h>
 
 struct source {
-    FILE *file;
+    /* Contents of file, terminated by null byte. Lines are cleaned and
+     * returned in place. */
+    char *buffer;
+
+    /* Position of next character to read, and end of buffer. */
+    char *pos;
+    char *end;
 
     /* Full path, or relative to invocation directory. */
     const char *path;
@@ -16,6 +22,30 @@ struct source {
 
     /* Current line. */
     int line;
+
+    /* Identify file for #pragma once. */
+    dev_t dev;
+    ino_t ino;
+
+    /* State of include guard detection. The whole file is guarded if the
+     * first line is #ifndef, and the matching #endif is the last line. */
+    enum {
+        GUARD_START,
+        GUARD_OPEN,
+        GUARD_CLOSED,
+        GUARD_NONE
+    } guard_state;
+    const char *guard;
+    int guard_depth;
+};
+
+/* Lines reported by the preprocessor to detect include guards.
+ */
+enum guard_line {
+    LINE_IFNDEF,
+    LINE_ELSE,
+    LINE_ENDIF,
+    LINE_OTHER
 };
 
 /* Initialize with root file name, and store relative path to resolve later
@@ -28,16 +58,38 @@ void init(const char *);
  */
 void add_include_search_path(const char *);
 
-/* Push new include file.
+/* Push new include file. Files that are known to be wrapped in an include
+ * guard which is currently defined, or marked with #pragma once, are skipped
+ * without being read.
  */
 void include_file(const char *);
 void include_system_file(const char *);
 
+/* Track whether the current file is completely wrapped in a single #ifndef
+ * GUARD ... #endif, called for each line before it is processed. Macro name is
+ * given for LINE_IFNDEF, and depth is the number of enclosing conditional
+ * directives. The guard is remembered for the path when end of file is
+ * reached.
+ */
+void track_include_guard(enum guard_line line, const char *macro, int depth);
+
+/* Never include current file again.
+ */
+void pragma_once(void);
+
 /* Yield next line ready for further preprocessing. Comments and all-whitespace
- * lines are removed.
+ * lines are removed. The line is valid until the end of the file it is read
+ * from is reached.
  */
 int getprepline(char **);
 
+/* Skip lines in inactive block of conditional inclusion, without further
+ * processing. Nested conditional directives are matched by looking only at the
+ * directive name. Yield the first #elif, #else or #endif belonging to the
+ * current block, or -1 on end of input.
+ */
+int skip_inactive_lines(char **);
+
 /* Expose global state to other components.
  */
 extern struct source current_file;
@@ -1,26 +1,38 @@
 #include "input.h"
 #include "macro.h"
-#include "strtab.h"
 #include "tokenize.h"
+#include <lacc/strtab.h>
 #include <lacc/cli.h>
 #include <lacc/hash.h>
 
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdio.h>
 
 #define HASH_TABLE_LENGTH 1024
 
+/* Macro names are indices of interned strings, and can be compared as
+ * integers. The index is also used as hash value, avoiding hashing the
+ * string.
+ */
+#define NAME_HASH(name) ((unsigned long) (name))
+
 static struct macro
     macro_hash_table[HASH_TABLE_LENGTH];
 
+/* Name of __LINE__, which is given a new value on each expansion.
+ */
+static unsigned line_name;
+
 static int macrocmp(const struct macro *a, const struct macro *b)
 {
     int i;
 
-    if (strcmp(a->name.strval, b->name.strval) ||
+    if (a->name.str != b->name.str ||
         a->type != b->type ||
-        a->params != b->params)
+        a->params != b->params ||
+        a->size != b->size)
     {
         return 1;
     }
@@ -32,8 +44,7 @@ static int macrocmp(const struct macro *a, const struct macro *b)
             }
         } else if (
             a->replacement[i].token.token != b->replacement[i].token.token ||
-            strcmp(a->replacement[i].token.strval,
-                b->replacement[i].token.strval))
+            a->replacement[i].token.str != b->replacement[i].token.str)
         {
             return 1;
         }
@@ -57,6 +68,8 @@ static void hash_chain_cleanup(struct macro *ref)
     hash_node_free(ref);
 }
 
+static void cleanup_expansion(void);
+
 static void cleanup(void)
 {
     int i;
@@ -69,35 +82,28 @@ static void cleanup(void)
         if (ref->replacement)
             free(ref->replacement);
     }
+
+    cleanup_expansion();
 }
 
 const struct macro *definition(struct token name)
 {
     struct macro *ref;
-    unsigned long hash, pos;
+    unsigned long hash;
 
     if (name.token != IDENTIFIER)
         return NULL;
 
-    hash = djb2_hash(name.strval);
-    pos = hash % HASH_TABLE_LENGTH;
-    ref = &macro_hash_table[pos];
-    if (!ref->name.strval) {
+    hash = NAME_HASH(name.str);
+    ref = &macro_hash_table[hash % HASH_TABLE_LENGTH];
+    if (!ref->name.str) {
         return NULL;
     }
 
-    while ((ref->hash.val != hash || strcmp(ref->name.strval, name.strval)) &&
-            ref->hash.next)
+    while (ref && ref->name.str != name.str)
         ref = ref->hash.next;
 
-    if (ref->hash.val == hash && !strcmp(ref->name.strval, name.strval)) {
-        if (!strcmp(ref->name.strval, "__LINE__")) {
-            ref->replacement[0].token.intval = current_file.line;
-        }
-        return ref;
-    }
-
-    return NULL;
+    return ref;
 }
 
 void define(struct macro macro)
@@ -106,7 +112,7 @@ void define(struct macro macro)
 
     struct macro *ref;
     unsigned long
-        hash = djb2_hash(macro.name.strval),
+        hash = NAME_HASH(macro.name.str),
         pos = hash % HASH_TABLE_LENGTH;
 
     if (!clean_on_exit) {
@@ -115,20 +121,19 @@ void define(struct macro macro)
     }
 
     ref = &macro_hash_table[pos];
-    if (!ref->name.strval) {
+    if (!ref->name.str) {
         *ref = macro;
         ref->hash.val = hash;
         return;
     }
 
-    while ((ref->hash.val != hash
-            || strcmp(ref->name.strval, macro.name.strval)) && ref->hash.next)
+    while (ref->name.str != macro.name.str && ref->hash.next)
         ref = ref->hash.next;
 
-    if (ref->hash.val == hash && !strcmp(ref->name.strval, macro.name.strval)) {
+    if (ref->name.str == macro.name.str) {
         if (macrocmp(ref, &macro)) {
             error("Redefinition of macro '%s' with different substitution.",
-                macro.name.strval);
+                tokstr(macro.name));
             exit(1);
         }
         /* Already have this definition, but need to clean up memory that we
@@ -154,16 +159,16 @@ void undef(struct token name)
     if (name.token != IDENTIFIER)
         return;
 
-    hash = djb2_hash(name.strval);
+    hash = NAME_HASH(name.str);
     pos = hash % HASH_TABLE_LENGTH;
     ref = &macro_hash_table[pos];
     prev = ref;
-    if (!ref->name.strval) {
+    if (!ref->name.str) {
         return;
     }
 
     /* Special case if found in static buffer. */
-    if (ref->hash.val == hash && !strcmp(ref->name.strval, name.strval)) {
+    if (ref->name.str == name.str) {
         prev = ref->hash.next;
         if (ref->replacement)
             free(ref->replacement);
@@ -176,54 +181,19 @@ void undef(struct token name)
     }
 
     /* Get pointer to match, and predecessor. */
-    while ((ref->hash.val != hash || strcmp(ref->name.strval, name.strval))
-            && ref->hash.next)
-    {
+    while (ref->name.str != name.str && ref->hash.next) {
         prev = ref;
         ref = ref->hash.next;
     }
 
     /* Remove node in middle of list. */
-    if (ref->hash.val == hash && !strcmp(ref->name.strval, name.strval)) {
+    if (ref->name.str == name.str) {
         assert(ref != prev);
         prev->hash.next = ref->hash.next;
         hash_node_free(ref);
     }
 }
 
-/* Keep track of which macros have been expanded, avoiding recursion by looking
- * up in this list for each new expansion.
- */
-static const struct macro **expand_stack;
-static size_t stack_size;
-
-static int is_macro_expanded(const struct macro *macro)
-{
-    size_t i = 0;
-    for (; i < stack_size; ++i)
-        if (!strcmp(expand_stack[i]->name.strval, macro->name.strval))
-            return 1;
-    return 0;
-}
-
-static void push_expand_stack(const struct macro *macro)
-{
-    assert(!is_macro_expanded(macro));
-    stack_size++;
-    expand_stack = realloc(expand_stack, stack_size * sizeof(*expand_stack));
-    expand_stack[stack_size - 1] = macro;
-}
-
-static void pop_expand_stack(void)
-{
-    assert(stack_size);
-    stack_size--;
-    if (!stack_size) {
-        free(expand_stack);
-        expand_stack = NULL;
-    }
-}
-
 /* Calculate length of list, excluding trailing END marker.
  */
 static size_t len(const struct token *list)
@@ -243,49 +213,13 @@ void print_list(const struct token *list)
     while (list->token != END) {
         if (!first)
             printf(", ");
-        printf("'%s'", list->strval);
+        printf("'%s'", tokstr(*list));
         first = 0;
         list++;
     }
     printf("] (%lu)\n", l);
 }
 
-/* Extend input list with concatinating another list to it. Takes ownership of
- * both arguments.
- */
-static struct token *concat(struct token *list, struct token *other)
-{
-    size_t i = len(list);
-    size_t j = len(other);
-
-    list = realloc(list, (i + j + 1) * sizeof(*list));
-    memmove(list + i, other, (j + 1) * sizeof(*list));
-    assert(list[i + j].token == END);
-    free(other);
-    return list;
-}
-
-/* Extend input list by a single token. Take ownership of input.
- */
-static struct token *append(struct token *list, struct token other)
-{
-    size_t i = len(list);
-
-    assert(list[i].token == END);
-    list = realloc(list, (i + 2) * sizeof(*list));
-    list[i + 1] = list[i];
-    list[i] = other;
-    return list;
-}
-
-static struct token *copy(const struct token *list)
-{
-    size_t i = len(list) + 1;
-    struct token *c = calloc(i, sizeof(*c));
-
-    return memcpy(c, list, i * sizeof(*c));
-}
-
 /* Paste together two tokens.
  */
 static struct token paste(struct token left, struct token right)
@@ -294,14 +228,14 @@ static struct token paste(struct token left, struct token right)
     size_t length;
     char *data, *endptr;
 
-    length = strlen(left.strval) + strlen(right.strval);
+    length = strlen(tokstr(left)) + strlen(tokstr(right));
     data   = calloc(length + 1, sizeof(*data));
-    data   = strcpy(data, left.strval);
-    data   = strcat(data, right.strval);
+    data   = strcpy(data, tokstr(left));
+    data   = strcat(data, tokstr(right));
     result = tokenize(data, &endptr);
     if (endptr != data + length) {
         error("Invalid token resulting from pasting '%s' and '%s'.",
-            left.strval, right.strval);
+            tokstr(left), tokstr(right));
         exit(1);
     }
 
@@ -309,188 +243,475 @@ static struct token paste(struct token left, struct token right)
     return result;
 }
 
-static struct token *skip_ws(struct token *list)
+/* Set of macro names that a token must not be expanded by, because it is the
+ * result of expanding one of them. Sets are never modified after creation, and
+ * share common tails.
+ *
+ * This is the algorithm described by Dave Prosser for the C89 committee.
+ */
+struct hideset {
+    unsigned name;
+    const struct hideset *next;
+};
+
+/* Hide sets are allocated in blocks, and all released after expanding a line.
+ */
+#define HIDESET_BLOCK_SIZE 256
+
+static struct hideset_block {
+    struct hideset set[HIDESET_BLOCK_SIZE];
+    struct hideset_block *next;
+} *hideset_blocks;
+
+static int hideset_used;
+
+static int hs_contains(const struct hideset *hs, unsigned name)
 {
-    while (list->token == SPACE) list++;
-    return list;
-}
+    for (; hs; hs = hs->next)
+        if (hs->name == name)
+            return 1;
 
-#define SKIP_WS(lst) \
-    while (lst->token == SPACE) lst++;
+    return 0;
+}
 
-/* In-place expansion of token paste operators, '##'.
- * ['foo', ' ', '##', '_f', ' ', '##', ' ', 'u', '##', 'nc']
- * becomes
- * ['foo_func']
- *
- * NB: Probably not preserving whitespace..
- */
-static struct token *expand_paste_operators(struct token *list)
+static const struct hideset *hs_add(const struct hideset *hs, unsigned name)
 {
-    struct token
-        *start = list,
-        *end;
+    struct hideset_block *block;
+    struct hideset *set;
 
-    if (list->token == END) {
-        return list;
+    if (hs_contains(hs, name)) {
+        return hs;
     }
 
-    end = skip_ws(list + 1);
-
-    if (start->token == TOKEN_PASTE) {
-        error("Invalid token paste operator at beginning of line.");
-        exit(1);
+    if (!hideset_blocks || hideset_used == HIDESET_BLOCK_SIZE) {
+        block = malloc(sizeof(*block));
+        block->next = hideset_blocks;
+        hideset_blocks = block;
+        hideset_used = 0;
     }
 
-    while (end->token != END) {
-        if (end->token == TOKEN_PASTE) {
-            end = skip_ws(end + 1);
-            if (end->token == END) {
-                error("Invalid paste operator at end of line.");
-                exit(1);
-            }
-            *start = paste(*start, *end);
-            end = skip_ws(end + 1);
-        } else {
-            do {
-                start++;
-                *start = *end++;
-            } while (end->token == SPACE);
-        }
+    set = &hideset_blocks->set[hideset_used++];
+    set->name = name;
+    set->next = hs;
+    return set;
+}
+
+static const struct hideset *hs_union(
+    const struct hideset *a,
+    const struct hideset *b)
+{
+    if (!a) {
+        return b;
     }
 
-    *(start + 1) = *end;
-    return list;
+    for (; b; b = b->next)
+        a = hs_add(a, b->name);
+
+    return a;
 }
 
-static struct token *expand_macro(
-    const struct macro *macro,
-    struct token *args[])
+static const struct hideset *hs_intersection(
+    const struct hideset *a,
+    const struct hideset *b)
 {
-    size_t i;
-    struct token *res = calloc(1, sizeof(*res));
+    const struct hideset *hs = NULL;
 
-    res[0] = token_end;
-    push_expand_stack(macro);
-    for (i = 0; i < macro->size; ++i) {
-        int n = macro->replacement[i].param;
-        if (n) {
-            /* Create a copy of args before expanding to avoid it being
-             * free'd. */
-            res = concat(res, expand(copy(args[n - 1])));
-        } else if (
-            i < macro->size - 1 &&
-            macro->replacement[i].token.token == '#' &&
-            macro->replacement[i + 1].param)
-        {
-            i++;
-            n = macro->replacement[i].param;
-            res = append(res, stringify(args[n - 1]));
-        } else {
-            res = append(res, macro->replacement[i].token);
+    for (; a; a = a->next)
+        if (hs_contains(b, a->name))
+            hs = hs_add(hs, a->name);
+
+    return hs;
+}
+
+/* Free all hide sets, keeping one block for the next expansion.
+ */
+static void hs_release(void)
+{
+    struct hideset_block *block;
+
+    if (hideset_blocks) {
+        while ((block = hideset_blocks->next) != NULL) {
+            hideset_blocks->next = block->next;
+            free(block);
         }
+        hideset_used = 0;
     }
-    res = expand_paste_operators(res);
-    res = expand(res);
-    pop_expand_stack();
+}
+
+/* Token with hide set, used during expansion.
+ */
+struct xtoken {
+    struct token token;
+    const struct hideset *hs;
+};
+
+struct xlist {
+    struct xtoken *elem;
+    size_t length;
+    size_t cap;
+};
+
+/* Tokens not yet scanned, in reverse order with the next token last. Result of
+ * substituting a macro is pushed back, and rescanned together with the rest of
+ * the input.
+ */
+static struct xlist stack;
+
+/* Arguments of macro invocations being substituted. Each argument is
+ * terminated by an END token.
+ */
+static struct xlist args;
+
+/* Replacement lists being constructed, and expanded output of each line.
+ */
+static struct xlist body;
+static struct xlist output;
+
+static void cleanup_expansion(void)
+{
+    hs_release();
+    free(hideset_blocks);
+    free(stack.elem);
+    free(args.elem);
+    free(body.elem);
+    free(output.elem);
+}
 
-    for (i = 0; i < macro->params; ++i) {
-        free(args[i]);
+static void xlist_push(
+    struct xlist *list,
+    struct token token,
+    const struct hideset *hs)
+{
+    if (list->length == list->cap) {
+        list->cap = (list->cap) ? list->cap * 2 : 64;
+        list->elem = realloc(list->elem, list->cap * sizeof(*list->elem));
     }
-    free(args);
-    return res;
+
+    list->elem[list->length].token = token;
+    list->elem[list->length].hs = hs;
+    list->length++;
 }
 
-static const struct token *skip_to(const struct token *list, int token)
+/* Remove trailing whitespace from list, not going further back than start.
+ */
+static void xlist_trim(struct xlist *list, size_t start)
 {
-    while (list->token == SPACE) list++;
-    if (list->token != token) {
-        assert(reserved[token]);
-        error("Expected '%s', but got '%s'.", reserved[token], list->strval);
+    while (list->length > start
+        && list->elem[list->length - 1].token.token == SPACE)
+    {
+        list->length--;
     }
-    return list;
 }
 
-static const struct token *skip_past(const struct token *list, int token)
+/* Push tokens in range of list to stack, in reverse order so that the first
+ * one is scanned next.
+ */
+static void push_range(const struct xlist *list, size_t start, size_t end)
 {
-    list = skip_to(list, token) + 1;
-    while (list->token == SPACE) list++;
-    return list;
+    while (end > start) {
+        end--;
+        xlist_push(&stack, list->elem[end].token, list->elem[end].hs);
+    }
 }
 
-static enum token_type peek_next(const struct token *list)
+/* Determine if the next token on stack, ignoring whitespace, is an opening
+ * parenthesis.
+ */
+static int is_invocation(size_t base)
 {
-    while (list->token == SPACE) list++;
-    return list->token;
+    size_t i = stack.length;
+
+    while (i > base && stack.elem[i - 1].token.token == SPACE)
+        i--;
+
+    return i > base && stack.elem[i - 1].token.token == '(';
 }
 
-/* Read argument in macro expansion, starting from one offset from the initial
- * open parenthesis. Stop readin when reaching a comma, and nesting depth is
- * zero. Track nesting depth to allow things like MAX( foo(a), b ).
+/* Read arguments of function-like macro invocation from stack, appending them
+ * to the list of arguments. Leading and trailing whitespace of each argument
+ * is removed. Return hide set of the closing parenthesis.
  */
-static struct token *read_arg(
-    const struct token *list,
-    const struct token **endptr)
+static const struct hideset *read_args(const struct macro *def, size_t base)
 {
-    size_t n = 0;
-    struct token *arg = calloc(1, sizeof(*arg));
+    struct xtoken t;
+    size_t arg = args.length, n = 0;
     int nesting = 0;
 
-    SKIP_WS(list);
-    do {
-        if (list->token == END) {
-            error("Unexpected end of input in expansion.");
+    while (stack.elem[--stack.length].token.token != '(')
+        ;
+
+    while (1) {
+        if (stack.length == base) {
+            error("Unbalanced invocation of macro '%s'.", tokstr(def->name));
             exit(1);
         }
-        if (list->token == '(') {
+
+        t = stack.elem[--stack.length];
+        if (t.token.token == ')' && !nesting) {
+            break;
+        }
+
+        if (t.token.token == ',' && !nesting) {
+            xlist_trim(&args, arg);
+            xlist_push(&args, token_end, NULL);
+            arg = args.length;
+            n++;
+            continue;
+        }
+
+        if (t.token.token == '(') {
             nesting++;
-        } else if (list->token == ')') {
+        } else if (t.token.token == ')') {
             nesting--;
-            if (nesting < 0) {
-                error("Negative nesting depth in expansion.");
+        } else if (t.token.token == SPACE && args.length == arg) {
+            continue;
+        }
+
+        xlist_push(&args, t.token, t.hs);
+    }
+
+    xlist_trim(&args, arg);
+    if (n || args.length > arg || def->params) {
+        xlist_push(&args, token_end, NULL);
+        n++;
+    }
+
+    if (n != def->params) {
+        error("Macro '%s' expects %lu arguments, but got %lu.",
+            tokstr(def->name), def->params, n);
+        exit(1);
+    }
+
+    return t.hs;
+}
+
+/* Find start of n-th argument, counting from 1, read from position start.
+ */
+static size_t arg_start(size_t start, int n)
+{
+    while (--n) {
+        while (args.elem[start].token.token != END)
+            start++;
+        start++;
+    }
+
+    return start;
+}
+
+static size_t arg_end(size_t start)
+{
+    while (args.elem[start].token.token != END)
+        start++;
+
+    return start;
+}
+
+/* Index of next replacement element that is not whitespace, or size of
+ * replacement list if there is none.
+ */
+static size_t skip_replacement_ws(const struct macro *def, size_t i)
+{
+    while (i < def->size
+        && !def->replacement[i].param
+        && def->replacement[i].token.token == SPACE)
+    {
+        i++;
+    }
+
+    return i;
+}
+
+static int is_replacement_token(const struct macro *def, size_t i, int token)
+{
+    return i < def->size
+        && !def->replacement[i].param
+        && def->replacement[i].token.token == token;
+}
+
+static void expand_tokens(size_t base, struct xlist *out);
+
+/* Convert argument to string, ignoring hide sets.
+ */
+static struct token stringify_arg(size_t start, size_t end)
+{
+    struct token *list, t;
+    size_t i;
+
+    list = calloc(end - start + 1, sizeof(*list));
+    for (i = start; i < end; ++i) {
+        list[i - start] = args.elem[i].token;
+    }
+
+    list[end - start] = token_end;
+    t = stringify(list);
+    free(list);
+    return t;
+}
+
+/* Substitute parameters in replacement list of macro, with arguments read
+ * from position start. Arguments are fully expanded before substitution,
+ * except when they are operands of '#' or '##'. The result, with hide set
+ * added, is pushed to the stack for rescanning.
+ *
+ * The body is built at the end of the shared list of replacements. Output of
+ * expanding an argument is written directly to the same list.
+ */
+static void substitute(
+    const struct macro *macro,
+    size_t start,
+    const struct hideset *hs,
+    struct xlist *out)
+{
+    size_t i, j, a, end, mark = body.length, left = body.length, top;
+    struct xtoken *last;
+    const struct replacement *r;
+    const struct hideset *prev, *union_hs;
+    const struct macro *def;
+
+    for (i = 0; i < macro->size; ++i) {
+        r = &macro->replacement[i];
+
+        /* Remember where output of each element starts, so that '##' knows
+         * whether its left operand produced any tokens. The result of a paste
+         * is the left operand of a following '##'. */
+        if (r->param || (r->token.token != SPACE
+                && r->token.token != TOKEN_PASTE))
+        {
+            left = body.length;
+        }
+
+        if (is_replacement_token(macro, i, '#')
+            && (j = skip_replacement_ws(macro, i + 1)) < macro->size
+            && macro->replacement[j].param)
+        {
+            a = arg_start(start, macro->replacement[j].param);
+            xlist_push(&body, stringify_arg(a, arg_end(a)), NULL);
+            i = j;
+        } else if (is_replacement_token(macro, i, TOKEN_PASTE)) {
+            j = skip_replacement_ws(macro, i + 1);
+            if (j == macro->size) {
+                error("Invalid paste operator at end of line.");
                 exit(1);
             }
+            xlist_trim(&body, left);
+            if (macro->replacement[j].param) {
+                a = arg_start(start, macro->replacement[j].param);
+                end = arg_end(a);
+            } else {
+                a = end = 0;
+            }
+
+            /* Empty left operand is a placemarker, and the right operand is
+             * added without pasting. */
+            if (body.length == left) {
+                if (macro->replacement[j].param) {
+                    for (; a < end; ++a)
+                        xlist_push(&body, args.elem[a].token, args.elem[a].hs);
+                } else {
+                    xlist_push(&body, macro->replacement[j].token, NULL);
+                }
+            } else if (macro->replacement[j].param) {
+                if (a < end) {
+                    last = &body.elem[body.length - 1];
+                    last->token = paste(last->token, args.elem[a].token);
+                    for (a = a + 1; a < end; ++a)
+                        xlist_push(&body, args.elem[a].token, args.elem[a].hs);
+                }
+            } else {
+                last = &body.elem[body.length - 1];
+                last->token = paste(last->token, macro->replacement[j].token);
+            }
+            i = j;
+        } else if (r->param) {
+            a = arg_start(start, r->param);
+            end = arg_end(a);
+            if (is_replacement_token(
+                    macro, skip_replacement_ws(macro, i + 1), TOKEN_PASTE))
+            {
+                for (; a < end; ++a)
+                    xlist_push(&body, args.elem[a].token, args.elem[a].hs);
+            } else {
+                top = stack.length;
+                push_range(&args, a, end);
+                expand_tokens(top, &body);
+            }
+        } else {
+            xlist_push(&body, r->token, NULL);
         }
-        arg = realloc(arg, (++n + 1) * sizeof(*arg));
-        arg[n - 1] = *list++;
-        SKIP_WS(list);
-    } while (nesting || (list->token != ',' && list->token != ')'));
-
-    arg[n] = token_end;
-    *endptr = list;
-    return arg;
-}
-
-static struct token **read_args(
-    const struct token *list,
-    const struct token **endptr,
-    const struct macro *macro)
-{
-    struct token **args = calloc(macro->params, sizeof(*args));
-    int n = 0;
-
-    if (macro->type == FUNCTION_LIKE) {
-        list = skip_past(list, '(');
-        for (; n < macro->params; ++n) {
-            args[n] = read_arg(list, &list);
-            if (n < macro->params - 1) {
-                list = skip_past(list, ',');
+    }
+
+    /* Hide sets only matter for names of macros. Consecutive tokens usually
+     * have the same hide set, and can share the result of the union. */
+    prev = union_hs = NULL;
+    for (i = mark; i < body.length; ++i) {
+        if (definition(body.elem[i].token)) {
+            if (!union_hs || body.elem[i].hs != prev) {
+                prev = body.elem[i].hs;
+                union_hs = hs_union(prev, hs);
             }
+            body.elem[i].hs = union_hs;
+        }
+    }
+
+    /* Tokens before the first macro that can be expanded are not affected by
+     * rescanning, and are moved directly to output. */
+    for (i = mark; i < body.length; ++i) {
+        if ((def = definition(body.elem[i].token))
+            && !hs_contains(body.elem[i].hs, def->name.str))
+        {
+            break;
         }
-        list = skip_past(list, ')');
     }
 
-    *endptr = list;
-    return args;
+    push_range(&body, i, body.length);
+    if (out == &body) {
+        body.length = i;
+    } else {
+        for (j = mark; j < i; ++j) {
+            xlist_push(out, body.elem[j].token, body.elem[j].hs);
+        }
+        body.length = mark;
+    }
 }
 
-static int needs_expansion(const struct token *list)
+/* Scan tokens on stack above base, expanding macros and appending the result
+ * to output.
+ */
+static void expand_tokens(size_t base, struct xlist *out)
 {
+    struct xtoken t;
+    struct token line;
     const struct macro *def;
+    const struct hideset *hs;
+    size_t start;
+
+    while (stack.length > base) {
+        t = stack.elem[--stack.length];
+        def = definition(t.token);
+        if (!def || hs_contains(t.hs, def->name.str)) {
+            xlist_push(out, t.token, t.hs);
+        } else if (def->name.str == line_name) {
+            line = token_int(current_file.line);
+            xlist_push(out, line, t.hs);
+        } else if (def->type == OBJECT_LIKE) {
+            substitute(
+                def, args.length, hs_add(t.hs, def->name.str), out);
+        } else if (is_invocation(base)) {
+            start = args.length;
+            hs = read_args(def, base);
+            hs = hs_add(hs_intersection(t.hs, hs), def->name.str);
+            substitute(def, start, hs, out);
+            args.length = start;
+        } else {
+            xlist_push(out, t.token, t.hs);
+        }
+    }
+}
 
+static int needs_expansion(const struct token *list)
+{
     while (list->token != END) {
-        def = definition(*list);
-        if (def && !is_macro_expanded(def))
+        if (definition(*list))
             return 1;
         list++;
     }
@@ -500,50 +721,57 @@ static int needs_expansion(const struct token *list)
 
 struct token *expand(struct token *original)
 {
-    const struct token *list;
-    struct token *res;
+    size_t i, n;
 
     /* Do nothing if there is nothing to expand. */
     if (!needs_expansion(original))
         return original;
 
-    list = original;
-    res = calloc(1, sizeof(*res));
-    res[0] = token_end;
-    while (list->token != END) {
-        const struct macro *def = definition(*list);
-        struct token **args;
+    assert(!stack.length);
+    assert(!args.length);
+    assert(!output.length);
 
-        /* Only expand function-like macros if they appear as function
-         * invocations, beginning with an open paranthesis. */
-        if (def && !is_macro_expanded(def) &&
-            (def->type != FUNCTION_LIKE || peek_next(list + 1) == '('))
-        {
-            args = read_args(list + 1, &list, def);
-            res = concat(res, expand_macro(def, args));
-        } else {
-            res = append(res, *list++);
-        }
+    n = len(original);
+    for (i = n; i > 0; --i) {
+        xlist_push(&stack, original[i - 1], NULL);
+    }
+
+    expand_tokens(0, &output);
+    original = realloc(original, (output.length + 1) * sizeof(*original));
+    for (i = 0; i < output.length; ++i) {
+        original[i] = output.elem[i].token;
     }
 
-    free(original);
-    return res;
+    original[output.length] = token_end;
+    output.length = 0;
+    hs_release();
+    return original;
 }
 
 struct token stringify(const struct token list[])
 {
     char *str = calloc(1, sizeof(*str));
+    const char *s;
     size_t len = 0;
     struct token t = {STRING};
 
     while (list->token != END) {
-        len += strlen(list->strval);
+        /* Each run of whitespace is written as a single space. */
+        if (list->token == SPACE) {
+            s = " ";
+            while (list[1].token == SPACE) {
+                list++;
+            }
+        } else {
+            s = tokstr(*list);
+        }
+        len += strlen(s);
         str = realloc(str, (len + 1) * sizeof(*str));
-        str = strncat(str, list->strval, len);
+        str = strncat(str, s, len);
         list++;
     }
 
-    t.strval = str_register_n(str, len);
+    t.str = str_index(str, len);
     free(str);
     return t;
 }
@@ -574,11 +802,12 @@ static struct replacement *parse(char *str, size_t *out_size)
 static void register__builtin_va_end(void)
 {
     struct macro macro = {
-        {IDENTIFIER, "__builtin_va_end"},
+        {IDENTIFIER},
         FUNCTION_LIKE,
         1, /* parameters */
     };
 
+    macro.name.str = str_index("__builtin_va_end", 16);
     macro.replacement = parse(
         "@[0].gp_offset=0;"
         "@[0].fp_offset=0;"
@@ -592,41 +821,41 @@ static void register__builtin_va_end(void)
 void register_builtin_definitions(void)
 {
     struct macro macro = {
-        {IDENTIFIER, NULL, 0},
+        {IDENTIFIER},
         OBJECT_LIKE,
         0, /* parameters */
     };
 
-    macro.name.strval = "__STDC_VERSION__";
+    macro.name.str = str_index("__STDC_VERSION__", 16);
     macro.replacement = parse("199409L", &macro.size);
     define(macro);
 
-    macro.name.strval = "__STDC__";
+    macro.name.str = str_index("__STDC__", 8);
     macro.replacement = parse("1", &macro.size);
     define(macro);
 
-    macro.name.strval = "__STDC_HOSTED__";
+    macro.name.str = str_index("__STDC_HOSTED__", 15);
     macro.replacement = parse("1", &macro.size);
     define(macro);
 
-    macro.name.strval = "__LINE__";
+    macro.name.str = line_name = str_index("__LINE__", 8);
     macro.replacement = parse("0", &macro.size);
     define(macro);
 
-    macro.name.strval = "__x86_64__";
+    macro.name.str = str_index("__x86_64__", 10);
     macro.replacement = parse("1", &macro.size);
     define(macro);
 
     /* For some reason this is not properly handled by macros in musl. */
-    macro.name.strval = "__inline";
+    macro.name.str = str_index("__inline", 8);
     macro.replacement = parse(" ", &macro.size);
     define(macro);
 
-    macro.name.strval = "__FILE__";
+    macro.name.str = str_index("__FILE__", 8);
     macro.replacement = calloc(1, sizeof(*macro.replacement));
     macro.replacement[0].token.token = STRING;
-    macro.replacement[0].token.strval = current_file.path;
-    macro.replacement[0].token.intval = 0;
+    macro.replacement[0].token.str =
+        str_index(current_file.path, strlen(current_file.path));
     define(macro);
 
     register__builtin_va_end();
@@ -1,8 +1,8 @@
 #include "input.h"
 #include "macro.h"
 #include "preprocess.h"
-#include "strtab.h"
 #include "tokenize.h"
+#include <lacc/strtab.h>
 #include <lacc/cli.h>
 
 #include <assert.h>
@@ -18,23 +18,25 @@ struct builder {
     size_t length;
 };
 
+/* Remaining part of current input line, or NULL if a new line must be read.
+ */
+static char *input_line;
+
 static struct token get_preprocessing_token(void)
 {
-    static char *line;
-
     struct token r;
     char *endptr;
 
-    if (!line && getprepline(&line) == -1) {
+    if (!input_line && getprepline(&input_line) == -1) {
         r = token_end;
     } else {
-        r = tokenize(line, &endptr);
-        line = endptr;
+        r = tokenize(input_line, &endptr);
+        input_line = endptr;
         if (r.token == END) {
             /* Newlines are removed by getprepline, and never present in the
              * input data. Instead intercept end of string, which represents
              * end of line. */
-            line = NULL;
+            input_line = NULL;
             r = token_newline;
         }
     }
@@ -66,7 +68,7 @@ static struct token expect_next(struct builder *list, enum token_type type)
 {
     struct token t = get_next(list);
     if (t.token != type) {
-        error("Expected token '%s', but got '%s'.", reserved[type], t.strval);
+        error("Expected token '%s', but got '%s'.", reserved[type], tokstr(t));
         exit(1);
     }
     return t;
@@ -113,7 +115,7 @@ static void read_macro_invocation(
         list_append(list, t);
     }
     if (nesting) {
-        error("Unbalanced invocation of macro '%s'.", macro->name.strval);
+        error("Unbalanced invocation of macro '%s'.", tokstr(macro->name));
         exit(1);
     }
 }
@@ -131,17 +133,10 @@ static void read_defined_operator(struct builder *list)
     }
     if (t.token != IDENTIFIER) {
         error("Expected identifier in 'defined' clause, but got '%s'",
-            t.strval);
+            tokstr(t));
         exit(1);
     }
-    if (definition(t)) {
-        t.intval = 1;
-        t.strval = "1";
-    } else {
-        t.intval = 0;
-        t.strval = "0";
-    }
-    t.token = INTEGER_CONSTANT;
+    t = token_int(definition(t) != NULL);
     list_append(list, t);
     if (is_parens) {
         expect_next(list, ')');
@@ -166,12 +161,14 @@ static struct token *read_complete_line(struct token t)
         t = get_next(&line);
         is_expandable =
             (t.token == IF ||
-                (t.token == IDENTIFIER && !strcmp("elif", t.strval)));
+                (t.token == IDENTIFIER && !strcmp("elif", tokstr(t))));
     }
 
     while (t.token != NEWLINE && t.token != END) {
         if (t.token == IDENTIFIER) {
-            if (!strcmp("defined", t.strval) && is_directive && is_expandable) {
+            if (!strcmp("defined", tokstr(t))
+                && is_directive && is_expandable)
+            {
                 read_defined_operator(&line);
             } else if (
                 (def = definition(t)) && def->type == FUNCTION_LIKE &&
@@ -203,7 +200,7 @@ static const struct token *skip_to(const struct token *list, int token)
     while (list->token == SPACE) list++;
     if (list->token != token) {
         assert(reserved[token]);
-        error("Expected '%s', but got '%s'.", reserved[token], list->strval);
+        error("Expected '%s', but got '%s'.", reserved[token], tokstr(*list));
     }
     return list;
 }
@@ -219,7 +216,7 @@ static int eval_primary(
     list = skip_ws(list);
     switch (list->token) {
     case INTEGER_CONSTANT:
-        value = list->intval;
+        value = tokval(*list);
         break;
     case IDENTIFIER:
         /* Macro expansions should already have been done. Stray identifiers are
@@ -231,7 +228,7 @@ static int eval_primary(
         list = skip_to(list, ')');
         break;
     default:
-        error("Invalid primary expression '%s'.", list->strval);
+        error("Invalid primary expression '%s'.", tokstr(*list));
         break;
     }
     *endptr = list + 1;
@@ -501,7 +498,7 @@ static struct macro preprocess_define(
         if (line->token == IDENTIFIER) {
             int i;
             for (i = 0; i < macro.params; ++i) {
-                if (!strcmp(line->strval, params[i].strval)) {
+                if (line->str == params[i].str) {
                     macro.replacement[macro.size - 1].param = i + 1;
                     break;
                 }
@@ -523,26 +520,25 @@ static struct token pastetok(struct token a, struct token b)
     char *str;
     struct token t = {STRING};
 
-    assert(a.strval && b.strval);
-
-    len = strlen(a.strval) + strlen(b.strval);
+    len = strlen(tokstr(a)) + strlen(tokstr(b));
     str = calloc(len + 1, sizeof(*str));
-    strcpy(str, a.strval);
-    strcat(str, b.strval);
+    strcpy(str, tokstr(a));
+    strcat(str, tokstr(b));
 
-    t.strval = str_register_n(str, len);
+    t.str = str_index(str, len);
     free(str);
     return t;
 }
 
 static void preprocess_include(const struct token line[])
 {
-    struct token t = {STRING, ""};
+    struct token t = {STRING};
 
     line = skip_ws(line);
     if (line->token == STRING) {
-        include_file(line->strval);
+        include_file(tokstr(*line));
     } else if (line->token == '<') {
+        t.str = str_index("", 0);
         line = skip_ws(line + 1);
         while (line->token != END) {
             if (line->token == '>') {
@@ -552,13 +548,13 @@ static void preprocess_include(const struct token line[])
             t = pastetok(t, *line++);
         }
 
-        if (!strlen(t.strval)) {
+        if (!strlen(tokstr(t))) {
             error("Invalid include directive.");
             exit(1);
         }
 
         assert(line->token == '>');
-        include_system_file(t.strval);
+        include_system_file(tokstr(t));
     }
 }
 
@@ -591,6 +587,34 @@ static int cnd_pop(void) {
     return branch_stack.condition[--branch_stack.length];
 }
 
+/* Report directive to input, detecting whether the current file is wrapped in
+ * an include guard.
+ */
+static void track_directive(const struct token *line)
+{
+    enum guard_line type = LINE_OTHER;
+    const char *macro = NULL;
+    const struct token *name;
+
+    if (line->token == ELSE) {
+        type = LINE_ELSE;
+    } else if (line->token == IDENTIFIER) {
+        if (!strcmp("elif", tokstr(*line))) {
+            type = LINE_ELSE;
+        } else if (!strcmp("endif", tokstr(*line))) {
+            type = LINE_ENDIF;
+        } else if (!strcmp("ifndef", tokstr(*line))) {
+            name = skip_ws(line + 1);
+            if (name->token == IDENTIFIER) {
+                type = LINE_IFNDEF;
+                macro = tokstr(*name);
+            }
+        }
+    }
+
+    track_include_guard(type, macro, branch_stack.length);
+}
+
 /* Preprocess a line starting with a '#' directive. Takes ownership of input.
  *
  * Assumes input is END terminated, and not containing newline.
@@ -601,8 +625,9 @@ static void preprocess_directive(struct token *original)
 
     line = skip_to(line, '#');
     line = skip_ws(line + 1);
+    track_directive(line);
     if (line->token == IF ||
-        (line->token == IDENTIFIER && !strcmp("elif", line->strval)))
+        (line->token == IDENTIFIER && !strcmp("elif", tokstr(*line))))
     {
         /* Perform macro expansion only for if and elif directives, before doing
          * the expression parsing. */
@@ -622,32 +647,37 @@ static void preprocess_directive(struct token *original)
         }
     } else if (line->token == ELSE) {
         cnd_push(!cnd_pop() && cnd_peek());
-    } else if (line->token == IDENTIFIER && !strcmp("elif", line->strval)) {
+    } else if (line->token == IDENTIFIER && !strcmp("elif", tokstr(*line))) {
         if (!cnd_pop() && cnd_peek()) {
             cnd_push(expression(line + 1, &line));
         } else {
             cnd_push(0);
         }
-    } else if (line->token == IDENTIFIER && !strcmp("endif", line->strval)) {
+    } else if (line->token == IDENTIFIER && !strcmp("endif", tokstr(*line))) {
         cnd_pop();
-    } else if (line->token == IDENTIFIER && !strcmp("ifndef", line->strval)) {
+    } else if (line->token == IDENTIFIER && !strcmp("ifndef", tokstr(*line))) {
         line = skip_to(line + 1, IDENTIFIER);
         cnd_push(!definition(*line) && cnd_peek());
-    } else if (line->token == IDENTIFIER && !strcmp("ifdef", line->strval)) {
+    } else if (line->token == IDENTIFIER && !strcmp("ifdef", tokstr(*line))) {
         line = skip_to(line + 1, IDENTIFIER);
         cnd_push(definition(*line++) && cnd_peek());
     } else if (cnd_peek() && line->token == IDENTIFIER) {
-        if (!strcmp("define", line->strval)) {
+        if (!strcmp("define", tokstr(*line))) {
             define(preprocess_define(line + 1, &line));
-        } else if (!strcmp("undef", line->strval)) {
+        } else if (!strcmp("undef", tokstr(*line))) {
             line = skip_to(line + 1, IDENTIFIER);
             undef(*line++);
-        } else if (!strcmp("include", line->strval)) {
+        } else if (!strcmp("include", tokstr(*line))) {
             preprocess_include(line + 1);
-        } else if (!strcmp("error", line->strval)) {
+        } else if (!strcmp("error", tokstr(*line))) {
             line = skip_ws(line + 1);
-            error("%s", stringify(line).strval);
+            error("%s", tokstr(stringify(line)));
             exit(1);
+        } else if (!strcmp("pragma", tokstr(*line))) {
+            line = skip_ws(line + 1);
+            if (line->token == IDENTIFIER && !strcmp("once", tokstr(*line))) {
+                pragma_once();
+            }
         }
     }
 
@@ -655,18 +685,26 @@ static void preprocess_directive(struct token *original)
 }
 
 /* Buffer of preprocessed tokens, ready to be consumed by the parser. Configured
- * to hold at least K tokens, enabling LL(K) parsing.
+ * to hold at least K tokens after each call to next(), enabling LL(K) parsing.
+ * Deeper lookahead with peekn is also supported, reading more lines as needed.
  *
  * For the K&R grammar, it is sufficient to have K = 2.
  *
- * Cursor points to current position in lookahead buffer, the token to be
- * returned by next().
+ * Tokens are kept in a ring buffer with capacity a power of two. Head is the
+ * position of the token to be returned by next(), and tail where the next
+ * token is added. Positions are not wrapped, only when indexing the buffer.
  */
 static struct token *lookahead;
-static size_t length;
-static size_t cursor;
+static unsigned capacity;
+static unsigned head;
+static unsigned tail;
+
+static const unsigned K = 2;
 
-static const int K = 2;
+#define LOOKAHEAD_INITIAL_CAPACITY 64
+
+#define at(i) lookahead[(i) & (capacity - 1)]
+#define buffered() (tail - head)
 
 /* Toggle for producing preprocessed output (-E).
  */
@@ -677,8 +715,9 @@ static void cleanup(void)
     if (lookahead) {
         free(lookahead);
         lookahead = NULL;
-        length = 0;
-        cursor = 0;
+        capacity = 0;
+        head = 0;
+        tail = 0;
     }
 
     if (branch_stack.condition) {
@@ -689,54 +728,71 @@ static void cleanup(void)
     }
 }
 
+/* Double the capacity of lookahead buffer. Tokens are copied to their
+ * position in the new buffer, which is not the same for those wrapped around.
+ */
+static void grow_lookahead_buffer(void)
+{
+    unsigned i, n;
+    struct token *buffer;
+
+    n = (capacity) ? capacity * 2 : LOOKAHEAD_INITIAL_CAPACITY;
+    buffer = malloc(n * sizeof(*buffer));
+    for (i = head; i != tail; ++i) {
+        buffer[i & (n - 1)] = at(i);
+    }
+
+    free(lookahead);
+    lookahead = buffer;
+    capacity = n;
+}
+
 /* Add preprocessed token to lookahead buffer.
  */
 static void add(struct token t)
 {
-    size_t i = length;
-    int added = 0;
+    unsigned i = tail;
 
     /* Combine adjacent string literals. This step is done after preprocessing
      * and macro expansion; logic in preprocess_line will guarantee that we keep
      * preprocessing lines and filling up the lookahead buffer for as long as
      * there can be string continuations. */
     if (t.token == STRING) {
-        while (i && lookahead[--i].token == SPACE)
-            ;
-        if (lookahead[i].token == STRING) {
-            lookahead[i] = pastetok(lookahead[i], t);
-            added = 1;
+        while (i != head && at(i - 1).token == SPACE)
+            i--;
+        if (i != head && at(i - 1).token == STRING) {
+            at(i - 1) = pastetok(at(i - 1), t);
+            verbose("   token( %s )", tokstr(t));
+            return;
         }
     }
 
-    if (!added) {
-        length++;
-        lookahead = realloc(lookahead, length * sizeof(*lookahead));
-        lookahead[length - 1] = t;
+    if (buffered() == capacity) {
+        grow_lookahead_buffer();
     }
 
-    verbose("   token( %s )", t.strval);
+    at(tail++) = t;
+    verbose("   token( %s )", tokstr(t));
 }
 
-static void rewind_lookahead_buffer(void)
+/* Skip to the end of an inactive block, where the next line is a directive
+ * that can make the following lines active again. Lines in between are not
+ * tokenized.
+ */
+static void skip_inactive(void)
 {
-    size_t remaining;
-    assert(length >= cursor);
+    char *buffer;
 
-    remaining = length - cursor;
-    if (remaining) {
-        lookahead =
-            memmove(lookahead,
-                lookahead + cursor, remaining * sizeof(*lookahead));
+    assert(!input_line);
+    if (skip_inactive_lines(&buffer) != -1) {
+        input_line = buffer;
     }
-    length = remaining;
-    cursor = 0;
 }
 
 /* Consume at least one line, up until the final newline or end of file. Fill up
- * lookahead buffer and reset cursor.
+ * lookahead buffer to hold at least n tokens.
  */
-static void preprocess_line(void)
+static void preprocess_line(unsigned n)
 {
     static int call_cleanup;
     struct token t = {0};
@@ -746,8 +802,6 @@ static void preprocess_line(void)
         atexit(cleanup);
     }
 
-    rewind_lookahead_buffer();
-
     do {
         struct token
             *line, *expanded;
@@ -756,9 +810,16 @@ static void preprocess_line(void)
             t = get_preprocessing_token();
         } while (t.token == SPACE);
 
+        if (t.token != '#' && t.token != END) {
+            track_include_guard(LINE_OTHER, NULL, branch_stack.length);
+        }
+
         if (t.token == '#') {
             line = read_complete_line(t);
             preprocess_directive(line);
+            if (!cnd_peek()) {
+                skip_inactive();
+            }
         } else if (cnd_peek()) {
             line = read_complete_line(t);
             expanded = expand(line);
@@ -777,10 +838,10 @@ static void preprocess_line(void)
                 t = get_preprocessing_token();
             }
         }
-    } while ((length < K || t.token == STRING) && t.token != END);
+    } while ((buffered() < n || t.token == STRING) && t.token != END);
 
     /* Fill remainder of lookahead buffer. */
-    while (length < K) {
+    while (buffered() < n) {
         assert(t.token == END);
         add(t);
     }
@@ -788,30 +849,30 @@ static void preprocess_line(void)
 
 struct token next(void)
 {
-    if (cursor + K >= length) {
-        preprocess_line();
+    if (buffered() <= K) {
+        preprocess_line(K);
     }
-    return lookahead[cursor++];
+    return at(head++);
 }
 
 struct token peek(void)
 {
-    if (!length) {
+    if (!buffered()) {
         /* If peek() is the first call made, make sure there is an initial call
          * to populate the lookahead buffer. */
-        preprocess_line();
+        preprocess_line(K);
     }
-    return lookahead[cursor];
+    return at(head);
 }
 
 struct token peekn(unsigned n)
 {
-    assert(n && n <= K);
+    assert(n);
 
-    if (!length) {
-        preprocess_line();
+    if (buffered() < n) {
+        preprocess_line((n > K) ? n : K);
     }
-    return lookahead[cursor + n - 1];
+    return at(head + n - 1);
 }
 
 struct token consume(enum token_type type)
@@ -820,10 +881,10 @@ struct token consume(enum token_type type)
 
     if (t.token != type) {
         if (reserved[type])
-            error("Unexpected token '%s', expected '%s'.", t.strval,
+            error("Unexpected token '%s', expected '%s'.", tokstr(t),
                 reserved[type]);
         else
-            error("Unexpected token '%s', expected %s.", t.strval,
+            error("Unexpected token '%s', expected %s.", tokstr(t),
                 (type == IDENTIFIER) ? "identifier" :
                 (type == INTEGER_CONSTANT) ? "number" : "string");
         exit(1);
@@ -841,13 +902,13 @@ void preprocess(FILE *output)
     while (t.token != END) {
         switch (t.token) {
         case INTEGER_CONSTANT:
-            fprintf(output, "%ld", t.intval);
+            fprintf(output, "%ld", tokval(t));
             break;
         case STRING:
-            fprintf(output, "\"%s\"", t.strval);
+            fprintf(output, "\"%s\"", tokstr(t));
             break;
         default:
-            fprintf(output, "%s", t.strval);
+            fprintf(output, "%s", tokstr(t));
             break;
         }
         t = next();
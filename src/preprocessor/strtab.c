@@ -1,100 +1,180 @@
-#if _XOPEN_SOURCE < 700
-#  undef _XOPEN_SOURCE
-#  define _XOPEN_SOURCE 700 /* strndup */
-#endif
-#include "strtab.h"
+#include <lacc/strtab.h>
 #include <lacc/hash.h>
 
 #include <assert.h>
-#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define HASH_TABLE_LENGTH 1024
+/* Strings are stored in large blocks of memory, each prefixed by its hash and
+ * length, and followed by a null byte. Blocks are never moved or freed until
+ * exit, so pointers returned remain valid.
+ */
+#define ARENA_BLOCK_SIZE 65536
+
+struct block {
+    struct block *next;
+    size_t used;
+    size_t size;
+    char data[1];
+};
 
-struct string {
-    size_t length;
-    char *string;
+static struct block *arena;
 
-    struct hash {
-        unsigned long val;
-        struct string *next;
-    } hash;
-};
+/* Registered strings by index, starting from 1.
+ */
+static const char **strings;
+static unsigned strings_count;
+static unsigned strings_cap;
 
-static struct string
-    str_hash_tab[HASH_TABLE_LENGTH];
+/* Hash table with open addressing and linear probing, storing the lower bits
+ * of the hash value of each string to avoid comparing strings that can not be
+ * equal. Capacity is a power of two, and doubled when more than half full.
+ */
+static struct entry {
+    unsigned hash;
+    unsigned index;
+} *table;
 
-static void hash_node_cleanup(struct string *ref)
+static size_t table_cap;
+
+static void cleanup(void)
 {
-    if (ref->hash.next)
-        hash_node_cleanup(ref->hash.next);
+    struct block *block;
 
-    free(ref->string);
-    free(ref);
+    while (arena) {
+        block = arena->next;
+        free(arena);
+        arena = block;
+    }
+
+    free(table);
+    free(strings);
+    table = NULL;
+    table_cap = 0;
+    strings = NULL;
+    strings_count = 0;
+    strings_cap = 0;
 }
 
-static void cleanup(void)
+/* Copy string to arena, aligned such that the hash and length can be stored
+ * right before the first character.
+ */
+static const char *arena_copy(const char *s, size_t len, unsigned hash)
 {
-    int i;
-    struct string *ref;
-
-    for (i = 0; i < HASH_TABLE_LENGTH; ++i) {
-        ref = &str_hash_tab[i];
-        if (ref->hash.next)
-            hash_node_cleanup(ref->hash.next);
-        if (ref->string)
-            free(ref->string);
+    struct block *block;
+    size_t need, size;
+    char *str;
+
+    need = 2 * sizeof(size_t) + len + 1;
+    need = (need + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+    if (!arena || arena->size - arena->used < need) {
+        size = (need > ARENA_BLOCK_SIZE) ? need : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(*block) + size);
+        block->next = arena;
+        block->used = 0;
+        block->size = size;
+        arena = block;
     }
+
+    str = arena->data + arena->used + 2 * sizeof(size_t);
+    memcpy(str - 2 * sizeof(size_t), &hash, sizeof(hash));
+    memcpy(str - sizeof(size_t), &len, sizeof(size_t));
+    memcpy(str, s, len);
+    str[len] = '\0';
+    arena->used += need;
+    return str;
+}
+
+static void resize(void)
+{
+    size_t i, j, cap;
+    struct entry *prev;
+
+    prev = table;
+    cap = table_cap;
+    table_cap = (cap) ? cap * 2 : 4096;
+    table = calloc(table_cap, sizeof(*table));
+    for (i = 0; i < cap; ++i) {
+        if (prev[i].index) {
+            j = prev[i].hash & (table_cap - 1);
+            while (table[j].index)
+                j = (j + 1) & (table_cap - 1);
+            table[j] = prev[i];
+        }
+    }
+
+    free(prev);
 }
 
-static struct string *hash_insert(const char *str, size_t len)
+unsigned str_index(const char *s, size_t n)
 {
     static int reg_cleanup;
-    struct string *ref;
-    unsigned long
-        hash = djb2_hash_p(str, str + len),
-        pos = hash % HASH_TABLE_LENGTH;
+    unsigned hash;
+    const char *str;
+    size_t i;
 
     if (!reg_cleanup) {
         atexit(cleanup);
         reg_cleanup = 1;
     }
 
-    ref = &str_hash_tab[pos];
-    if (!ref->string) {
-        ref->length = len;
-        ref->string = strndup(str, len);
-        ref->hash.val = hash;
-        return ref;
+    if (2 * (strings_count + 1) > table_cap) {
+        resize();
     }
 
-    while ((ref->hash.val != hash || strncmp(ref->string, str, len)) &&
-            ref->hash.next)
-        ref = ref->hash.next;
+    hash = word_hash(s, n);
+    i = hash & (table_cap - 1);
+    while (table[i].index) {
+        if (table[i].hash == hash) {
+            str = strings[table[i].index];
+            if (str_len(str) == n && !memcmp(str, s, n)) {
+                return table[i].index;
+            }
+        }
+        i = (i + 1) & (table_cap - 1);
+    }
 
-    if (ref->hash.val == hash && !strncmp(ref->string, str, len)) {
-        return ref;
+    if (strings_count + 1 >= strings_cap) {
+        strings_cap = (strings_cap) ? strings_cap * 2 : 4096;
+        strings = realloc(strings, strings_cap * sizeof(*strings));
+        strings[0] = NULL;
     }
 
-    assert(!ref->hash.next);
-    ref->hash.next = calloc(1, sizeof(*ref));
-    ref = ref->hash.next;
+    strings[++strings_count] = arena_copy(s, n, hash);
+    table[i].hash = hash;
+    table[i].index = strings_count;
+    return strings_count;
+}
 
-    ref->length = len;
-    ref->string = strndup(str, len);
-    ref->hash.val = hash;
-    return ref;
+const char *str_at(unsigned index)
+{
+    assert(index && index <= strings_count);
+    return strings[index];
+}
+
+const char *str_register_n(const char *s, size_t n)
+{
+    return strings[str_index(s, n)];
 }
 
 const char *str_register(const char *s)
 {
-    struct string *str = hash_insert(s, strlen(s));
-    return str->string;
+    return str_register_n(s, strlen(s));
 }
 
-const char *str_register_n(const char *s, size_t n)
+size_t str_len(const char *s)
+{
+    size_t len;
+
+    memcpy(&len, s - sizeof(size_t), sizeof(size_t));
+    assert(s[len] == '\0');
+    return len;
+}
+
+unsigned str_hash(const char *s)
 {
-    struct string *str = hash_insert(s, n);
-    return str->string;
+    unsigned hash;
+
+    memcpy(&hash, s - 2 * sizeof(size_t), sizeof(hash));
+    return hash;
 }
@@ -2,8 +2,8 @@
 #  undef _XOPEN_SOURCE
 #  define _XOPEN_SOURCE 700 /* strndup, isblank */
 #endif
-#include "strtab.h"
 #include "tokenize.h"
+#include <lacc/strtab.h>
 #include <lacc/cli.h>
 
 #include <assert.h>
@@ -13,8 +13,8 @@
 #include <string.h>
 
 struct token
-    token_end = {END, "$"},
-    token_newline = {NEWLINE, "\n"};
+    token_end = {END},
+    token_newline = {NEWLINE};
 
 const char *reserved[] = {
 /* 0x00 */  "$",        "auto",     "break",    "case",
@@ -362,9 +362,61 @@ static enum token_type strtoop(char *in, char **endptr)
     return *in;
 }
 
+/* Value of integer constants, indexed by string. The same text always gives
+ * the same value.
+ */
+static long *values;
+static unsigned values_cap;
+
+static void free_values(void)
+{
+    free(values);
+}
+
+static struct token integer_constant(unsigned str, long value)
+{
+    struct token t = {INTEGER_CONSTANT};
+
+    if (str >= values_cap) {
+        if (!values_cap) {
+            atexit(free_values);
+        }
+        while (str >= values_cap) {
+            values_cap = (values_cap) ? values_cap * 2 : 1024;
+        }
+        values = realloc(values, values_cap * sizeof(*values));
+    }
+
+    values[str] = value;
+    t.str = str;
+    return t;
+}
+
+struct token token_int(long value)
+{
+    char buf[32];
+
+    sprintf(buf, "%ld", value);
+    return integer_constant(str_index(buf, strlen(buf)), value);
+}
+
+const char *tokstr(struct token t)
+{
+    return (t.str) ? str_at(t.str) : reserved[t.token];
+}
+
+long tokval(struct token t)
+{
+    assert(t.token == INTEGER_CONSTANT);
+    assert(t.str < values_cap);
+    return values[t.str];
+}
+
 struct token tokenize(char *in, char **endptr)
 {
     struct token res = {0};
+    const char *str;
+    long value;
     assert(in && endptr);
 
     *endptr = in;
@@ -374,31 +426,27 @@ struct token tokenize(char *in, char **endptr)
         res.token = SPACE;
         strtospace(in, endptr);
         assert(*endptr != in);
-        res.strval = str_register_n(in, *endptr - in);
+        res.str = str_index(in, *endptr - in);
     } else if (isalpha(*in) || *in == '_') {
         res.token = strtoident(in, endptr);
         assert(*endptr != in);
-        res.strval =
-            (res.token == IDENTIFIER) ?
-                str_register_n(in, *endptr - in) :
-                reserved[res.token];
+        if (res.token == IDENTIFIER) {
+            res.str = str_index(in, *endptr - in);
+        }
     } else if (isdigit(*in)) {
-        res.token = INTEGER_CONSTANT;
-        res.intval = strtonum(in, endptr);
+        value = strtonum(in, endptr);
         assert(*endptr != in);
-        res.strval = str_register_n(in, *endptr - in);
+        res = integer_constant(str_index(in, *endptr - in), value);
     } else if (*in == '"') {
         res.token = STRING;
-        res.strval = strtostr(in, endptr);
-        res.strval = str_register(res.strval);
+        str = strtostr(in, endptr);
+        res.str = str_index(str, strlen(str));
     } else if (*in == '\'') {
-        res.token = INTEGER_CONSTANT;
-        res.intval = strtochar(in, endptr);
+        value = strtochar(in, endptr);
         assert(*endptr != in);
-        res.strval = str_register_n(in, *endptr - in);
+        res = integer_constant(str_index(in, *endptr - in), value);
     } else {
         res.token = strtoop(in, endptr);
-        res.strval = reserved[res.token];
         assert(*endptr != in);
     }
 
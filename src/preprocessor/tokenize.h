@@ -15,6 +15,10 @@ extern const char *reserved[128];
  */
 struct token tokenize(char *in, char **endptr);
 
+/* Create integer constant token with given value.
+ */
+struct token token_int(long value);
+
 /* Global instances of tokens representing end of input, and end of line,
  * respectively.
  */
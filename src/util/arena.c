@@ -0,0 +1,137 @@
+#include <lacc/arena.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Alignment of every allocation, enough for any basic type.
+ */
+#define ARENA_ALIGN 16
+#define ALIGN(n) (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+/* Size of regular chunks. Objects larger than this get a chunk of their own,
+ * which is not reused.
+ */
+#define ARENA_CHUNK_SIZE 16384
+
+struct chunk {
+    struct chunk *next;
+    size_t size;
+};
+
+#define CHUNK_HEADER ALIGN(sizeof(struct chunk))
+#define CHUNK_DATA(c) ((char *) (c) + CHUNK_HEADER)
+
+struct arena {
+    struct chunk *chunk;
+    char *pos;
+    char *end;
+
+    /* Start of last object allocated, which can be grown in place. */
+    char *last;
+};
+
+/* Regular size chunks released from arenas, ready to be used again.
+ */
+static struct chunk *free_chunks;
+
+static void free_chunk_list(struct chunk *chunk)
+{
+    struct chunk *next;
+
+    while (chunk) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+static void cleanup(void)
+{
+    free_chunk_list(free_chunks);
+    free_chunks = NULL;
+}
+
+static void arena_grow(struct arena *arena, size_t size)
+{
+    struct chunk *chunk;
+
+    if (size <= ARENA_CHUNK_SIZE && free_chunks) {
+        chunk = free_chunks;
+        free_chunks = chunk->next;
+    } else {
+        if (size < ARENA_CHUNK_SIZE) {
+            size = ARENA_CHUNK_SIZE;
+        }
+        chunk = malloc(CHUNK_HEADER + size);
+        chunk->size = size;
+    }
+
+    chunk->next = arena->chunk;
+    arena->chunk = chunk;
+    arena->pos = CHUNK_DATA(chunk);
+    arena->end = arena->pos + chunk->size;
+}
+
+struct arena *arena_init(void)
+{
+    static int call_cleanup;
+
+    if (!call_cleanup) {
+        call_cleanup = 1;
+        atexit(cleanup);
+    }
+
+    return calloc(1, sizeof(struct arena));
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    char *ptr;
+
+    size = ALIGN(size);
+    if (size > (size_t) (arena->end - arena->pos)) {
+        arena_grow(arena, size);
+    }
+
+    ptr = arena->pos;
+    arena->pos += size;
+    arena->last = ptr;
+    return memset(ptr, 0, size);
+}
+
+void *arena_realloc(struct arena *arena, void *ptr, size_t old, size_t size)
+{
+    char *mem = ptr;
+
+    assert(size >= old);
+    if (!mem) {
+        return arena_alloc(arena, size);
+    }
+
+    if (mem == arena->last && ALIGN(size) <= (size_t) (arena->end - mem)) {
+        memset(mem + old, 0, size - old);
+        arena->pos = mem + ALIGN(size);
+        return mem;
+    }
+
+    ptr = arena_alloc(arena, size);
+    return memcpy(ptr, mem, old);
+}
+
+void arena_free(struct arena *arena)
+{
+    struct chunk *chunk, *next;
+
+    for (chunk = arena->chunk; chunk; chunk = next) {
+        next = chunk->next;
+        if (chunk->size == ARENA_CHUNK_SIZE) {
+            chunk->next = free_chunks;
+            free_chunks = chunk;
+        } else {
+            free(chunk);
+        }
+    }
+
+    free(arena);
+}
@@ -1,5 +1,12 @@
+#if _XOPEN_SOURCE < 600
+#  undef _XOPEN_SOURCE
+#  define _XOPEN_SOURCE 700 /* strdup */
+#endif
 #include <lacc/hash.h>
 
+#include <stdlib.h>
+#include <string.h>
+
 /* 
  * Hash algorithm is adapted from http://www.cse.yorku.ca/~oz/hash.html.
  */
@@ -28,3 +35,123 @@ unsigned long djb2_hash_p(const char *str, const char *endptr)
 
     return hash;
 }
+
+/* Multiply and shift to mix each word into the hash value. The multiplier is
+ * taken from MurmurHash2.
+ */
+#define MIX 0x5bd1e995
+
+unsigned long word_hash(const char *str, size_t n)
+{
+    unsigned long hash = n, word;
+
+    while (n >= sizeof(word)) {
+        memcpy(&word, str, sizeof(word));
+        hash = (hash ^ word) * MIX;
+        hash ^= hash >> 24;
+        str += sizeof(word);
+        n -= sizeof(word);
+    }
+
+    if (n) {
+        word = 0;
+        memcpy(&word, str, n);
+        hash = (hash ^ word) * MIX;
+    }
+
+    hash ^= hash >> 29;
+    hash *= MIX;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/* Find entry with key, or the empty slot where it should be inserted. Table
+ * must have non-zero capacity.
+ */
+static struct hash_entry *probe(const struct hash_table *table, const char *key)
+{
+    unsigned long i;
+    struct hash_entry *entry;
+
+    i = djb2_hash(key) & (table->capacity - 1);
+    while ((entry = &table->entry[i])->key && strcmp(entry->key, key)) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+
+    return entry;
+}
+
+/* Double the capacity, keeping the table at most half full.
+ */
+static void grow(struct hash_table *table)
+{
+    size_t i, capacity;
+    struct hash_entry *prev;
+
+    prev = table->entry;
+    capacity = table->capacity;
+    table->capacity = capacity ? capacity * 2 : 64;
+    table->entry = calloc(table->capacity, sizeof(*table->entry));
+    for (i = 0; i < capacity; ++i) {
+        if (prev[i].key) {
+            *probe(table, prev[i].key) = prev[i];
+        }
+    }
+
+    free(prev);
+}
+
+struct hash_entry *hash_table_lookup(
+    const struct hash_table *table,
+    const char *key)
+{
+    struct hash_entry *entry;
+
+    if (!table->capacity) {
+        return NULL;
+    }
+
+    entry = probe(table, key);
+    return entry->key ? entry : NULL;
+}
+
+struct hash_entry *hash_table_insert(struct hash_table *table, const char *key)
+{
+    struct hash_entry *entry;
+
+    if (table->capacity) {
+        entry = probe(table, key);
+        if (entry->key) {
+            return entry;
+        }
+    }
+
+    if (2 * (table->count + 1) > table->capacity) {
+        grow(table);
+    }
+
+    entry = probe(table, key);
+    entry->key = strdup(key);
+    entry->value = NULL;
+    table->count++;
+    return entry;
+}
+
+void hash_table_free(struct hash_table *table, void (*free_value)(void *))
+{
+    size_t i;
+
+    for (i = 0; i < table->capacity; ++i) {
+        if (table->entry[i].key) {
+            free(table->entry[i].key);
+            if (free_value && table->entry[i].value) {
+                free_value(table->entry[i].value);
+            }
+        }
+    }
+
+    free(table->entry);
+    table->entry = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
@@ -0,0 +1,56 @@
+int printf(const char *, ...);
+
+static int count(int a, int b) {
+	int n = 0;
+	if (a != b) n += 1;
+	if (a < b) n += 2;
+	if (a <= b) n += 4;
+	if (!(a > b)) n += 8;
+	if (!(a != b)) n += 16;
+	if (!a) n += 32;
+	if (3 < a) n += 64;
+	if (-1 >= b) n += 128;
+	return n;
+}
+
+static int ucount(unsigned a, unsigned b) {
+	int n = 0;
+	if (a < b) n += 1;
+	if (a >= 4000000000u) n += 2;
+	if (7u > a) n += 4;
+	if (!(b <= a)) n += 8;
+	return n;
+}
+
+static int lcount(long a, char *p) {
+	int n = 0;
+	if (a > 2000000000L) n += 1;
+	if (a < -5) n += 2;
+	if (p) n += 4;
+	if (!p) n += 8;
+	if (a) n += 16;
+	return n;
+}
+
+int main(void) {
+	int i = 0, j = 10, k = 0;
+	long big = 2100000000, neg = -6;
+
+	while (i != j) {
+		k += i;
+		i++;
+	}
+
+	do {
+		k--;
+	} while (!(k < 40));
+
+	for (i = 0; i < 4; ++i) {
+		printf("%d %d\n", count(i - 2, 1 - i), ucount(i * 2000000000u, i));
+	}
+
+	big = big + big;
+	printf("%d %d %d\n", lcount(big, (char *) &i),
+		lcount(neg, (char *) 0), lcount(0, "a"));
+	return k;
+}
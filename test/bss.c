@@ -0,0 +1,35 @@
+int printf(const char *, ...);
+
+static char big[64 << 20];
+static int counter;
+int common[16];
+int zero = 0;
+long zeros[8] = {0, 0, 0};
+
+struct point {
+	int x, y;
+	char pad[100];
+	long z;
+} origin = {0}, last = {1, 2, {0}, 3};
+
+static int next(void) {
+	static int calls;
+	static struct point p;
+	p.x += 2;
+	return ++calls + p.x;
+}
+
+int main(void) {
+	int i, sum = 0;
+
+	big[(64 << 20) - 1] = 7;
+	for (i = 0; i < 16; ++i) {
+		common[i] = i;
+		sum += zeros[i % 8] + common[i];
+	}
+
+	counter = next() + next();
+	printf("%d %d %d %d\n", sum, counter, zero, big[(64 << 20) - 1]);
+	printf("%d %d %ld %d\n", origin.x, last.y, last.z, last.pad[99]);
+	return sum + counter + zero + big[0] + (int) sizeof(big) / 1024;
+}
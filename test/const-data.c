@@ -0,0 +1,39 @@
+int printf(const char *, ...);
+
+struct entry {
+	const char *name;
+	int value;
+};
+
+static const struct entry entries[] = {
+	{"one", 1},
+	{"two", 2},
+	{"three", 3}
+};
+
+const int primes[] = {2, 3, 5, 7, 11, 13};
+
+const long zero;
+
+static const char *const names[] = {"one", "two", "three" + 2, 0};
+
+static const char *greeting(void) {
+	return "hello";
+}
+
+int main(void) {
+	int i, sum = 0;
+	static const int scale = 3;
+	const char *s = "hello";
+
+	for (i = 0; i < 3; ++i) {
+		sum += printf("%s: %d\n", entries[i].name, entries[i].value);
+		sum += entries[i].name == names[i];
+	}
+
+	for (i = 0; i < sizeof(primes) / sizeof(primes[0]); ++i)
+		sum += primes[i];
+
+	printf("%s, %s\n", names[2], greeting() + 1);
+	return sum + (s == greeting()) + scale + zero;
+}
@@ -0,0 +1,45 @@
+int printf(const char *, ...);
+
+struct s5 { char c[5]; };
+struct s12 { int a, b, c; };
+struct s40 { char c[37]; };
+struct s100 { long l[12]; char c[3]; };
+struct big { int a[2000]; };
+
+static struct s100 global = {{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12}, "ab"};
+
+static struct s12 make12(int k) {
+	struct s12 s = {0};
+	s.c = k;
+	return s;
+}
+
+static struct s100 make100(struct s100 *p) {
+	p->l[11] += 1;
+	return *p;
+}
+
+static struct big makebig(int k) {
+	struct big b = {{0}};
+	b.a[1999] = k;
+	return b;
+}
+
+int main(void) {
+	struct s12 x = make12(5), y;
+	struct s40 u = {"Hello, structure copy of odd size!!!"}, v;
+	struct s100 w = make100(&global), *pw = &w, z;
+	struct big b = makebig(9), c;
+	char str[] = "a string that is longer than sixty-four characters, to use rep";
+	char tiny[] = "hi";
+	struct s5 f = {"five"}, g;
+
+	y = x;
+	v = u;
+	z = *pw;
+	c = b;
+	g = f;
+	printf("%d %s %ld %s %d\n", y.c, v.c, z.l[11], z.c, c.a[1999]);
+	printf("%s %s %s\n", str, tiny, g.c);
+	return 0;
+}
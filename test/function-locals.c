@@ -0,0 +1,40 @@
+int printf(const char *, ...);
+
+int total = 1;
+
+static int dense(int i) {
+	switch (i) {
+	case 0: return 3;
+	case 1: return 5;
+	case 2: return 7;
+	case 3: return 11;
+	case 4: return 13;
+	default: return 0;
+	}
+}
+
+static int *counter(void) {
+	typedef int pair[2];
+	static pair count[3] = {{1, 2}, {3, 4}};
+	extern int total;
+	total += dense(2);
+	return count[1];
+}
+
+int main(void) {
+	int i, sum = 0;
+
+	for (i = 0; i < 6; ++i) {
+		switch (i) {
+		case 0: sum += dense(i); break;
+		case 1: sum += dense(i) * 2; break;
+		case 2: sum += dense(i) * 3; break;
+		case 3: sum += dense(i) * 4; break;
+		case 4: sum += dense(i) * 5; break;
+		default: sum += counter()[1]; break;
+		}
+	}
+
+	printf("%d %d\n", sum, total);
+	return sum;
+}
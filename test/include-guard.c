@@ -0,0 +1,13 @@
+#include "include-guard.h"
+#include "pragma-once.h"
+#include "include-guard.h"
+#include "pragma-once.h"
+
+#undef INCLUDE_GUARD_H
+#define AGAIN
+#include "include-guard.h"
+
+int main() {
+	struct point p = {3, 4};
+	return first + again + p.x * p.y;
+}
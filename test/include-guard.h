@@ -0,0 +1,10 @@
+#ifndef INCLUDE_GUARD_H
+#define INCLUDE_GUARD_H
+
+#ifdef AGAIN
+int again = 2;
+#else
+int first = 1;
+#endif
+
+#endif
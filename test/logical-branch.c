@@ -0,0 +1,42 @@
+int printf(const char *, ...);
+
+static int calls = 0;
+
+static int tick(int v) {
+	calls++;
+	return v;
+}
+
+static int mixed(int b, int c, int d) {
+	return (b != 0) + (c || d);
+}
+
+int main(void) {
+	int i, a = 1, b = 0, c = 2, n = 0;
+	char *p = "x", *q = 0;
+
+	if (a && b && c) n += 1;
+	if (a && (b || c)) n += 2;
+	if ((a || b) && (b || c)) n += 4;
+	if (!(a && b)) n += 8;
+	if (1 && c) n += 16;
+	if (0 || b) n += 32;
+	if (p && !q) n += 64;
+	if (tick(0) && tick(1)) n += 128;
+	if (tick(1) || tick(1)) n += 256;
+
+	for (i = 0; i < 10 && (i < 5 || c > 5); ++i)
+		n += 1000;
+
+	i = 0;
+	do {
+		i++;
+	} while (i < 3 || (i < 8 && !b));
+
+	while (a < 4 && (c || b))
+		a++;
+
+	b = (a > 3 && c) + (a < 3 || b) + ((b || 0) ? 10 : 20);
+	printf("%d %d %d %d %d %d\n", n, i, a, b, calls, mixed(99, 0, 17));
+	return 0;
+}
@@ -0,0 +1,24 @@
+int printf(const char *, ...);
+
+#define STEP(k) if (i % (k) == 0) s += t * (k); else t = t + s; \
+	while (t > 1000000) t = t - 999999;
+#define STEP4(k) STEP(k) STEP(k + 1) STEP(k + 2) STEP(k + 3)
+#define STEP16(k) STEP4(k) STEP4(k + 4) STEP4(k + 8) STEP4(k + 12)
+
+static int loop(int n) {
+	int i, s = 0, t = 1;
+
+	for (i = 0; i < n; ++i) {
+		if (i == 3) continue;
+		STEP16(2)
+		if (s < 0) break;
+	}
+
+	return s;
+}
+
+int main(void) {
+	int s = loop(50);
+	printf("%d\n", s);
+	return s & 0x7F;
+}
@@ -0,0 +1,36 @@
+#define f(x) (x + 1)
+#define g f
+#define h g(2)
+#define self self
+#define a b
+#define b a
+#define id(x) x
+#define rec(x) rec(x)
+#define cat(x, y) x ## y
+#define str(x) #x
+#define xstr(x) str(x)
+#define max(x, y) ((x) > (y) ? (x) : (y))
+#define LIST(X) X(1) X(2) X(3)
+#define PLUS(n) + n
+#define G(pre, x) foo pre ## x
+#define E(x, y) [x ## y]
+
+typedef int foo;
+
+int self = 1, a = 2, b = 3;
+
+int rec(int x) {
+	return x;
+}
+
+int main() {
+	int v = g(1) + h;
+	int w = id(id(4)) + rec(rec(5)) + max(max(1, 2), max(max(3, 7), 4));
+	int x = cat(, 3) + cat(1, ) + cat(1, 0) + 0 LIST(PLUS);
+	int y = sizeof(xstr(cat(1, 2))) == 3 && sizeof(xstr(__LINE__)) == 3;
+	int z = sizeof(str( a  +   b )) == 6 && sizeof(str(a	+  b)) == 6;
+	G(, bar) = 4;
+	int e E(, ) = {1, 2, 3, 5};
+	int u = bar + e E(, b) + e E(a, ) + sizeof(e);
+	return v + w + x + y + z + u + self + a + b;
+}
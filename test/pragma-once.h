@@ -0,0 +1,5 @@
+#pragma once
+
+struct point {
+	int x, y;
+};
@@ -0,0 +1,32 @@
+#define A 1
+
+#if 0
+# if A
+#  error nested in skipped block
+# else
+int x = 'a
+# endif
+/* #endif inside comment
+#endif */
+#elif A
+# ifdef B
+#  error not defined
+# elif A + 1 == 3
+#  error not this either
+#else
+#  define C 3
+# endif
+#else
+#  error not reached
+#endif
+
+#ifndef A
+#  error not reached
+#endif
+
+#if defined(C) \
+	&& C == 3
+int main() {
+	return C;
+}
+#endif
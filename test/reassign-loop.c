@@ -0,0 +1,26 @@
+int swap_sum(int a, int b, int n) {
+	int t, s = 0;
+
+	while (n--) {
+		t = a;
+		a = b;
+		b = t + (n & 1);
+		if (a > b)
+			s += a;
+		else
+			s -= b;
+	}
+
+	return s + a * b;
+}
+
+int main() {
+	int i, x = 0;
+
+	for (i = 0; i < 4; ++i)
+		x += i;
+	for (i = 10; i > 0; i -= 3)
+		x += i;
+
+	return x + swap_sum(3, 7, 9);
+}
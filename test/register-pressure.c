@@ -0,0 +1,29 @@
+int sum(int a, int b, int c, int d, int e, int f, int g) {
+	return a + b + c + d + e + f + g;
+}
+
+static int pair(int *p, int *q) {
+	return *p * 10 + *q;
+}
+
+static int arrays(void) {
+	int x[2] = {1, 2}, y[2] = {3, 4};
+	return pair(x, y) + pair(y + 1, x + 1);
+}
+
+int main() {
+	int i, j, a = 1, b = 2, c = 3, d = 4, e = 5, f = 6, g = 7, h = 8;
+	long total = 0;
+	char *p = "pressure";
+
+	for (i = 0; i < 10; ++i) {
+		for (j = i; j < 10; j++) {
+			total += a * i + b - c + (d ^ j) + (e & i) + (f | j) - g + h;
+			a = b;
+			b = sum(a, b, c, d, e, f, g) % 13;
+		}
+		total += p[i % 8];
+	}
+
+	return (total + arrays()) % 256;
+}
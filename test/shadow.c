@@ -0,0 +1,39 @@
+int printf(const char *, ...);
+
+#define D1(p) int p##0 = 1, p##1 = 2, p##2 = 3, p##3 = 4;
+#define D2(p) D1(p##0) D1(p##1) D1(p##2) D1(p##3) D1(p##4) D1(p##5) D1(p##6)
+#define D3(p) D2(p##0) D2(p##1) D2(p##2) D2(p##3) D2(p##4) D2(p##5) D2(p##6)
+
+D3(a)
+D3(b)
+D3(c)
+D3(d)
+
+int x = 1;
+
+static int f(int x) {
+	int a = x;
+	{
+		int x = 3;
+		a += x;
+		{
+			struct x { int x; } s = {5};
+			{
+				{
+					a += s.x;
+				}
+			}
+		}
+		{
+			int y = x;
+			a += y;
+		}
+	}
+	return a + x;
+}
+
+int main(void) {
+	a000 = d663 = 7;
+	printf("%s\n", __func__);
+	return f(x) + x + a000 + d663;
+}
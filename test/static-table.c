@@ -0,0 +1,44 @@
+int printf(const char *, ...);
+
+#define ROW(n) n, n * 3, -(n), n ^ 0x55
+#define ROW4(n) ROW(n), ROW(n + 1), ROW(n + 2), ROW(n + 3)
+#define ROW16(n) ROW4(n), ROW4(n + 4), ROW4(n + 8), ROW4(n + 12)
+
+static const int table[] = { ROW16(0), ROW16(16), ROW16(32), ROW16(48) };
+
+struct entry {
+	char tag;
+	const char *name;
+	unsigned long mask;
+	char code[6];
+	union { int i; char c[8]; } u;
+} entries[] = {
+	{'a', "first", 0xFFFFFFFFFFFFFFFFul, {'a', 'b'}, {-2}},
+	{'b', 0, 12, "abcde", {0}},
+	{0},
+	{'d', "last", 0x12345678ul, {'x', 'y'}, {7}}
+};
+
+signed char small[10] = {-1, 127, -128, 0, 5};
+long values[] = {-1L, 2147483647L, -2147483647L - 1, 0, 42};
+char word[] = "word";
+char *words[] = {"one", 0, "three"};
+
+int main(void) {
+	int i, sum = 0;
+
+	for (i = 0; i < sizeof(table) / sizeof(table[0]); ++i)
+		sum += table[i] * (i % 7);
+
+	printf("%d %d\n", sum, (int) sizeof(table));
+	for (i = 0; i < 4; ++i) {
+		printf("%c %s %lu %s %d\n", entries[i].tag ? entries[i].tag : '-',
+			entries[i].name ? entries[i].name : "(null)",
+			entries[i].mask, entries[i].code, entries[i].u.i);
+	}
+
+	printf("%d %d %d %d\n", small[0], small[1], small[2], small[9]);
+	printf("%ld %ld %ld %ld\n", values[0], values[1], values[2], values[4]);
+	printf("%s %s %s\n", word, words[0], words[2]);
+	return sum % 256;
+}
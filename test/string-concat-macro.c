@@ -0,0 +1,16 @@
+int puts(const char *s);
+
+#define SUM4(a) (a + a + a + a)
+#define SUM16(a) (SUM4(a) + SUM4(a) + SUM4(a) + SUM4(a))
+#define SUM64(a) (SUM16(a) + SUM16(a) + SUM16(a) + SUM16(a))
+#define WORLD "wo" "rld"
+
+int n = SUM64(1) + SUM64(2); char str[] = "Hello"
+	" "
+	WORLD
+	"!"; int m = SUM64(3);
+
+int main(void) {
+	puts(str);
+	return n + m + sizeof(str);
+}
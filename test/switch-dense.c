@@ -0,0 +1,61 @@
+int dense(int a) {
+	int b = 0;
+
+	switch (a) {
+	case -2: b = 1;
+	case 0: b += 2;
+		break;
+	case 1: b = 3;
+		break;
+	case 3: b = 4;
+		break;
+	case 4: b = 5;
+	case 5: b += 6;
+		break;
+	default:
+		b = 7;
+		break;
+	case 7: b = 8;
+		break;
+	}
+
+	return b;
+}
+
+int no_default(unsigned a) {
+	switch (a) {
+	case 10: return 1;
+	case 11: return 2;
+	case 12: return 3;
+	case 13: return 4;
+	case 15: return 5;
+	}
+
+	return 0;
+}
+
+int character(char c) {
+	switch (c) {
+	case 'a': return 1;
+	case 'b': return 2;
+	case 'c': return 3;
+	case 'e': return 4;
+	case 'f': return 5;
+	}
+
+	return 6;
+}
+
+int main() {
+	int i, sum = 0;
+
+	for (i = -5; i < 10; ++i)
+		sum = (sum * 3 + dense(i)) % 1000;
+
+	for (i = 8; i < 18; ++i)
+		sum = (sum * 3 + no_default(i)) % 1000;
+
+	sum += no_default(-1) + no_default(-6) + character('d') + character('f');
+	sum += character(-100) + character('a');
+	return sum % 251;
+}
@@ -0,0 +1,29 @@
+int sparse(long a) {
+	switch (a) {
+	case 1000: return 1;
+	case -70000: return 2;
+	case 5: return 3;
+	case 123456: return 4;
+	case -1: return 5;
+	case 77: return 6;
+	case 3000000: return 7;
+	case 2: return 8;
+	default: return 9;
+	}
+}
+
+int main() {
+	long big = 65536, values[] = {
+		1000, -70000, 5, 123456, -1, 77, 3000000, 2,
+		0, 3, 1001, -69999, 78, 4, 0, 0
+	};
+	int i, sum = 0;
+
+	big = big * big;
+	values[14] = big + 5;
+	values[15] = big - 1;
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+		sum = (sum * 5 + sparse(values[i])) % 1000;
+
+	return sum % 253;
+}
@@ -0,0 +1,22 @@
+typedef int vec[4];
+typedef const char *str;
+
+struct point { int x, y; };
+
+static const struct point origin = {1, 2};
+static vec values = {1, 2, 3, 4};
+
+static int sum(const vec *v, int * const *p) {
+	return (*v)[0] + (*v)[3] + **p;
+}
+
+int main(void) {
+	str s = "abc";
+	const char *t = s;
+	struct point *volatile q = (struct point *) &origin;
+	int *r = &values[1];
+	int * const *pr = &r;
+	const struct point *c = q;
+
+	return sum(&values, pr) + t[1] + c->y + sizeof(vec) + sizeof(*pr);
+}
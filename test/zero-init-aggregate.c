@@ -0,0 +1,27 @@
+int printf(const char *, ...);
+
+struct point { char c; long l; int a[3]; };
+union value { char c; long a[3]; };
+
+static int sum(const int *p, int n) {
+	int i, s = 0;
+	for (i = 0; i < n; ++i)
+		s += p[i];
+	return s;
+}
+
+int main(void) {
+	int buf[4096] = {0};
+	int small[5] = {1, 2};
+	struct point p = {1};
+	union value v = {3};
+	char odd[11] = {1};
+	static int data[1000] = {1, 2, 3};
+	struct point q[3] = {{1, 2}, {3}};
+
+	buf[7] = 7;
+	printf("%d %d %d\n", sum(buf, 4096), sum(small, 5), sum(data, 1000));
+	printf("%ld %d %ld %d\n", p.l, p.a[2], v.a[2], odd[10]);
+	printf("%d %ld %d\n", q[0].c, q[1].l, q[2].a[1]);
+	return 0;
+}